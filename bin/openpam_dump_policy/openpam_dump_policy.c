@@ -34,6 +34,7 @@
 #endif
 
 #include <ctype.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -44,14 +45,33 @@
 #include "openpam_impl.h"
 #include "openpam_asprintf.h"
 
+/*
+ * Turn a service name into something which can be part of a C identifier.
+ */
+static char *
+openpam_ident(const char *service)
+{
+	char *ident, *p;
+
+	if ((ident = strdup(service)) == NULL)
+		return (NULL);
+	for (p = ident; *p; ++p)
+		if (!isalnum((unsigned char)*p))
+			*p = '_';
+	return (ident);
+}
+
 static char *
 openpam_chain_name(const char *service, pam_facility_t fclt)
 {
 	const char *facility = pam_facility_name[fclt];
-	char *name;
+	char *ident, *name;
 
-	if (asprintf(&name, "pam_%s_%s", service, facility) == -1)
+	if ((ident = openpam_ident(service)) == NULL)
 		return (NULL);
+	if (asprintf(&name, "pam_%s_%s", ident, facility) == -1)
+		name = NULL;
+	free(ident);
 	return (name);
 }
 
@@ -68,52 +88,81 @@ openpam_facility_index_name(pam_facility_t fclt)
 	return (name);
 }
 
+/*
+ * Print a string as a C string literal.
+ */
+static void
+openpam_dump_string(const char *str)
+{
+	const char *p;
+
+	printf("\"");
+	for (p = str; *p; ++p) {
+		if (isprint((unsigned char)*p) && *p != '"' && *p != '\\')
+			printf("%c", *p);
+		else
+			printf("\\%03o", (unsigned char)*p);
+	}
+	printf("\"");
+}
+
 int
 openpam_dump_chain(const char *name, pam_chain_t *chain)
 {
-	char *modname, **opt, *p;
-	int i;
-
-	for (i = 0; chain != NULL; ++i, chain = chain->next) {
-		/* declare the module's struct pam_module */
-		modname = strrchr(chain->module->path, '/');
-		modname = strdup(modname ? modname : chain->module->path);
-		if (modname == NULL)
-			return (PAM_BUF_ERR);
-		for (p = modname; *p && *p != '.'; ++p)
-			/* nothing */ ;
-		*p = '\0';
-		printf("extern struct pam_module %s_pam_module;\n", modname);
-		/* module arguments */
+	char **opt;
+	int i, j;
+
+	/* module arguments */
+	for (i = 0; !OPENPAM_CHAIN_END(&chain[i]); ++i) {
 		printf("static char *%s_%d_optv[] = {\n", name, i);
-		for (opt = chain->optv; *opt; ++opt) {
-			printf("\t\"");
-			for (p = *opt; *p; ++p) {
-				if (isprint((unsigned char)*p) && *p != '"')
-					printf("%c", *p);
-				else
-					printf("\\x%02x", (unsigned char)*p);
-			}
-			printf("\",\n");
+		for (opt = chain[i].optv; *opt; ++opt) {
+			printf("\t");
+			openpam_dump_string(*opt);
+			printf(",\n");
 		}
 		printf("\tNULL,\n");
 		printf("};\n");
-		/* next module in chain */
-		if (chain->next != NULL)
-			printf("static pam_chain_t %s_%d;\n", name, i + 1);
-		/* chain entry */
-		printf("static pam_chain_t %s_%d = {\n", name, i);
-		printf("\t.module = &%s_pam_module,\n", modname);
-		printf("\t.flag = 0x%08x,\n", chain->flag);
-		printf("\t.optc = %d,\n", chain->optc);
-		printf("\t.optv = %s_%d_optv,\n", name, i);
-		if (chain->next)
-			printf("\t.next = &%s_%d,\n", name, i + 1);
-		else
-			printf("\t.next = NULL,\n");
+		if (chain[i].guardc == 0)
+			continue;
+		printf("static char *%s_%d_guardv[] = {\n", name, i);
+		for (opt = chain[i].guardv; *opt; ++opt) {
+			printf("\t");
+			openpam_dump_string(*opt);
+			printf(",\n");
+		}
+		printf("\tNULL,\n");
 		printf("};\n");
-		free(modname);
 	}
+	/* chain entries; the modules are looked up by name at run time */
+	printf("static pam_chain_t %s[] = {\n", name);
+	for (i = 0; !OPENPAM_CHAIN_END(&chain[i]); ++i) {
+		printf("\t{\n");
+		printf("\t\t.modname = ");
+		openpam_dump_string(chain[i].module != NULL ?
+		    chain[i].module->path : chain[i].modname);
+		printf(",\n");
+		printf("\t\t.flag = 0x%08x,\n", chain[i].flag);
+		printf("\t\t.action = {");
+		for (j = 0; j < PAM_NUM_RESULTS; ++j)
+			printf("%s%d,", j % 16 ? " " : "\n\t\t    ",
+			    chain[i].action[j]);
+		printf("\n\t\t},\n");
+		printf("\t\t.skip = {");
+		for (j = 0; j < PAM_NUM_RESULTS; ++j)
+			printf("%s%d,", j % 16 ? " " : "\n\t\t    ",
+			    chain[i].skip[j]);
+		printf("\n\t\t},\n");
+		printf("\t\t.optc = %d,\n", chain[i].optc);
+		printf("\t\t.optv = %s_%d_optv,\n", name, i);
+		if (chain[i].guardc > 0) {
+			printf("\t\t.guardc = %d,\n", chain[i].guardc);
+			printf("\t\t.guardv = %s_%d_guardv,\n", name, i);
+		}
+		printf("\t},\n");
+	}
+	/* end of chain */
+	printf("\t{ .modname = NULL },\n");
+	printf("};\n");
 	return (PAM_SUCCESS);
 }
 
@@ -121,7 +170,7 @@ int
 openpam_dump_policy(const char *service)
 {
 	pam_handle_t *pamh;
-	char *name;
+	char *ident, *name;
 	int fclt, ret;
 
 	if ((pamh = calloc(1, sizeof *pamh)) == NULL)
@@ -138,8 +187,13 @@ openpam_dump_policy(const char *service)
 				return (ret);
 		}
 	}
-	printf("static pam_policy_t pam_%s_policy = {\n", service);
-	printf("\t.service = \"%s\",\n", service);
+	if ((ident = openpam_ident(service)) == NULL)
+		return (PAM_BUF_ERR);
+	printf("static pam_policy_t pam_%s_policy = {\n", ident);
+	free(ident);
+	printf("\t.service = ");
+	openpam_dump_string(service);
+	printf(",\n");
 	printf("\t.chains = {\n");
 	for (fclt = 0; fclt < PAM_NUM_FACILITIES; ++fclt) {
 		if ((name = openpam_facility_index_name(fclt)) == NULL)
@@ -149,7 +203,7 @@ openpam_dump_policy(const char *service)
 		if (pamh->chains[fclt] != NULL) {
 			if ((name = openpam_chain_name(service, fclt)) == NULL)
 				return (PAM_BUF_ERR);
-			printf("&%s_0,\n", name);
+			printf("%s,\n", name);
 			free(name);
 		} else {
 			printf("NULL,\n");
@@ -157,6 +211,7 @@ openpam_dump_policy(const char *service)
 	}
 	printf("\t},\n");
 	printf("};\n");
+	openpam_clear_chains(pamh->chains);
 	free(pamh);
 	return (PAM_SUCCESS);
 }
@@ -165,20 +220,35 @@ static void
 usage(void)
 {
 
-	fprintf(stderr, "usage: openpam_dump_policy [-d] policy ...\n");
+	fprintf(stderr,
+	    "usage: openpam_dump_policy [-d] [-o image] [-p dir] "
+	    "policy ...\n");
 	exit(1);
 }
 
 int
 main(int argc, char *argv[])
 {
+	const char *image;
+	char *ident, *policydir;
 	int i, opt;
 
-	while ((opt = getopt(argc, argv, "d")) != -1)
+	image = NULL;
+	while ((opt = getopt(argc, argv, "do:p:")) != -1)
 		switch (opt) {
 		case 'd':
 			openpam_debug = 1;
 			break;
+		case 'o':
+			image = optarg;
+			break;
+		case 'p':
+			/* look for policies in this directory only */
+			if (asprintf(&policydir, "%s/", optarg) == -1)
+				exit(1);
+			openpam_policy_path[0] = policydir;
+			openpam_policy_path[1] = NULL;
+			break;
 		default:
 			usage();
 		}
@@ -189,13 +259,42 @@ main(int argc, char *argv[])
 	if (argc < 1)
 		usage();
 
+	/* compiled policy image instead of C source */
+	if (image != NULL) {
+		if (openpam_image_write(image, argc,
+		    (const char **)(intptr_t)argv) != PAM_SUCCESS) {
+			fprintf(stderr, "openpam_dump_policy: "
+			    "failed to write %s\n", image);
+			exit(1);
+		}
+		exit(0);
+	}
+
+	/*
+	 * Embedded policies are looked up by openpam_configure() in the
+	 * same way as policy files, so record each policy exactly as
+	 * written (but with includes expanded) and let the "other"
+	 * fallback happen at run time.  Don't load the modules either;
+	 * the names are all we need.
+	 */
+	openpam_set_feature(OPENPAM_FALLBACK_TO_OTHER, 0);
+	openpam_set_feature(OPENPAM_LAZY_MODULES, 1);
 	printf("#include <security/pam_appl.h>\n");
 	printf("#include \"openpam_impl.h\"\n");
-	for (i = 0; i < argc; ++i)
-		openpam_dump_policy(argv[i]);
+	for (i = 0; i < argc; ++i) {
+		if (openpam_dump_policy(argv[i]) != PAM_SUCCESS) {
+			fprintf(stderr, "openpam_dump_policy: "
+			    "failed to dump %s\n", argv[i]);
+			exit(1);
+		}
+	}
 	printf("pam_policy_t *pam_embedded_policies[] = {\n");
-	for (i = 0; i < argc; ++i)
-		printf("\t&pam_%s_policy,\n", argv[i]);
+	for (i = 0; i < argc; ++i) {
+		if ((ident = openpam_ident(argv[i])) == NULL)
+			exit(1);
+		printf("\t&pam_%s_policy,\n", ident);
+		free(ident);
+	}
 	printf("\tNULL,\n");
 	printf("};\n");
 	exit(0);
@@ -164,6 +164,12 @@ openpam_readlinev(FILE *_f,
 	int *_lenp)
 	OPENPAM_NONNULL((1));
 
+char **
+openpam_readlinev_packed(FILE *_f,
+	int *_lineno,
+	int *_lenp)
+	OPENPAM_NONNULL((1));
+
 char *
 openpam_readword(FILE *_f,
 	int *_lineno,
@@ -187,6 +193,13 @@ enum {
 	OPENPAM_RESTRICT_MODULE_NAME,
 	OPENPAM_VERIFY_MODULE_FILE,
 	OPENPAM_FALLBACK_TO_OTHER,
+	OPENPAM_CACHE_POLICY,
+	OPENPAM_RESIDENT_MODULES,
+	OPENPAM_POLICY_IMAGE,
+	OPENPAM_CACHE_POLICY_PATH,
+	OPENPAM_LAZY_MODULES,
+	OPENPAM_PREFER_EMBEDDED,
+	OPENPAM_MODULE_STATS,
 	OPENPAM_NUM_FEATURES
 };
 
@@ -196,6 +209,78 @@ openpam_set_feature(int _feature, int _onoff);
 int
 openpam_get_feature(int _feature, int *_onoff);
 
+/*
+ * Select the memory allocator
+ */
+struct openpam_allocator {
+	void	*(*alloc_func)(size_t, void *);
+	void	*(*realloc_func)(void *, size_t, size_t, void *);
+	void	 (*free_func)(void *, size_t, void *);
+	void	*arg;
+};
+
+int
+openpam_set_allocator(const struct openpam_allocator *_allocator);
+
+/*
+ * Per-module dispatch statistics
+ */
+#define OPENPAM_STATS_BUCKETS	24
+
+struct openpam_stats {
+	const char		*service;
+	const char		*facility;
+	const char		*module;
+	int			 primitive;
+	unsigned long		 calls;
+	unsigned long		 result[PAM_NUM_ERRORS + 1];
+	unsigned long		 latency[OPENPAM_STATS_BUCKETS];
+	unsigned long long	 nsec;
+};
+
+int
+openpam_get_stats(struct openpam_stats **_stats, size_t *_nstats)
+	OPENPAM_NONNULL((1,2));
+
+void
+openpam_reset_stats(void);
+
+/*
+ * Load any modules whose loading was deferred
+ */
+int
+openpam_check_modules(pam_handle_t *_pamh)
+	OPENPAM_NONNULL((1));
+
+/*
+ * Load policies and modules ahead of time
+ */
+int
+openpam_preload(const char **_services,
+	int *_status)
+	OPENPAM_NONNULL((1));
+
+/*
+ * Create a PAM context which shares its policy with an existing one
+ */
+int
+openpam_clone(pam_handle_t *_template,
+	pam_handle_t **_pamh)
+	OPENPAM_NONNULL((2));
+
+/*
+ * Prepare a PAM context for a new transaction
+ */
+int
+openpam_reset(pam_handle_t *_pamh,
+	const char *_user);
+
+/*
+ * Watch policy files for changes
+ */
+int
+openpam_watch_policy(int _onoff);
+
 /*
  * Log levels
  */
@@ -362,8 +447,18 @@ struct pam_module {
 #  error "Don't know how to build static modules on non-GNU compilers"
 # endif
 /* gcc, static linking */
-# include <sys/cdefs.h>
-# include <linker_set.h>
+# if defined(__linux__)
+/* no <linker_set.h>, but the linker provides __start_ and __stop_ */
+#  define _PAM_MODULE_SET(sym)						\
+	static struct pam_module *_pam_module_ptr			\
+	__attribute__((__section__("openpam_static_modules"), __used__)) \
+	    = &sym
+# else
+#  include <sys/cdefs.h>
+#  include <linker_set.h>
+#  define _PAM_MODULE_SET(sym)						\
+	DATA_SET(openpam_static_modules, sym)
+# endif
 # define PAM_EXTERN static
 # define PAM_MODULE_ENTRY(name)						\
 	static char _pam_name[] = name PAM_SOEXT;			\
@@ -378,7 +473,7 @@ struct pam_module {
 			[PAM_SM_CHAUTHTOK] = _PAM_SM_CHAUTHTOK		\
 		},							\
 	};								\
-	DATA_SET(_openpam_static_modules, _pam_module)
+	_PAM_MODULE_SET(_pam_module)
 #else
 /* normal case */
 # define PAM_EXTERN
@@ -0,0 +1,216 @@
+/*-
+ * Copyright (c) 2026 Dag-Erling Smørgrav
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote
+ *    products derived from this software without specific prior written
+ *    permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $OpenPAM$
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <security/pam_appl.h>
+
+#include "openpam_impl.h"
+
+/*
+ * Memory which only needs to live as long as the transaction - items,
+ * environment variables and module data - is carved out of a handful of
+ * chunks which belong to the handle.  A block which is freed is wiped
+ * right away, and either handed back to the chunk, if nothing was
+ * allocated after it, or kept for a later allocation of the same size or
+ * smaller.  Everything is wiped and released in one pass when the
+ * transaction ends.
+ */
+
+/* chosen so that a chunk and malloc's bookkeeping fit in a page */
+#define OPENPAM_ARENA_CHUNK	(4096 - 64)
+
+/* every block is preceded by its size and aligned like this */
+union openpam_arena_block {
+	size_t		 size;
+	long double	 ld;
+	long long	 ll;
+	void		*p;
+};
+#define OPENPAM_ARENA_ALIGN	sizeof(union openpam_arena_block)
+#define OPENPAM_ARENA_ROUND(n)					\
+	(((n) + OPENPAM_ARENA_ALIGN - 1) /			\
+	    OPENPAM_ARENA_ALIGN * OPENPAM_ARENA_ALIGN)
+
+#define OPENPAM_ARENA_HDR	OPENPAM_ARENA_ROUND(sizeof(pam_arena_chunk_t))
+#define OPENPAM_ARENA_DATA(c)	((char *)(c) + OPENPAM_ARENA_HDR)
+
+/*
+ * A memset() the compiler cannot prove is pointless
+ */
+static void *(*const volatile openpam_arena_memset)(void *, int, size_t) =
+    memset;
+
+/*
+ * OpenPAM internal
+ *
+ * Allocate a block of memory from the handle's arena.
+ */
+
+void *
+openpam_arena_alloc(pam_handle_t *pamh, size_t size)
+{
+	pam_arena_t *arena;
+	union openpam_arena_block *blk;
+	pam_arena_chunk_t *chunk;
+	void **pfree;
+	size_t need;
+
+	arena = &pamh->arena;
+	if ((need = OPENPAM_ARENA_ROUND(size)) < size) {
+		/* overflow */
+		return (NULL);
+	}
+	if (need == 0)
+		need = OPENPAM_ARENA_ALIGN;
+
+	/* first fit from the blocks which were freed */
+	for (pfree = &arena->freelist; *pfree != NULL; pfree = *pfree) {
+		blk = (union openpam_arena_block *)*pfree - 1;
+		if (blk->size >= need) {
+			*pfree = *(void **)*pfree;
+			*(void **)(blk + 1) = NULL;
+			return (blk + 1);
+		}
+	}
+
+	/* carve a new one out of the current chunk */
+	need += OPENPAM_ARENA_ALIGN;
+	chunk = arena->chunks;
+	if (chunk == NULL || chunk->size - chunk->used < need) {
+		size = need > OPENPAM_ARENA_CHUNK ? need : OPENPAM_ARENA_CHUNK;
+		if ((chunk = openpam_malloc(OPENPAM_ARENA_HDR + size)) == NULL)
+			return (NULL);
+		chunk->size = size;
+		chunk->used = 0;
+		if (arena->chunks != NULL && size > OPENPAM_ARENA_CHUNK) {
+			/* keep carving up the current chunk afterwards */
+			chunk->next = arena->chunks->next;
+			arena->chunks->next = chunk;
+		} else {
+			chunk->next = arena->chunks;
+			arena->chunks = chunk;
+		}
+	}
+	blk = (union openpam_arena_block *)
+	    (OPENPAM_ARENA_DATA(chunk) + chunk->used);
+	blk->size = need - OPENPAM_ARENA_ALIGN;
+	chunk->used += need;
+	return (blk + 1);
+}
+
+/*
+ * OpenPAM internal
+ *
+ * Copy a string into the handle's arena.
+ */
+
+char *
+openpam_arena_strdup(pam_handle_t *pamh, const char *str)
+{
+	size_t len;
+	char *p;
+
+	len = strlen(str) + 1;
+	if ((p = openpam_arena_alloc(pamh, len)) != NULL)
+		memcpy(p, str, len);
+	return (p);
+}
+
+/*
+ * OpenPAM internal
+ *
+ * Wipe a block of memory allocated from the handle's arena and make it
+ * available for reuse.
+ */
+
+void
+openpam_arena_free(pam_handle_t *pamh, void *p)
+{
+	pam_arena_t *arena;
+	union openpam_arena_block *blk;
+	pam_arena_chunk_t *chunk;
+	size_t size;
+
+	if (p == NULL)
+		return;
+	arena = &pamh->arena;
+	blk = (union openpam_arena_block *)p - 1;
+	size = blk->size;
+	openpam_arena_memset(p, 0, size);
+	chunk = arena->chunks;
+	if ((char *)p + size == OPENPAM_ARENA_DATA(chunk) + chunk->used) {
+		chunk->used -= OPENPAM_ARENA_ALIGN + size;
+	} else {
+		*(void **)p = arena->freelist;
+		arena->freelist = p;
+	}
+}
+
+/*
+ * OpenPAM internal
+ *
+ * Wipe everything allocated from the handle's arena.  If keep is
+ * non-zero, the current chunk is kept for the next transaction;
+ * otherwise, all memory is released.
+ */
+
+void
+openpam_arena_clear(pam_handle_t *pamh, int keep)
+{
+	pam_arena_t *arena;
+	pam_arena_chunk_t *chunk, *next;
+
+	arena = &pamh->arena;
+	for (chunk = arena->chunks; chunk != NULL; chunk = next) {
+		next = chunk->next;
+		openpam_arena_memset(OPENPAM_ARENA_DATA(chunk), 0,
+		    chunk->used);
+		chunk->used = 0;
+		if (keep && chunk == arena->chunks) {
+			chunk->next = NULL;
+			continue;
+		}
+		FREE(chunk);
+	}
+	if (!keep)
+		arena->chunks = NULL;
+	arena->freelist = NULL;
+}
+
+/*
+ * NOPARSE
+ */
@@ -85,13 +85,13 @@ openpam_borrow_cred(pam_handle_t *pamh,
 	scred->egid = getegid();
 	r = getgroups(NGROUPS_MAX, scred->groups);
 	if (r < 0) {
-		FREE(scred);
+		free(scred);
 		RETURNC(PAM_SYSTEM_ERR);
 	}
 	scred->ngroups = r;
 	r = pam_set_data(pamh, PAM_SAVED_CRED, scred, &openpam_free_data);
 	if (r != PAM_SUCCESS) {
-		FREE(scred);
+		free(scred);
 		RETURNC(r);
 	}
 	if (geteuid() == pwd->pw_uid)
@@ -0,0 +1,434 @@
+/*-
+ * Copyright (c) 2026 Dag-Erling Smørgrav
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote
+ *    products derived from this software without specific prior written
+ *    permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $OpenPAM$
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <security/pam_appl.h>
+
+#include "openpam_impl.h"
+
+/*
+ * Process-wide cache of parsed policies, keyed by service name.  Each
+ * entry records the identity and state of every file which was read or
+ * searched for while the policy was assembled, and is discarded as soon
+ * as any of them changes.
+ *
+ * Handles receive private copies of the chains, which hold their own
+ * references to the modules.  Entries are reference-counted so that one
+ * can be unlinked while another thread is still copying from it.
+ */
+static pthread_mutex_t openpam_cache_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pam_cached_policy_t *openpam_cache_list;
+
+/*
+ * OpenPAM internal
+ *
+ * Snapshot of the features which affect the outcome of the configuration
+ * process.
+ */
+
+int
+openpam_cache_features(void)
+{
+	int features, i;
+
+	for (features = i = 0; i < OPENPAM_NUM_FEATURES; ++i) {
+		switch (i) {
+		case OPENPAM_CACHE_POLICY:
+		case OPENPAM_RESIDENT_MODULES:
+		case OPENPAM_POLICY_IMAGE:
+		case OPENPAM_CACHE_POLICY_PATH:
+		case OPENPAM_MODULE_STATS:
+			/* does not affect the chains */
+			continue;
+		}
+		if (openpam_features[i].onoff)
+			features |= 1 << i;
+	}
+	return (features);
+}
+
+/*
+ * OpenPAM internal
+ *
+ * Record the identity and state of a file.
+ */
+
+void
+openpam_stamp_set(pam_file_stamp_t *stamp, const struct stat *sb)
+{
+
+	stamp->dev = sb->st_dev;
+	stamp->ino = sb->st_ino;
+	stamp->size = sb->st_size;
+#if defined(HAVE_STRUCT_STAT_ST_MTIM)
+	stamp->mtime = sb->st_mtim;
+	stamp->ctime = sb->st_ctim;
+#elif defined(HAVE_STRUCT_STAT_ST_MTIMESPEC)
+	stamp->mtime = sb->st_mtimespec;
+	stamp->ctime = sb->st_ctimespec;
+#else
+	stamp->mtime.tv_sec = sb->st_mtime;
+	stamp->mtime.tv_nsec = 0;
+	stamp->ctime.tv_sec = sb->st_ctime;
+	stamp->ctime.tv_nsec = 0;
+#endif
+}
+
+/*
+ * OpenPAM internal
+ *
+ * Check whether a file is still in the state in which we recorded it.
+ * Since any change to the ownership or permissions of a file updates its
+ * ctime, a file which passes this test does not need to be re-verified.
+ */
+
+int
+openpam_stamp_valid(const pam_file_stamp_t *stamp)
+{
+	pam_file_stamp_t now;
+	struct stat sb;
+
+	if (stat(stamp->path, &sb) != 0)
+		return (!stamp->found && errno == ENOENT);
+	if (!stamp->found)
+		return (0);
+	openpam_stamp_set(&now, &sb);
+	return (now.dev == stamp->dev &&
+	    now.ino == stamp->ino &&
+	    now.size == stamp->size &&
+	    now.mtime.tv_sec == stamp->mtime.tv_sec &&
+	    now.mtime.tv_nsec == stamp->mtime.tv_nsec &&
+	    now.ctime.tv_sec == stamp->ctime.tv_sec &&
+	    now.ctime.tv_nsec == stamp->ctime.tv_nsec);
+}
+
+/*
+ * Copy a set of chains.  Returns 0 on success and -1 on failure, in
+ * which case the destination is left empty.
+ */
+static int
+openpam_copy_chains(pam_chain_t *dst[], pam_chain_t *const src[])
+{
+	int fclt;
+
+	for (fclt = 0; fclt < PAM_NUM_FACILITIES; ++fclt) {
+		if (openpam_copy_chain(&dst[fclt], src[fclt]) != 0) {
+			openpam_clear_chains(dst);
+			return (-1);
+		}
+	}
+	return (0);
+}
+
+/*
+ * Free a cache entry, releasing the modules it owns.
+ */
+static void
+openpam_cache_free(pam_cached_policy_t *policy)
+{
+
+	openpam_clear_chains(policy->chains);
+	while (policy->nstamps > 0) {
+		--policy->nstamps;
+		FREE(policy->stamps[policy->nstamps].path);
+	}
+	FREE(policy->stamps);
+	FREE(policy->service);
+	FREE(policy);
+}
+
+/*
+ * Drop a reference to a cache entry, and free it if it was the last.
+ */
+static void
+openpam_cache_unref(pam_cached_policy_t *policy)
+{
+	unsigned int refcount;
+
+	pthread_mutex_lock(&openpam_cache_mtx);
+	refcount = --policy->refcount;
+	pthread_mutex_unlock(&openpam_cache_mtx);
+	if (refcount == 0)
+		openpam_cache_free(policy);
+}
+
+/*
+ * Unlink a cache entry from the list, if it is still there.  Must be
+ * called with the lock held.  Returns non-zero if the entry was found,
+ * in which case the caller inherits the list's reference.
+ */
+static int
+openpam_cache_unlink(pam_cached_policy_t *policy)
+{
+	pam_cached_policy_t **prev;
+
+	for (prev = &openpam_cache_list; *prev != NULL;
+	     prev = &(*prev)->next) {
+		if (*prev == policy) {
+			*prev = policy->next;
+			policy->next = NULL;
+			return (1);
+		}
+	}
+	return (0);
+}
+
+/*
+ * Mark every cache entry which depends on the specified file, or on
+ * anything in the specified directory, as needing to be checked.  If
+ * the path is NULL, mark all of them.  Called by the policy watcher with
+ * the lock held.
+ */
+static void
+openpam_cache_dirty(const char *path)
+{
+	pam_cached_policy_t *policy;
+	const char *p;
+	size_t len;
+	int i;
+
+	len = path ? strlen(path) : 0;
+	for (policy = openpam_cache_list; policy != NULL;
+	     policy = policy->next) {
+		for (i = 0; i < policy->nstamps && path != NULL; ++i) {
+			p = policy->stamps[i].path;
+			if (strncmp(p, path, len) == 0 &&
+			    (p[len] == '\0' || p[len] == '/'))
+				break;
+		}
+		if ((path == NULL || i < policy->nstamps) &&
+		    ++policy->dirty == 0)
+			policy->dirty = 1;
+	}
+}
+
+/*
+ * OpenPAM internal
+ *
+ * Look for a valid cached policy for the given service.  If one is found,
+ * copy its chains into the handle and return 1.  Otherwise, return 0.
+ */
+
+int
+openpam_cache_lookup(pam_handle_t *pamh, const char *service)
+{
+	pam_cached_policy_t *policy;
+	unsigned int dirty, gen;
+	int armed, i, ret, stale;
+
+	ENTERS(service);
+	pthread_mutex_lock(&openpam_cache_mtx);
+	gen = openpam_watch_drain(openpam_cache_dirty);
+	for (policy = openpam_cache_list; policy != NULL;
+	     policy = policy->next)
+		if (strcmp(policy->service, service) == 0)
+			break;
+	if (policy != NULL)
+		++policy->refcount;
+	dirty = policy ? policy->dirty : 0;
+	pthread_mutex_unlock(&openpam_cache_mtx);
+	if (policy == NULL)
+		RETURNN(0);
+
+	/* check that neither the features nor the files have changed */
+	stale = (policy->features != openpam_cache_features());
+	if (!stale && (gen == 0 || policy->watchgen != gen || dirty != 0)) {
+		/*
+		 * Start watching the files before we look at them, so
+		 * that any change we miss will be caught next time.
+		 */
+		armed = (gen != 0 &&
+		    openpam_watch_arm(policy->stamps, policy->nstamps) == 0);
+		for (i = 0; i < policy->nstamps && !stale; ++i)
+			stale = !openpam_stamp_valid(&policy->stamps[i]);
+		if (!stale && armed) {
+			pthread_mutex_lock(&openpam_cache_mtx);
+			if (policy->dirty == dirty) {
+				policy->dirty = 0;
+				policy->watchgen = gen;
+			}
+			pthread_mutex_unlock(&openpam_cache_mtx);
+		}
+	}
+	if (stale) {
+		openpam_log(PAM_LOG_DEBUG, "cached %s policy is stale",
+		    service);
+		pthread_mutex_lock(&openpam_cache_mtx);
+		if (openpam_cache_unlink(policy))
+			--policy->refcount;
+		pthread_mutex_unlock(&openpam_cache_mtx);
+		openpam_cache_unref(policy);
+		RETURNN(0);
+	}
+
+	ret = openpam_copy_chains(pamh->chains, policy->chains);
+	openpam_cache_unref(policy);
+	if (ret != 0)
+		RETURNN(0);
+	openpam_log(PAM_LOG_DEBUG, "using cached %s policy", service);
+	RETURNN(1);
+}
+
+/*
+ * OpenPAM internal
+ *
+ * Prepare a new cache entry for a policy which is about to be loaded.
+ * The entry is attached to the handle until openpam_cache_commit() or
+ * openpam_cache_abort() is called.
+ */
+
+void
+openpam_cache_begin(pam_handle_t *pamh, const char *service)
+{
+	pam_cached_policy_t *policy;
+
+	ENTERS(service);
+	if ((policy = openpam_calloc(1, sizeof *policy)) == NULL ||
+	    (policy->service = openpam_strdup(service)) == NULL) {
+		openpam_log(PAM_LOG_ERROR, "malloc(): %m");
+		FREE(policy);
+		RETURNV();
+	}
+	policy->features = openpam_cache_features();
+	pamh->policy = policy;
+	RETURNV();
+}
+
+/*
+ * OpenPAM internal
+ *
+ * Record a file which was read while loading the policy, or which was
+ * searched for but not found (in which case sb is NULL).  If anything
+ * goes wrong, the policy will simply not be cached.
+ */
+
+void
+openpam_cache_stamp(pam_handle_t *pamh, const char *path,
+    const struct stat *sb)
+{
+	pam_cached_policy_t *policy;
+	pam_file_stamp_t *stamp;
+	int i;
+
+	if ((policy = pamh->policy) == NULL)
+		return;
+	for (i = 0; i < policy->nstamps; ++i)
+		if (strcmp(policy->stamps[i].path, path) == 0)
+			return;
+	stamp = openpam_realloc(policy->stamps,
+	    (policy->nstamps + 1) * sizeof *stamp);
+	if (stamp == NULL)
+		goto nomem;
+	policy->stamps = stamp;
+	stamp = &policy->stamps[policy->nstamps];
+	memset(stamp, 0, sizeof *stamp);
+	if ((stamp->path = openpam_strdup(path)) == NULL)
+		goto nomem;
+	if (sb != NULL) {
+		stamp->found = 1;
+		openpam_stamp_set(stamp, sb);
+	}
+	++policy->nstamps;
+	return;
+nomem:
+	openpam_log(PAM_LOG_ERROR, "malloc(): %m");
+	openpam_cache_abort(pamh);
+}
+
+/*
+ * OpenPAM internal
+ *
+ * Store a copy of the handle's freshly loaded chains in the new cache
+ * entry and publish it, replacing any previous entry for the same
+ * service.
+ */
+
+void
+openpam_cache_commit(pam_handle_t *pamh)
+{
+	pam_cached_policy_t *old, *policy;
+
+	ENTER();
+	if ((policy = pamh->policy) == NULL)
+		RETURNV();
+	pamh->policy = NULL;
+	if (openpam_copy_chains(policy->chains, pamh->chains) != 0) {
+		openpam_cache_free(policy);
+		RETURNV();
+	}
+	policy->refcount = 1;
+	policy->dirty = 1;
+	pthread_mutex_lock(&openpam_cache_mtx);
+	for (old = openpam_cache_list; old != NULL; old = old->next)
+		if (strcmp(old->service, policy->service) == 0)
+			break;
+	if (old != NULL && !openpam_cache_unlink(old))
+		old = NULL;
+	policy->next = openpam_cache_list;
+	openpam_cache_list = policy;
+	pthread_mutex_unlock(&openpam_cache_mtx);
+	if (old != NULL)
+		openpam_cache_unref(old);
+	RETURNV();
+}
+
+/*
+ * OpenPAM internal
+ *
+ * Discard a cache entry which was never committed.  The handle keeps its
+ * chains.
+ */
+
+void
+openpam_cache_abort(pam_handle_t *pamh)
+{
+	pam_cached_policy_t *policy;
+
+	if ((policy = pamh->policy) == NULL)
+		return;
+	pamh->policy = NULL;
+	openpam_cache_free(policy);
+}
+
+/*
+ * NOPARSE
+ */
@@ -0,0 +1,90 @@
+/*-
+ * Copyright (c) 2026 Dag-Erling Smørgrav
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote
+ *    products derived from this software without specific prior written
+ *    permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $OpenPAM$
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <security/pam_appl.h>
+#include <security/openpam.h>
+
+#include "openpam_impl.h"
+
+/*
+ * OpenPAM extension
+ *
+ * Load any modules whose loading was deferred
+ */
+
+int
+openpam_check_modules(pam_handle_t *pamh)
+{
+	pam_chain_t *chain;
+	int fclt, ret;
+
+	ENTER();
+	ret = PAM_SUCCESS;
+	for (fclt = 0; fclt < PAM_NUM_FACILITIES; ++fclt) {
+		/* keep going so that every failure is logged */
+		for (chain = pamh->chains[fclt];
+		     chain != NULL && !OPENPAM_CHAIN_END(chain); ++chain)
+			if (openpam_chain_module(chain) == NULL)
+				ret = PAM_SYSTEM_ERR;
+	}
+	RETURNC(ret);
+}
+
+/*
+ * Error codes:
+ *
+ *	PAM_SYSTEM_ERR
+ */
+
+/**
+ * The =openpam_check_modules function loads every module referenced by
+ * the policy associated with the PAM context =pamh which has not been
+ * loaded yet.
+ *
+ * When the =OPENPAM_LAZY_MODULES feature is enabled, =pam_start only
+ * records the names of the modules the policy refers to, and each
+ * module is loaded the first time one of its functions is called.
+ * A module which is missing or cannot be loaded then goes unnoticed
+ * until that point.
+ * Applications which would rather find out immediately can call
+ * =openpam_check_modules right after =pam_start, at the cost of loading
+ * modules they may never need.
+ *
+ * >openpam_get_feature
+ * >openpam_set_feature
+ * >pam_start
+ *
+ * AUTHOR DES
+ */
@@ -37,7 +37,10 @@
 #include <sys/stat.h>
 
 #include <errno.h>
+#include <fcntl.h>
 #include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
@@ -45,52 +48,339 @@
 #include <security/pam_appl.h>
 
 #include "openpam_impl.h"
+#include "openpam_strlcpy.h"
+
+/*
+ * Verify that the file or directory described by the given stat buffer
+ * is owned by either root or the arbitrator and that it is not writable
+ * by group or other.
+ */
+static int
+openpam_check_owner(const char *name, const struct stat *sb)
+{
+	uid_t root, arbitrator;
+
+	root = 0;
+	arbitrator = geteuid();
+	if ((sb->st_uid != root && sb->st_uid != arbitrator) ||
+	    (sb->st_mode & (S_IWGRP|S_IWOTH)) != 0) {
+		openpam_log(PAM_LOG_ERROR,
+		    "%s: insecure ownership or permissions", name);
+		errno = EPERM;
+		return (-1);
+	}
+	return (0);
+}
 
 /*
  * OpenPAM internal
  *
- * Verify that the file or directory referenced by the given descriptor is
- * owned by either root or the arbitrator and that it is not writable by
- * group or other.
+ * Verify that the file described by the given stat buffer is a regular
+ * file owned by either root or the arbitrator and that it is not
+ * writable by group or other.
+ */
+
+int
+openpam_check_stat_owner_perms(const char *name, const struct stat *sb)
+{
+
+	if (!S_ISREG(sb->st_mode)) {
+		openpam_log(PAM_LOG_ERROR,
+		    "%s: not a regular file", name);
+		errno = EINVAL;
+		return (-1);
+	}
+	return (openpam_check_owner(name, sb));
+}
+
+/*
+ * OpenPAM internal
+ *
+ * Verify that the file referenced by the given descriptor is a regular
+ * file owned by either root or the arbitrator and that it is not
+ * writable by group or other.
  */
 
 int
 openpam_check_desc_owner_perms(const char *name, int fd)
 {
-	uid_t root, arbitrator;
 	struct stat sb;
 	int serrno;
 
-	root = 0;
-	arbitrator = geteuid();
 	if (fstat(fd, &sb) != 0) {
 		serrno = errno;
 		openpam_log(PAM_LOG_ERROR, "%s: %m", name);
 		errno = serrno;
 		return (-1);
 	}
-	if (!S_ISREG(sb.st_mode)) {
-		openpam_log(PAM_LOG_ERROR,
-		    "%s: not a regular file", name);
-		errno = EINVAL;
+	return (openpam_check_stat_owner_perms(name, &sb));
+}
+
+#if defined(O_PATH)
+
+#define OPENPAM_MAXSYMLINKS	32
+
+/*
+ * A directory which was found to be safe, together with every directory
+ * we passed through to reach it.  We hold on to a descriptor for each of
+ * them and record their state at the time they were verified: since
+ * renaming, removing or replacing an entry in a directory or changing its
+ * ownership or permissions all update its ctime, the path still leads to
+ * the same, safe place for as long as none of them have changed.
+ */
+typedef struct pam_verified_dir pam_verified_dir_t;
+struct pam_verified_dir {
+	char			*path;		/* as requested */
+	char			*real;		/* as resolved */
+	int			 ndirs;
+	int			*fdv;
+	pam_file_stamp_t	*stampv;
+	pam_verified_dir_t	*next;
+};
+
+static pthread_mutex_t openpam_verified_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pam_verified_dir_t *openpam_verified;
+
+static void
+openpam_verified_free(pam_verified_dir_t *vd)
+{
+	int i;
+
+	for (i = 0; i < vd->ndirs; ++i)
+		close(vd->fdv[i]);
+	FREE(vd->fdv);
+	FREE(vd->stampv);
+	FREE(vd->path);
+	FREE(vd->real);
+}
+
+/*
+ * Check whether none of the directories on the path have changed since
+ * they were verified.
+ */
+static int
+openpam_verified_valid(const pam_verified_dir_t *vd)
+{
+	pam_file_stamp_t now;
+	struct stat sb;
+	int i;
+
+	for (i = 0; i < vd->ndirs; ++i) {
+		if (fstat(vd->fdv[i], &sb) != 0)
+			return (0);
+		openpam_stamp_set(&now, &sb);
+		if (now.dev != vd->stampv[i].dev ||
+		    now.ino != vd->stampv[i].ino ||
+		    now.ctime.tv_sec != vd->stampv[i].ctime.tv_sec ||
+		    now.ctime.tv_nsec != vd->stampv[i].ctime.tv_nsec)
+			return (0);
+	}
+	return (1);
+}
+
+/*
+ * Verify a directory we are about to pass through and add it to the
+ * list.  Consumes the descriptor.
+ */
+static int
+openpam_verified_push(pam_verified_dir_t *vd, const char *name, int fd,
+    const struct stat *sb)
+{
+	pam_file_stamp_t *stampv;
+	int *fdv;
+
+	if (openpam_check_owner(*name ? name : "/", sb) != 0) {
+		close(fd);
 		return (-1);
 	}
-	if ((sb.st_uid != root && sb.st_uid != arbitrator) ||
-	    (sb.st_mode & (S_IWGRP|S_IWOTH)) != 0) {
-		openpam_log(PAM_LOG_ERROR,
-		    "%s: insecure ownership or permissions", name);
-		errno = EPERM;
+	fdv = openpam_realloc(vd->fdv, (vd->ndirs + 1) * sizeof *fdv);
+	if (fdv != NULL)
+		vd->fdv = fdv;
+	stampv = openpam_realloc(vd->stampv, (vd->ndirs + 1) * sizeof *stampv);
+	if (stampv != NULL)
+		vd->stampv = stampv;
+	if (fdv == NULL || stampv == NULL) {
+		openpam_log(PAM_LOG_ERROR, "malloc(): %m");
+		close(fd);
+		errno = ENOMEM;
 		return (-1);
 	}
+	memset(&vd->stampv[vd->ndirs], 0, sizeof *stampv);
+	openpam_stamp_set(&vd->stampv[vd->ndirs], sb);
+	vd->fdv[vd->ndirs++] = fd;
 	return (0);
 }
 
+/*
+ * Start over from the root directory.
+ */
+static int
+openpam_verified_root(pam_verified_dir_t *vd, char *real)
+{
+	struct stat sb;
+	int fd, serrno;
+
+	real[0] = '\0';
+	if ((fd = open("/", O_PATH|O_DIRECTORY|O_CLOEXEC)) < 0 ||
+	    fstat(fd, &sb) != 0) {
+		serrno = errno;
+		openpam_log(PAM_LOG_ERROR, "/: %m");
+		if (fd >= 0)
+			close(fd);
+		errno = serrno;
+		return (-1);
+	}
+	return (openpam_verified_push(vd, real, fd, &sb));
+}
+
+/*
+ * Resolve a path one component at a time, relative to the directory we
+ * have just verified, so that nothing can be slipped in between the
+ * check and the next step.  Symbolic links are followed by splicing their
+ * target into the remainder of the path, which means that every directory
+ * we pass through is checked, including those a link points into.
+ *
+ * If tip is non-zero, the path must lead to a regular file, which is
+ * checked as well; otherwise, it must lead to a directory.  On success,
+ * the resolved path is stored in real, which must be PATH_MAX bytes long;
+ * unlike realpath(3), it is empty rather than "/" for the root directory.
+ */
+static int
+openpam_verified_walk(pam_verified_dir_t *vd, const char *path, int tip,
+    char *real)
+{
+	char buf[PATH_MAX], link[PATH_MAX], tmp[PATH_MAX];
+	char *comp, *p;
+	struct stat sb;
+	ssize_t linklen;
+	size_t len;
+	int dirfd, fd, last, nlinks, serrno;
+
+	if (path[0] != '/') {
+		if (getcwd(tmp, sizeof tmp) == NULL)
+			return (-1);
+		len = snprintf(buf, sizeof buf, "%s/%s", tmp, path);
+	} else {
+		len = strlcpy(buf, path, sizeof buf);
+	}
+	if (len >= sizeof buf) {
+		errno = ENAMETOOLONG;
+		return (-1);
+	}
+	if (openpam_verified_root(vd, real) != 0)
+		return (-1);
+	nlinks = 0;
+	for (p = buf; *p != '\0'; ) {
+		comp = p;
+		p += strcspn(p, "/");
+		if (*p != '\0')
+			*p++ = '\0';
+		while (*p == '/')
+			++p;
+		last = (*p == '\0');
+		if (*comp == '\0' || strcmp(comp, ".") == 0)
+			continue;
+		dirfd = vd->fdv[vd->ndirs - 1];
+		len = strlen(real);
+		if (strcmp(comp, "..") == 0) {
+			/* real contains no links, so this is the parent */
+			while (len > 0 && real[--len] != '/')
+				/* nothing */ ;
+			real[len] = '\0';
+		} else if (snprintf(real + len, PATH_MAX - len, "/%s",
+		    comp) >= (int)(PATH_MAX - len)) {
+			errno = ENAMETOOLONG;
+			return (-1);
+		}
+		if ((fd = openat(dirfd, comp,
+		    O_PATH|O_NOFOLLOW|O_CLOEXEC)) < 0 ||
+		    fstat(fd, &sb) != 0) {
+			serrno = errno;
+			if (serrno != ENOENT)
+				openpam_log(PAM_LOG_ERROR, "%s: %m", real);
+			if (fd >= 0)
+				close(fd);
+			errno = serrno;
+			return (-1);
+		}
+		if (S_ISLNK(sb.st_mode)) {
+			close(fd);
+			if (++nlinks > OPENPAM_MAXSYMLINKS) {
+				errno = ELOOP;
+				return (-1);
+			}
+			linklen = readlinkat(dirfd, comp, link,
+			    sizeof link - 1);
+			if (linklen < 0)
+				return (-1);
+			link[linklen] = '\0';
+			real[len] = '\0';
+			if (snprintf(tmp, sizeof tmp, "%s/%s", link, p) >=
+			    (int)sizeof tmp) {
+				errno = ENAMETOOLONG;
+				return (-1);
+			}
+			strcpy(buf, tmp);
+			p = buf;
+			if (link[0] == '/' &&
+			    openpam_verified_root(vd, real) != 0)
+				return (-1);
+			continue;
+		}
+		if (tip && last) {
+			close(fd);
+			return (openpam_check_stat_owner_perms(real, &sb));
+		}
+		if (!S_ISDIR(sb.st_mode)) {
+			close(fd);
+			errno = ENOTDIR;
+			return (-1);
+		}
+		if (openpam_verified_push(vd, real, fd, &sb) != 0)
+			return (-1);
+	}
+	if (tip) {
+		openpam_log(PAM_LOG_ERROR, "%s: not a regular file",
+		    *real ? real : "/");
+		errno = EINVAL;
+		return (-1);
+	}
+	return (0);
+}
+
+/*
+ * Verify a path without consulting or updating the cache.
+ */
+static int
+openpam_verified_once(const char *path, char *resolved)
+{
+	pam_verified_dir_t vd;
+	char real[PATH_MAX];
+	int ret, serrno;
+
+	memset(&vd, 0, sizeof vd);
+	ret = openpam_verified_walk(&vd, path, 1, real);
+	serrno = errno;
+	openpam_verified_free(&vd);
+	if (ret == 0 && resolved != NULL)
+		strlcpy(resolved, real, PATH_MAX);
+	errno = serrno;
+	return (ret);
+}
+
 /*
  * OpenPAM internal
  *
- * Verify that a file or directory and all components of the path leading
- * up to it are owned by either root or the arbitrator and that they are
- * not writable by group or other.
+ * Verify that a file and all components of the path leading up to it are
+ * owned by either root or the arbitrator and that they are not writable
+ * by group or other.  If resolved is not NULL, the canonical path of the
+ * file is stored there; it must be PATH_MAX bytes long.
+ *
+ * The path is walked one component at a time using descriptors, and the
+ * directory which contains the file is remembered along with every
+ * directory leading up to it, so that verifying another file in the same
+ * directory, or the same file again, costs one fstat(2) per directory and
+ * one fstatat(2) for the file itself for as long as nothing has changed.
  *
  * Note that openpam_check_desc_owner_perms() should be used instead if
  * possible to avoid a race between the ownership / permission check and
@@ -98,18 +388,109 @@ openpam_check_desc_owner_perms(const char *name, int fd)
  */
 
 int
-openpam_check_path_owner_perms(const char *path)
+openpam_check_path_owner_perms(const char *path, char *resolved)
+{
+	pam_verified_dir_t *vd, **pvd;
+	char dir[PATH_MAX], real[PATH_MAX];
+	const char *base;
+	struct stat sb;
+	int ret, serrno;
+
+	/* split the path; anything unusual takes the slow path */
+	if ((base = strrchr(path, '/')) == NULL || base[1] == '\0' ||
+	    (size_t)(base - path) >= sizeof dir)
+		return (openpam_verified_once(path, resolved));
+	if (base == path) {
+		strcpy(dir, "/");
+	} else {
+		memcpy(dir, path, base - path);
+		dir[base - path] = '\0';
+	}
+	++base;
+
+	/* look up the directory, and re-verify it if it has changed */
+	pthread_mutex_lock(&openpam_verified_mtx);
+	for (pvd = &openpam_verified; (vd = *pvd) != NULL; pvd = &vd->next)
+		if (strcmp(vd->path, dir) == 0)
+			break;
+	if (vd != NULL && !openpam_verified_valid(vd)) {
+		openpam_log(PAM_LOG_LIBDEBUG, "%s has changed", dir);
+		*pvd = vd->next;
+		openpam_verified_free(vd);
+		FREE(vd);
+	}
+	if (vd == NULL) {
+		if ((vd = openpam_calloc(1, sizeof *vd)) == NULL ||
+		    (vd->path = openpam_strdup(dir)) == NULL) {
+			openpam_log(PAM_LOG_ERROR, "malloc(): %m");
+			FREE(vd);
+			pthread_mutex_unlock(&openpam_verified_mtx);
+			errno = ENOMEM;
+			return (-1);
+		}
+		if (openpam_verified_walk(vd, dir, 0, real) != 0 ||
+		    (vd->real = openpam_strdup(real)) == NULL) {
+			serrno = errno;
+			openpam_verified_free(vd);
+			FREE(vd);
+			pthread_mutex_unlock(&openpam_verified_mtx);
+			errno = serrno;
+			return (-1);
+		}
+		vd->next = openpam_verified;
+		openpam_verified = vd;
+	}
+
+	/* the directory is safe; now check the file itself */
+	if (fstatat(vd->fdv[vd->ndirs - 1], base, &sb,
+	    AT_SYMLINK_NOFOLLOW) != 0) {
+		serrno = errno;
+		pthread_mutex_unlock(&openpam_verified_mtx);
+		if (serrno != ENOENT)
+			openpam_log(PAM_LOG_ERROR, "%s: %m", path);
+		errno = serrno;
+		return (-1);
+	}
+	if (S_ISLNK(sb.st_mode)) {
+		pthread_mutex_unlock(&openpam_verified_mtx);
+		return (openpam_verified_once(path, resolved));
+	}
+	if ((ret = openpam_check_stat_owner_perms(path, &sb)) == 0 &&
+	    resolved != NULL)
+		snprintf(resolved, PATH_MAX, "%s/%s", vd->real, base);
+	serrno = errno;
+	pthread_mutex_unlock(&openpam_verified_mtx);
+	errno = serrno;
+	return (ret);
+}
+
+#else
+
+/*
+ * OpenPAM internal
+ *
+ * Verify that a file and all components of the path leading up to it are
+ * owned by either root or the arbitrator and that they are not writable
+ * by group or other.  If resolved is not NULL, the canonical path of the
+ * file is stored there; it must be PATH_MAX bytes long.
+ *
+ * Note that openpam_check_desc_owner_perms() should be used instead if
+ * possible to avoid a race between the ownership / permission check and
+ * the actual open().
+ */
+
+int
+openpam_check_path_owner_perms(const char *path, char *resolved)
 {
-	uid_t root, arbitrator;
 	char pathbuf[PATH_MAX];
 	struct stat sb;
 	int len, serrno, tip;
 
 	tip = 1;
-	root = 0;
-	arbitrator = geteuid();
 	if (realpath(path, pathbuf) == NULL)
 		return (-1);
+	if (resolved != NULL)
+		strlcpy(resolved, pathbuf, PATH_MAX);
 	len = strlen(pathbuf);
 	while (len > 0) {
 		if (stat(pathbuf, &sb) != 0) {
@@ -120,17 +501,10 @@ openpam_check_path_owner_perms(const char *path)
 			}
 			return (-1);
 		}
-		if (tip && !S_ISREG(sb.st_mode)) {
-			openpam_log(PAM_LOG_ERROR,
-			    "%s: not a regular file", pathbuf);
-			errno = EINVAL;
-			return (-1);
-		}
-		if ((sb.st_uid != root && sb.st_uid != arbitrator) ||
-		    (sb.st_mode & (S_IWGRP|S_IWOTH)) != 0) {
-			openpam_log(PAM_LOG_ERROR,
-			    "%s: insecure ownership or permissions", pathbuf);
-			errno = EPERM;
+		if (tip) {
+			if (openpam_check_stat_owner_perms(pathbuf, &sb) != 0)
+				return (-1);
+		} else if (openpam_check_owner(pathbuf, &sb) != 0) {
 			return (-1);
 		}
 		while (--len > 0 && pathbuf[len] != '/')
@@ -140,6 +514,8 @@ openpam_check_path_owner_perms(const char *path)
 	return (0);
 }
 
+#endif
+
 /*
  * NOPARSE
  */
@@ -0,0 +1,226 @@
+/*-
+ * Copyright (c) 2026 Dag-Erling Smørgrav
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote
+ *    products derived from this software without specific prior written
+ *    permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $OpenPAM$
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <pthread.h>
+#include <stdlib.h>
+
+#include <security/pam_appl.h>
+#include <security/openpam.h>
+
+#include "openpam_impl.h"
+
+/* protects the reference counts of templates */
+static pthread_mutex_t openpam_clone_mtx = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * OpenPAM internal
+ *
+ * Drop a reference to a handle and return the number of references which
+ * remain.  A template is not destroyed until its last clone is.
+ */
+
+unsigned int
+openpam_unref_handle(pam_handle_t *pamh)
+{
+	unsigned int refcount;
+
+	pthread_mutex_lock(&openpam_clone_mtx);
+	refcount = --pamh->refcount;
+	pthread_mutex_unlock(&openpam_clone_mtx);
+	return (refcount);
+}
+
+/*
+ * OpenPAM internal
+ *
+ * Return the options of a chain entry as seen by the given handle.
+ */
+
+char **
+openpam_chain_optv(pam_handle_t *pamh, const pam_chain_t *chain, int *optc)
+{
+	pam_overlay_t *ov;
+
+	for (ov = pamh->overlay; ov != NULL; ov = ov->next) {
+		if (ov->chain == chain) {
+			*optc = ov->optc;
+			return (ov->optv);
+		}
+	}
+	*optc = chain->optc;
+	return (chain->optv);
+}
+
+/*
+ * OpenPAM internal
+ *
+ * Return the index of the options of a chain entry as seen by the given
+ * handle, or NULL if there is none.
+ */
+
+pam_optidx_t *
+openpam_chain_optidx(pam_handle_t *pamh, const pam_chain_t *chain)
+{
+	pam_overlay_t *ov;
+
+	for (ov = pamh->overlay; ov != NULL; ov = ov->next)
+		if (ov->chain == chain)
+			return (ov->optidx);
+	return (chain->optidx);
+}
+
+/*
+ * OpenPAM internal
+ *
+ * Replace the options of a chain entry, taking ownership of the new
+ * vector.  If the handle is a clone, the chain belongs to the template,
+ * so the change is recorded in the handle instead.  Returns 0 on success
+ * and -1 on failure, in which case the vector is left to the caller.
+ */
+
+int
+openpam_chain_set_optv(pam_handle_t *pamh, pam_chain_t *chain, int optc,
+    char **optv)
+{
+	pam_overlay_t *ov;
+
+	if (pamh->parent == NULL) {
+		FREE(chain->optidx);
+		FREE(chain->optv);
+		chain->optv = optv;
+		chain->optc = optc;
+		chain->optidx = openpam_optidx(optc, optv);
+		return (0);
+	}
+	for (ov = pamh->overlay; ov != NULL; ov = ov->next)
+		if (ov->chain == chain)
+			break;
+	if (ov == NULL) {
+		if ((ov = openpam_calloc(1, sizeof *ov)) == NULL)
+			return (-1);
+		ov->chain = chain;
+		ov->next = pamh->overlay;
+		pamh->overlay = ov;
+	}
+	FREE(ov->optidx);
+	FREE(ov->optv);
+	ov->optv = optv;
+	ov->optc = optc;
+	ov->optidx = openpam_optidx(optc, optv);
+	return (0);
+}
+
+/*
+ * OpenPAM extension
+ *
+ * Create a PAM context which shares its policy with an existing one
+ */
+
+int
+openpam_clone(pam_handle_t *template,
+	pam_handle_t **pamh)
+{
+	pam_handle_t *ph;
+	int i;
+
+	ENTER();
+	if (template == NULL)
+		RETURNC(PAM_BAD_HANDLE);
+	if (template->parent != NULL)
+		template = template->parent;
+	if ((ph = openpam_calloc(1, sizeof *ph)) == NULL)
+		RETURNC(PAM_BUF_ERR);
+	pthread_mutex_lock(&openpam_clone_mtx);
+	/* the chains will be shared, so they must not change later */
+	if (openpam_check_modules(template) != PAM_SUCCESS) {
+		pthread_mutex_unlock(&openpam_clone_mtx);
+		FREE(ph);
+		RETURNC(PAM_SYSTEM_ERR);
+	}
+	++template->refcount;
+	pthread_mutex_unlock(&openpam_clone_mtx);
+	ph->parent = template;
+	ph->refcount = 1;
+	for (i = 0; i < PAM_NUM_FACILITIES; ++i)
+		ph->chains[i] = template->chains[i];
+	/* borrow the preset items until the clone sets its own */
+	for (i = 0; i < PAM_NUM_ITEMS; ++i) {
+		if (OPENPAM_PRESET_ITEM(i)) {
+			ph->item[i] = template->item[i];
+			ph->borrowed |= 1U << i;
+		}
+	}
+	*pamh = ph;
+	RETURNC(PAM_SUCCESS);
+}
+
+/*
+ * Error codes:
+ *
+ *	PAM_BAD_HANDLE
+ *	PAM_BUF_ERR
+ *	PAM_SYSTEM_ERR
+ */
+
+/**
+ * The =openpam_clone function creates a new PAM context which shares the
+ * policy of the context =template, and stores a pointer to it in the
+ * location pointed to by =pamh.
+ * The new context is equivalent to one returned by =pam_start with the
+ * same service, host and conversation function, but creating it only
+ * costs a small allocation: the chains and the modules they refer to are
+ * shared rather than loaded again, and the =PAM_SERVICE, =PAM_HOST and
+ * =PAM_CONV items are only copied if the clone changes them.
+ * Options set with =openpam_set_option within the clone are private to
+ * it.
+ *
+ * If modules were deferred by the =OPENPAM_LAZY_MODULES feature, they
+ * are loaded when the first clone is created, and =openpam_clone fails
+ * if any of them cannot be loaded.
+ * A clone of a clone is a clone of the original template.
+ *
+ * The template should not be used for transactions or otherwise modified
+ * while it has clones; the clones themselves may be used concurrently by
+ * different threads.
+ * The template may be terminated with =pam_end before its clones, in
+ * which case the resources it shares with them are released when the
+ * last clone is terminated.
+ *
+ * >openpam_reset
+ * >pam_end
+ * >pam_start
+ *
+ * AUTHOR DES
+ */
@@ -0,0 +1,280 @@
+/*-
+ * Copyright (c) 2026 Dag-Erling Smørgrav
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote
+ *    products derived from this software without specific prior written
+ *    permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $OpenPAM$
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <security/pam_appl.h>
+
+#include "openpam_impl.h"
+#include "openpam_lex.h"
+
+/*
+ * Process-wide index of the pam.conf-style policy files we have read,
+ * keyed by file name.  For every service which appears in a file, the
+ * index lists the runs of lines which belong to it, so that looking up
+ * a service does not require splitting every other service's lines into
+ * words.  An index is discarded as soon as its file changes.
+ */
+typedef struct openpam_confidx_svc openpam_confidx_svc_t;
+struct openpam_confidx_svc {
+	char		*name;
+	struct openpam_lexrange *rangev;
+	int		 rangec;
+	int		 rangesize;
+};
+
+typedef struct openpam_confidx openpam_confidx_t;
+struct openpam_confidx {
+	char		*path;
+	pam_file_stamp_t stamp;
+	openpam_confidx_svc_t *svcv;
+	int		 svcc;
+	int		 svcsize;
+	openpam_confidx_t *next;
+};
+
+static pthread_mutex_t openpam_confidx_mtx = PTHREAD_MUTEX_INITIALIZER;
+static openpam_confidx_t *openpam_confidx_list;
+
+static void
+openpam_confidx_free(openpam_confidx_t *idx)
+{
+	int i;
+
+	for (i = 0; i < idx->svcc; ++i) {
+		FREE(idx->svcv[i].name);
+		FREE(idx->svcv[i].rangev);
+	}
+	FREE(idx->svcv);
+	FREE(idx->path);
+	FREE(idx);
+}
+
+/*
+ * Look up a service in an index, creating it if requested.
+ */
+static openpam_confidx_svc_t *
+openpam_confidx_svc(openpam_confidx_t *idx, const struct openpam_word *name,
+	int create)
+{
+	openpam_confidx_svc_t *svc;
+	int size;
+
+	for (svc = idx->svcv; svc < idx->svcv + idx->svcc; ++svc)
+		if (openpam_wordeq(name, svc->name))
+			return (svc);
+	if (!create)
+		return (NULL);
+	if (idx->svcc == idx->svcsize) {
+		size = idx->svcsize ? idx->svcsize * 2 : 16;
+		svc = openpam_realloc(idx->svcv, size * sizeof *svc);
+		if (svc == NULL)
+			return (NULL);
+		idx->svcv = svc;
+		idx->svcsize = size;
+	}
+	svc = &idx->svcv[idx->svcc];
+	memset(svc, 0, sizeof *svc);
+	if ((svc->name = openpam_worddup(name)) == NULL)
+		return (NULL);
+	idx->svcc++;
+	return (svc);
+}
+
+/*
+ * Add a line to a service's list of ranges, extending the last range if
+ * the line immediately follows it.
+ */
+static int
+openpam_confidx_add(openpam_confidx_svc_t *svc,
+	size_t offset, size_t end, int lineno)
+{
+	struct openpam_lexrange *r;
+	int size;
+
+	if (svc->rangec > 0) {
+		r = &svc->rangev[svc->rangec - 1];
+		if (r->offset + r->len == offset) {
+			r->len = end - r->offset;
+			return (0);
+		}
+	}
+	if (svc->rangec == svc->rangesize) {
+		size = svc->rangesize ? svc->rangesize * 2 : 4;
+		r = openpam_realloc(svc->rangev, size * sizeof *r);
+		if (r == NULL)
+			return (-1);
+		svc->rangev = r;
+		svc->rangesize = size;
+	}
+	r = &svc->rangev[svc->rangec++];
+	r->offset = offset;
+	r->len = end - offset;
+	r->lineno = lineno;
+	return (0);
+}
+
+/*
+ * Index the contents of a file.  Blank lines and comments are attached
+ * to whichever service precedes them so that a service's lines form a
+ * single range even if they are not tightly packed.
+ */
+static openpam_confidx_t *
+openpam_confidx_build(const char *path, const struct stat *sb,
+	const struct openpam_lexer *lx)
+{
+	struct openpam_lexer scan;
+	openpam_confidx_t *idx;
+	openpam_confidx_svc_t *svc;
+	size_t offset;
+	int lineno, serrno, wordc;
+
+	if ((idx = openpam_calloc(1, sizeof *idx)) == NULL)
+		return (NULL);
+	if ((idx->path = openpam_strdup(path)) == NULL) {
+		FREE(idx);
+		return (NULL);
+	}
+	openpam_stamp_set(&idx->stamp, sb);
+	openpam_lex_init(&scan, lx->buf, lx->len);
+	svc = NULL;
+	for (;;) {
+		offset = scan.pos;
+		lineno = scan.lineno;
+		if ((wordc = openpam_lex_line(&scan)) < 0)
+			break;
+		if (wordc > 0 &&
+		    (svc = openpam_confidx_svc(idx, &scan.wordv[0], 1)) ==
+		    NULL)
+			break;
+		if (svc != NULL &&
+		    openpam_confidx_add(svc, offset, scan.pos, lineno) != 0)
+			break;
+	}
+	serrno = errno;
+	openpam_lex_fini(&scan);
+	if (wordc >= 0 || serrno != 0) {
+		/* out of memory, or a syntax error the parser will report */
+		openpam_confidx_free(idx);
+		return (NULL);
+	}
+	return (idx);
+}
+
+/*
+ * OpenPAM internal
+ *
+ * Look up a service in the index of a pam.conf-style file, indexing the
+ * file first if necessary.  The lexer holds the contents of the file and
+ * the stat buffer describes the file as it was before it was read.
+ *
+ * Returns the number of ranges which belong to the service, which may be
+ * zero, and a copy of the ranges which the caller must free, or -1 if the
+ * file could not be indexed.
+ */
+
+int
+openpam_confidx_lookup(const char *path,
+	const struct stat *sb,
+	const struct openpam_lexer *lx,
+	const char *service,
+	struct openpam_lexrange **rangesp)
+{
+	openpam_confidx_t *idx, **prev;
+	openpam_confidx_svc_t *svc;
+	struct openpam_word name;
+	pam_file_stamp_t stamp;
+	int i, n;
+
+	openpam_stamp_set(&stamp, sb);
+	pthread_mutex_lock(&openpam_confidx_mtx);
+	for (prev = &openpam_confidx_list; (idx = *prev) != NULL;
+	     prev = &idx->next)
+		if (strcmp(idx->path, path) == 0)
+			break;
+	if (idx != NULL &&
+	    (idx->stamp.dev != stamp.dev ||
+	    idx->stamp.ino != stamp.ino ||
+	    idx->stamp.size != stamp.size ||
+	    idx->stamp.size != (off_t)lx->len ||
+	    idx->stamp.mtime.tv_sec != stamp.mtime.tv_sec ||
+	    idx->stamp.mtime.tv_nsec != stamp.mtime.tv_nsec ||
+	    idx->stamp.ctime.tv_sec != stamp.ctime.tv_sec ||
+	    idx->stamp.ctime.tv_nsec != stamp.ctime.tv_nsec)) {
+		openpam_log(PAM_LOG_DEBUG, "%s: discarding stale index",
+		    path);
+		*prev = idx->next;
+		openpam_confidx_free(idx);
+		idx = NULL;
+	}
+	if (idx == NULL) {
+		if ((off_t)lx->len != stamp.size ||
+		    (idx = openpam_confidx_build(path, sb, lx)) == NULL) {
+			pthread_mutex_unlock(&openpam_confidx_mtx);
+			return (-1);
+		}
+		openpam_log(PAM_LOG_DEBUG, "%s: indexed %d services",
+		    path, idx->svcc);
+		idx->next = openpam_confidx_list;
+		openpam_confidx_list = idx;
+	}
+	name.str = service;
+	name.len = strlen(service);
+	n = 0;
+	*rangesp = NULL;
+	if ((svc = openpam_confidx_svc(idx, &name, 0)) != NULL) {
+		n = svc->rangec;
+		*rangesp = openpam_malloc(n * sizeof **rangesp);
+		if (*rangesp == NULL) {
+			pthread_mutex_unlock(&openpam_confidx_mtx);
+			return (-1);
+		}
+		for (i = 0; i < n; ++i)
+			(*rangesp)[i] = svc->rangev[i];
+	}
+	pthread_mutex_unlock(&openpam_confidx_mtx);
+	return (n);
+}
+
+/*
+ * NOPARSE
+ */
@@ -40,20 +40,33 @@
 #endif
 
 #include <sys/param.h>
+#include <sys/stat.h>
 
 #include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include <security/pam_appl.h>
 
 #include "openpam_impl.h"
 #include "openpam_ctype.h"
+#include "openpam_lex.h"
 #include "openpam_strlcat.h"
 #include "openpam_strlcpy.h"
 
-static int openpam_load_chain(pam_handle_t *, const char *, pam_facility_t);
+/*
+ * Sets of facilities
+ */
+#define PAM_FACILITY_BIT(f)	(1 << (f))
+#define PAM_FACILITY_ALL	((1 << PAM_NUM_FACILITIES) - 1)
+
+typedef struct openpam_pass openpam_pass_t;
+static int openpam_load_chain(pam_handle_t *, openpam_pass_t *,
+    pam_chain_t **, const char *, int);
 
 /*
  * Validate a service name.
@@ -88,12 +101,12 @@ valid_service_name(const char *name)
  * is not a valid facility name.
  */
 static pam_facility_t
-parse_facility_name(const char *name)
+parse_facility_name(const struct openpam_word *name)
 {
 	int i;
 
 	for (i = 0; i < PAM_NUM_FACILITIES; ++i)
-		if (strcmp(pam_facility_name[i], name) == 0)
+		if (openpam_wordeq(name, pam_facility_name[i]))
 			return (i);
 	return ((pam_facility_t)-1);
 }
@@ -105,16 +118,209 @@ parse_facility_name(const char *name)
  * not a valid control flag name.
  */
 static pam_control_t
-parse_control_flag(const char *name)
+parse_control_flag(const struct openpam_word *name)
 {
 	int i;
 
 	for (i = 0; i < PAM_NUM_CONTROL_FLAGS; ++i)
-		if (strcmp(pam_control_flag_name[i], name) == 0)
+		if (openpam_wordeq(name, pam_control_flag_name[i]))
 			return (i);
 	return ((pam_control_t)-1);
 }
 
+/*
+ * Linux-PAM style control actions
+ */
+typedef enum {
+	CTL_IGNORE,
+	CTL_OK,
+	CTL_DONE,
+	CTL_BAD,
+	CTL_DIE,
+	CTL_RESET,
+	CTL_JUMP,
+	CTL_NUM_ACTIONS
+} control_action_t;
+
+static const char *control_action_name[CTL_NUM_ACTIONS] = {
+	[CTL_IGNORE]	 = "ignore",
+	[CTL_OK]	 = "ok",
+	[CTL_DONE]	 = "done",
+	[CTL_BAD]	 = "bad",
+	[CTL_DIE]	 = "die",
+	[CTL_RESET]	 = "reset",
+};
+
+/*
+ * Parse a return code name as used in Linux-PAM style control actions:
+ * the name of the constant, in lower case and without the "PAM_"
+ * prefix, or "default".
+ *
+ * Returns the return code, PAM_RC_OTHER for "default", or -1 if the
+ * argument is not a valid return code name.
+ */
+static int
+parse_return_code(const char *str, size_t len)
+{
+	const char *name;
+	size_t i;
+	int r;
+
+	if (len == 7 && memcmp(str, "default", len) == 0)
+		return (PAM_RC_OTHER);
+	/* Linux-PAM spelling */
+	if (len == 19 && memcmp(str, "authtok_recover_err", len) == 0)
+		return (PAM_AUTHTOK_RECOVERY_ERR);
+	for (r = 0; r < PAM_NUM_ERRORS; ++r) {
+		name = pam_err_name[r] + 4;
+		for (i = 0; i < len && name[i] != '\0'; ++i)
+			if (str[i] != (is_upper(name[i]) ?
+			    name[i] - 'A' + 'a' : name[i]))
+				break;
+		if (i == len && name[i] == '\0')
+			return (r);
+	}
+	return (-1);
+}
+
+/*
+ * Parse a single "value=action" pair from a Linux-PAM style control.
+ *
+ * Returns 0 and sets the return code (see parse_return_code()), action
+ * and skip count, or -1 if the argument is not a valid pair.
+ */
+static int
+parse_control_pair(const char *str, size_t len,
+	int *code, int *act, int *skip)
+{
+	const char *eq;
+	size_t i;
+	int n;
+
+	if ((eq = memchr(str, '=', len)) == NULL ||
+	    (*code = parse_return_code(str, eq - str)) < 0)
+		return (-1);
+	len -= eq + 1 - str;
+	str = eq + 1;
+	if (len > 0 && is_digit(*str)) {
+		/* jump: skip the next n entries */
+		for (i = n = 0; i < len && n <= UCHAR_MAX; ++i) {
+			if (!is_digit(str[i]))
+				return (-1);
+			n = n * 10 + str[i] - '0';
+		}
+		if (n < 1 || n > UCHAR_MAX)
+			return (-1);
+		*act = CTL_JUMP;
+		*skip = n;
+		return (0);
+	}
+	for (n = 0; n < CTL_NUM_ACTIONS; ++n) {
+		if (control_action_name[n] != NULL &&
+		    strlen(control_action_name[n]) == len &&
+		    memcmp(str, control_action_name[n], len) == 0) {
+			*act = n;
+			*skip = 0;
+			return (0);
+		}
+	}
+	return (-1);
+}
+
+/*
+ * Parse a Linux-PAM style control, e.g. "[success=2 default=ignore]",
+ * which may span several words starting at wordv[*ip], and fill in the
+ * entry's action table accordingly.  Return codes which are not listed
+ * take the "default" action, which is "bad" unless specified.
+ *
+ * Returns 0 and advances *ip past the control, or -1 if it is invalid.
+ */
+static int
+parse_control_actions(const struct openpam_word *wordv, int *ip,
+	pam_chain_t *this)
+{
+	int ctl[PAM_NUM_RESULTS];
+	unsigned char skip[PAM_NUM_RESULTS];
+	const char *str;
+	size_t len;
+	int act, code, end, i, n, r;
+
+	for (r = 0; r < PAM_NUM_RESULTS; ++r)
+		ctl[r] = -1;
+	memset(skip, 0, sizeof skip);
+	for (i = *ip, end = 0; !end; ++i) {
+		if ((str = wordv[i].str) == NULL)
+			return (-1);
+		len = wordv[i].len;
+		if (i == *ip) {
+			/* the caller has checked that it starts with [ */
+			++str;
+			--len;
+		}
+		if (len > 0 && str[len - 1] == ']') {
+			--len;
+			end = 1;
+		}
+		if (len == 0)
+			continue;
+		if (parse_control_pair(str, len, &code, &act, &n) != 0)
+			return (-1);
+		ctl[code] = act;
+		skip[code] = n;
+	}
+	*ip = i;
+
+	/* fill in the blanks */
+	if (ctl[PAM_RC_OTHER] < 0)
+		ctl[PAM_RC_OTHER] = CTL_BAD;
+	for (r = 0; r < PAM_NUM_ERRORS; ++r) {
+		if (ctl[r] < 0) {
+			ctl[r] = ctl[PAM_RC_OTHER];
+			skip[r] = skip[PAM_RC_OTHER];
+		}
+	}
+	ctl[PAM_RC_NONFINAL] = ctl[PAM_SUCCESS];
+	skip[PAM_RC_NONFINAL] = skip[PAM_SUCCESS];
+
+	/* translate into the actions openpam_dispatch() understands */
+	for (r = 0; r < PAM_NUM_RESULTS; ++r) {
+		code = (r == PAM_RC_NONFINAL) ? PAM_SUCCESS : r;
+		switch (ctl[r]) {
+		case CTL_IGNORE:
+			this->action[r] = PAM_ACT_CONTINUE;
+			break;
+		case CTL_OK:
+			this->action[r] = code == PAM_SUCCESS ?
+			    PAM_ACT_SUCCEED : code == PAM_IGNORE ?
+			    PAM_ACT_CONTINUE : PAM_ACT_FAIL;
+			break;
+		case CTL_DONE:
+			this->action[r] =
+			    code == PAM_SUCCESS || code == PAM_IGNORE ?
+			    PAM_ACT_DONE : PAM_ACT_TERMINATE;
+			break;
+		case CTL_BAD:
+			this->action[r] = PAM_ACT_FAIL;
+			break;
+		case CTL_DIE:
+			this->action[r] = PAM_ACT_TERMINATE;
+			break;
+		case CTL_RESET:
+			this->action[r] = PAM_ACT_RESET;
+			break;
+		case CTL_JUMP:
+			/* as in Linux-PAM, only counts if not final */
+			this->action[r] = r == PAM_RC_NONFINAL ?
+			    PAM_ACT_SUCCEED : PAM_ACT_CONTINUE;
+			break;
+		default:
+			return (-1);
+		}
+		this->skip[r] = skip[r];
+	}
+	return (0);
+}
+
 /*
  * Validate a file name.
  *
@@ -143,84 +349,238 @@ valid_module_name(const char *name)
 
 typedef enum { pam_conf_style, pam_d_style } openpam_style_t;
 
+/*
+ * Include lines are expanded once per configuration pass: the first time
+ * a service is included, it is loaded for every facility it is known to
+ * be included for, and its chains are kept so that every include line
+ * which names it receives a copy.  The facilities for which a service is
+ * currently being loaded are used to detect include loops.
+ */
+#define OPENPAM_MAX_INCLUDE_DEPTH	16
+
+typedef struct openpam_include openpam_include_t;
+struct openpam_include {
+	char		*service;
+	int		 wanted;	/* facilities it is included for */
+	int		 loaded;	/* facilities loaded so far */
+	int		 loading;	/* facilities being loaded */
+	pam_chain_t	*chains[PAM_NUM_FACILITIES];
+	openpam_include_t *next;
+};
+
+struct openpam_pass {
+	openpam_include_t *includes;
+	int		 depth;
+};
+
+static void
+openpam_pass_fini(openpam_pass_t *pass)
+{
+	openpam_include_t *inc;
+
+	while ((inc = pass->includes) != NULL) {
+		pass->includes = inc->next;
+		openpam_clear_chains(inc->chains);
+		FREE(inc->service);
+		FREE(inc);
+	}
+}
+
+/*
+ * Look up an included service, creating an entry for it if necessary.
+ */
+static openpam_include_t *
+openpam_pass_include(openpam_pass_t *pass, const struct openpam_word *service)
+{
+	openpam_include_t *inc;
+
+	for (inc = pass->includes; inc != NULL; inc = inc->next)
+		if (openpam_wordeq(service, inc->service))
+			return (inc);
+	if ((inc = openpam_calloc(1, sizeof *inc)) == NULL)
+		return (NULL);
+	if ((inc->service = openpam_worddup(service)) == NULL) {
+		FREE(inc);
+		return (NULL);
+	}
+	inc->next = pass->includes;
+	pass->includes = inc;
+	return (inc);
+}
+
+/*
+ * Scan the remainder of a policy file for include lines and record which
+ * services are included for which of the requested facilities, so that
+ * each of them can be loaded for all of those facilities at once.  Lines
+ * which are malformed are ignored here; the parser will report them.
+ */
+static void
+openpam_scan_includes(openpam_pass_t *pass,
+	const struct openpam_lexer *lx,
+	const char *service,
+	int facilities,
+	openpam_style_t style)
+{
+	struct openpam_lexer scan;
+	struct openpam_word *wordv;
+	openpam_include_t *inc;
+	pam_facility_t fclt;
+	int i, wordc;
+
+	openpam_lex_init(&scan, lx->buf + lx->pos, lx->len - lx->pos);
+	while ((wordc = openpam_lex_line(&scan)) >= 0) {
+		wordv = scan.wordv;
+		i = 0;
+		if (wordc == 0 || (style == pam_conf_style &&
+		    !openpam_wordeq(&wordv[i++], service)))
+			continue;
+		if (wordc != i + 3 ||
+		    (fclt = parse_facility_name(&wordv[i])) ==
+		    (pam_facility_t)-1 ||
+		    !(facilities & PAM_FACILITY_BIT(fclt)) ||
+		    !openpam_wordeq(&wordv[i + 1], "include"))
+			continue;
+		if ((inc = openpam_pass_include(pass, &wordv[i + 2])) == NULL)
+			break;
+		inc->wanted |= PAM_FACILITY_BIT(fclt);
+	}
+	openpam_lex_fini(&scan);
+}
+
+/*
+ * Process an include line: append the specified service's chain for the
+ * specified facility to ours.
+ */
+static int
+openpam_include(pam_handle_t *pamh,
+	openpam_pass_t *pass,
+	pam_chain_t *chains[],
+	const char *service,
+	pam_facility_t fclt)
+{
+	openpam_include_t *inc;
+	struct openpam_word word;
+	int facilities, ret;
+
+	word.str = service;
+	word.len = strlen(service);
+	if ((inc = openpam_pass_include(pass, &word)) == NULL) {
+		openpam_log(PAM_LOG_ERROR, "malloc(): %m");
+		return (-1);
+	}
+	if (inc->loading & PAM_FACILITY_BIT(fclt)) {
+		openpam_log(PAM_LOG_ERROR, "%s: include loop", service);
+		errno = EINVAL;
+		return (-1);
+	}
+	if (!(inc->loaded & PAM_FACILITY_BIT(fclt))) {
+		if (pass->depth >= OPENPAM_MAX_INCLUDE_DEPTH) {
+			openpam_log(PAM_LOG_ERROR,
+			    "%s: includes nested too deeply", service);
+			errno = EINVAL;
+			return (-1);
+		}
+		facilities = (inc->wanted | PAM_FACILITY_BIT(fclt)) &
+		    ~inc->loaded;
+		inc->loading |= facilities;
+		pass->depth++;
+		ret = openpam_load_chain(pamh, pass, inc->chains, service,
+		    facilities);
+		pass->depth--;
+		inc->loading &= ~facilities;
+		if (ret < 0)
+			return (-1);
+		inc->loaded |= facilities;
+	}
+	if (openpam_copy_chain(&chains[fclt], inc->chains[fclt]) != 0)
+		return (-1);
+	return (0);
+}
+
 /*
  * Extracts given chains from a policy file.
  *
  * Returns the number of policy entries which were found for the specified
- * service and facility, or -1 if a system error occurred or a syntax
+ * service and facilities, or -1 if a system error occurred or a syntax
  * error was encountered.
  */
 static int
 openpam_parse_chain(pam_handle_t *pamh,
+	openpam_pass_t *pass,
+	pam_chain_t *chains[],
 	const char *service,
-	pam_facility_t facility,
-	FILE *f,
+	int facilities,
+	struct openpam_lexer *lx,
 	const char *filename,
 	openpam_style_t style)
 {
-	pam_chain_t *this, **next;
+	pam_chain_t ent, *this;
 	pam_facility_t fclt;
 	pam_control_t ctlf;
-	char *name, *servicename, *modulename;
-	int count, lineno, ret, serrno;
-	char **wordv, *word;
-	int i, wordc;
+	char servicename[PATH_MAX], modulename[PATH_MAX];
+	struct openpam_word *wordv, *word;
+	int count, ret, scanned, serrno;
+	int guard, i, wordc;
 
 	count = 0;
 	this = NULL;
-	name = NULL;
-	lineno = 0;
-	wordc = 0;
-	wordv = NULL;
-	while ((wordv = openpam_readlinev(f, &lineno, &wordc)) != NULL) {
+	scanned = 0;
+	while ((wordc = openpam_lex_line(lx)) >= 0) {
 		/* blank line? */
-		if (wordc == 0) {
-			FREEV(wordc, wordv);
+		if (wordc == 0)
 			continue;
-		}
+		wordv = lx->wordv;
 		i = 0;
 
 		/* check service name if necessary */
 		if (style == pam_conf_style &&
-		    strcmp(wordv[i++], service) != 0) {
-			FREEV(wordc, wordv);
+		    !openpam_wordeq(&wordv[i++], service))
 			continue;
-		}
 
 		/* check facility name */
-		if ((word = wordv[i++]) == NULL ||
+		if ((word = &wordv[i++])->str == NULL ||
 		    (fclt = parse_facility_name(word)) == (pam_facility_t)-1) {
 			openpam_log(PAM_LOG_ERROR,
 			    "%s(%d): missing or invalid facility",
-			    filename, lineno);
+			    filename, lx->lineno);
 			errno = EINVAL;
 			goto fail;
 		}
-		if (facility != fclt && facility != PAM_FACILITY_ANY) {
-			FREEV(wordc, wordv);
+		if (!(facilities & PAM_FACILITY_BIT(fclt)))
 			continue;
-		}
 
 		/* check for "include" */
-		if ((word = wordv[i++]) != NULL &&
-		    strcmp(word, "include") == 0) {
-			if ((servicename = wordv[i++]) == NULL ||
+		if ((word = &wordv[i++])->str != NULL &&
+		    openpam_wordeq(word, "include")) {
+			if (wordv[i].str == NULL ||
+			    openpam_wordcpy(servicename, &wordv[i++],
+			    sizeof servicename) != 0 ||
 			    !valid_service_name(servicename)) {
 				openpam_log(PAM_LOG_ERROR,
 				    "%s(%d): missing or invalid service name",
-				    filename, lineno);
+				    filename, lx->lineno);
 				errno = EINVAL;
 				goto fail;
 			}
-			if (wordv[i] != NULL) {
+			if (wordv[i].str != NULL) {
 				openpam_log(PAM_LOG_ERROR,
 				    "%s(%d): garbage at end of line",
-				    filename, lineno);
+				    filename, lx->lineno);
 				errno = EINVAL;
 				goto fail;
 			}
-			ret = openpam_load_chain(pamh, servicename, fclt);
-			FREEV(wordc, wordv);
+			/*
+			 * Find out which services the rest of this file
+			 * includes for which facilities, so each of them
+			 * is only parsed once.
+			 */
+			if (!scanned) {
+				openpam_scan_includes(pass, lx, service,
+				    facilities, style);
+				scanned = 1;
+			}
+			ret = openpam_include(pamh, pass, chains, servicename,
+			    fclt);
 			if (ret < 0) {
 				/*
 				 * Bogus errno, but this ensures that the
@@ -234,80 +594,98 @@ openpam_parse_chain(pam_handle_t *pamh,
 			continue;
 		}
 
-		/* get control flag */
-		if (word == NULL || /* same word we compared to "include" */
+		/* get control flag (same word we compared to "include") */
+		memset(&ent, 0, sizeof ent);
+		if (word->str != NULL && word->len > 0 && *word->str == '[') {
+			--i;
+			if (parse_control_actions(wordv, &i, &ent) != 0) {
+				openpam_log(PAM_LOG_ERROR,
+				    "%s(%d): invalid control actions",
+				    filename, lx->lineno);
+				errno = EINVAL;
+				goto fail;
+			}
+			ctlf = PAM_CUSTOM_CONTROL;
+		} else if (word->str == NULL ||
 		    (ctlf = parse_control_flag(word)) == (pam_control_t)-1) {
 			openpam_log(PAM_LOG_ERROR,
 			    "%s(%d): missing or invalid control flag",
-			    filename, lineno);
+			    filename, lx->lineno);
 			errno = EINVAL;
 			goto fail;
 		}
 
+		/* skip over guards, if any */
+		for (guard = i; wordv[i].str != NULL && wordv[i].len > 0 &&
+		     *wordv[i].str == '?'; ++i)
+			/* nothing */ ;
+
 		/* get module name */
-		if ((modulename = wordv[i++]) == NULL ||
+		if (wordv[i].str == NULL ||
+		    openpam_wordcpy(modulename, &wordv[i++],
+		    sizeof modulename) != 0 ||
 		    !valid_module_name(modulename)) {
 			openpam_log(PAM_LOG_ERROR,
 			    "%s(%d): missing or invalid module name",
-			    filename, lineno);
+			    filename, lx->lineno);
 			errno = EINVAL;
 			goto fail;
 		}
 
-		/* allocate new entry */
-		if ((this = calloc(1, sizeof *this)) == NULL)
-			goto syserr;
+		/* set up new entry */
+		this = &ent;
 		this->flag = ctlf;
 
-		/* load module */
-		if ((this->module = openpam_load_module(modulename)) == NULL) {
+		/* load module, or take note of it for later */
+		if (openpam_chain_init(this, modulename) != 0) {
 			if (errno == ENOENT)
 				errno = ENOEXEC;
 			goto fail;
 		}
 
 		/*
-		 * The remaining items in wordv are the module's
-		 * arguments.  We could set this->optv = wordv + i, but
-		 * then free(this->optv) wouldn't work.  Instead, we free
-		 * the words we've already consumed, shift the rest up,
-		 * and clear the tail end of the array.
+		 * The remaining words are the module's arguments.  They
+		 * are packed into a single allocation together with the
+		 * array that points to them.
 		 */
+		if ((this->optv = openpam_lex_pack(lx, i, wordc)) == NULL)
+			goto syserr;
 		this->optc = wordc - i;
-		for (i = 0; i < wordc - this->optc; ++i) {
-			FREE(wordv[i]);
-		}
-		for (i = 0; i < this->optc; ++i) {
-			wordv[i] = wordv[wordc - this->optc + i];
-			wordv[wordc - this->optc + i] = NULL;
+		this->optidx = openpam_optidx(this->optc, this->optv);
+
+		/* likewise the guards, which are also compiled */
+		if (i - 1 > guard) {
+			this->guardv = openpam_lex_pack(lx, guard, i - 1);
+			if (this->guardv == NULL)
+				goto syserr;
+			this->guardc = i - 1 - guard;
+			this->guards = openpam_guards(this->guardc,
+			    this->guardv);
+			if (this->guards == NULL && errno == EINVAL) {
+				openpam_log(PAM_LOG_ERROR,
+				    "%s(%d): invalid guard",
+				    filename, lx->lineno);
+				goto fail;
+			}
+			if (this->guards == NULL)
+				goto syserr;
 		}
-		this->optv = wordv;
-		wordv = NULL;
-		wordc = 0;
 
 		/* hook it up */
-		for (next = &pamh->chains[fclt]; *next != NULL;
-		     next = &(*next)->next)
-			/* nothing */ ;
-		*next = this;
+		if (openpam_chain_append(&chains[fclt], this) != 0)
+			goto syserr;
 		this = NULL;
 		++count;
 	}
 	/*
-	 * The loop ended because openpam_readword() returned NULL, which
-	 * can happen for four different reasons: an I/O error (ferror(f)
-	 * is true), a memory allocation failure (ferror(f) is false,
-	 * feof(f) is false, errno is non-zero), the file ended with an
-	 * unterminated quote or backslash escape (ferror(f) is false,
-	 * feof(f) is true, errno is non-zero), or the end of the file was
-	 * reached without error (ferror(f) is false, feof(f) is true,
-	 * errno is zero).
+	 * The loop ended because openpam_lex_line() returned -1, which
+	 * can happen for three different reasons: a memory allocation
+	 * failure or an unterminated quote or backslash escape (errno is
+	 * non-zero), or the end of the file was reached without error
+	 * (errno is zero).
 	 */
-	if (ferror(f) || errno != 0)
+	if (errno != 0)
 		goto syserr;
-	if (!feof(f))
-		goto fail;
-	fclose(f);
 	return (count);
 syserr:
 	serrno = errno;
@@ -316,19 +694,15 @@ syserr:
 	/* fall through */
 fail:
 	serrno = errno;
-	if (this && this->optc && this->optv)
-		FREEV(this->optc, this->optv);
-	FREE(this);
-	FREEV(wordc, wordv);
-	FREE(wordv);
-	FREE(name);
-	fclose(f);
+	if (this != NULL)
+		openpam_chain_fini(this);
 	errno = serrno;
 	return (-1);
 }
 
 /*
- * Read the specified chains from the specified file.
+ * Read the specified chains from the specified file.  If the file is on
+ * the policy search path, the directory cache may be used to open it.
  *
  * Returns 0 if the file exists but does not contain any matching lines.
  *
@@ -339,53 +713,163 @@ fail:
  */
 static int
 openpam_load_file(pam_handle_t *pamh,
+	openpam_pass_t *pass,
+	pam_chain_t *chains[],
 	const char *service,
-	pam_facility_t facility,
+	int facilities,
 	const char *filename,
-	openpam_style_t style)
+	openpam_style_t style,
+	int search)
 {
-	FILE *f;
-	int ret, serrno;
+	struct openpam_lexer lx, sub;
+	struct openpam_lexrange *rangev;
+	struct stat sb;
+	int count, fd, i, indexed, n, ret, serrno;
 
 	/* attempt to open the file */
-	if ((f = fopen(filename, "r")) == NULL) {
+	if (search && OPENPAM_FEATURE(CACHE_POLICY_PATH))
+		fd = openpam_dircache_open(filename);
+	else
+		fd = open(filename, O_RDONLY);
+	if (fd < 0) {
 		serrno = errno;
 		openpam_log(errno == ENOENT ? PAM_LOG_DEBUG : PAM_LOG_ERROR,
 		    "%s: %m", filename);
+		if (serrno == ENOENT)
+			openpam_cache_stamp(pamh, filename, NULL);
 		errno = serrno;
 		RETURNN(-1);
-	} else {
-		openpam_log(PAM_LOG_DEBUG, "found %s", filename);
 	}
+	openpam_log(PAM_LOG_DEBUG, "found %s", filename);
+	if (fstat(fd, &sb) != 0) {
+		serrno = errno;
+		openpam_log(PAM_LOG_ERROR, "%s: %m", filename);
+		close(fd);
+		errno = serrno;
+		RETURNN(-1);
+	}
+	openpam_cache_stamp(pamh, filename, &sb);
 
 	/* verify type, ownership and permissions */
 	if (OPENPAM_FEATURE(VERIFY_POLICY_FILE) &&
-	    openpam_check_desc_owner_perms(filename, fileno(f)) != 0) {
+	    openpam_check_stat_owner_perms(filename, &sb) != 0) {
 		/* already logged the cause */
 		serrno = errno;
-		fclose(f);
+		close(fd);
+		errno = serrno;
+		RETURNN(-1);
+	}
+
+	/* slurp it in; we already know its state in case we index it */
+	indexed = (style == pam_conf_style);
+	if (openpam_lex_open(&lx, fd) != 0) {
+		serrno = errno;
+		openpam_log(PAM_LOG_ERROR, "%s: %m", filename);
+		close(fd);
 		errno = serrno;
 		RETURNN(-1);
 	}
+	close(fd);
+
+	/* in pam.conf style, parse only the service's own lines */
+	if (indexed && (n = openpam_confidx_lookup(filename, &sb, &lx,
+	    service, &rangev)) >= 0) {
+		for (ret = i = 0; i < n && ret >= 0; ++i) {
+			openpam_lex_init(&sub, lx.buf + rangev[i].offset,
+			    rangev[i].len);
+			sub.lineno = rangev[i].lineno;
+			if ((count = openpam_parse_chain(pamh, pass, chains,
+			    service, facilities, &sub, filename, style)) < 0)
+				ret = -1;
+			else
+				ret += count;
+			serrno = errno;
+			openpam_lex_fini(&sub);
+			errno = serrno;
+		}
+		serrno = errno;
+		FREE(rangev);
+		openpam_lex_fini(&lx);
+		errno = serrno;
+		RETURNN(ret);
+	}
 
 	/* parse the file */
-	ret = openpam_parse_chain(pamh, service, facility,
-	    f, filename, style);
+	ret = openpam_parse_chain(pamh, pass, chains, service, facilities,
+	    &lx, filename, style);
+	serrno = errno;
+	openpam_lex_fini(&lx);
+	errno = serrno;
 	RETURNN(ret);
 }
 
+#if defined(OPENPAM_EMBEDDED)
+/*
+ * Copies the given chains from the policy compiled into the library for
+ * the given service.
+ *
+ * Returns the number of policy entries which were found for the specified
+ * facilities, or -1 if a system error occurred or a module could not be
+ * loaded.  Returns -1 and sets errno to ENOENT if there is no compiled-in
+ * policy for the service.
+ */
+static int
+openpam_load_embedded(pam_chain_t *chains[],
+	const char *service,
+	int facilities)
+{
+	pam_policy_t **policy;
+	pam_chain_t *this;
+	pam_facility_t fclt;
+	int count, n;
+
+	policy = pam_embedded_policies;
+	while (policy != NULL && *policy != NULL &&
+	    strcmp((*policy)->service, service) != 0)
+		++policy;
+	if (policy == NULL || *policy == NULL) {
+		errno = ENOENT;
+		return (-1);
+	}
+	openpam_log(PAM_LOG_LIBDEBUG, "using embedded %s policy", service);
+	count = 0;
+	for (fclt = 0; fclt < PAM_NUM_FACILITIES; ++fclt) {
+		if (!(facilities & PAM_FACILITY_BIT(fclt)))
+			continue;
+		n = openpam_chain_length(chains[fclt]);
+		if (openpam_copy_chain(&chains[fclt],
+		    (*policy)->chains[fclt]) != 0)
+			return (-1);
+		if (chains[fclt] == NULL)
+			continue;
+		for (this = &chains[fclt][n]; !OPENPAM_CHAIN_END(this);
+		     ++this) {
+			if (!OPENPAM_FEATURE(LAZY_MODULES) &&
+			    openpam_chain_module(this) == NULL) {
+				errno = ENOEXEC;
+				return (-1);
+			}
+			++count;
+		}
+	}
+	return (count);
+}
+#endif
+
 /*
  * Locates the policy file for a given service and reads the given chains
  * from it.
  *
  * Returns the number of policy entries which were found for the specified
- * service and facility, or -1 if a system error occurred or a syntax
+ * service and facilities, or -1 if a system error occurred or a syntax
  * error was encountered.
  */
 static int
 openpam_load_chain(pam_handle_t *pamh,
+	openpam_pass_t *pass,
+	pam_chain_t *chains[],
 	const char *service,
-	pam_facility_t facility)
+	int facilities)
 {
 	const char *p, **path;
 	char filename[PATH_MAX];
@@ -393,7 +877,7 @@ openpam_load_chain(pam_handle_t *pamh,
 	openpam_style_t style;
 	int ret;
 
-	ENTERS(facility < 0 ? "any" : pam_facility_name[facility]);
+	ENTERS(service);
 
 	/* either absolute or relative to cwd */
 	if (strchr(service, '/') != NULL) {
@@ -401,11 +885,20 @@ openpam_load_chain(pam_handle_t *pamh,
 			style = pam_conf_style;
 		else
 			style = pam_d_style;
-		ret = openpam_load_file(pamh, service, facility,
-		    service, style);
+		ret = openpam_load_file(pamh, pass, chains, service,
+		    facilities, service, style, 0);
 		RETURNN(ret);
 	}
 
+#if defined(OPENPAM_EMBEDDED)
+	/* compiled-in policies, if they take precedence */
+	if (OPENPAM_FEATURE(PREFER_EMBEDDED)) {
+		ret = openpam_load_embedded(chains, service, facilities);
+		if (ret >= 0 || errno != ENOENT)
+			RETURNN(ret);
+	}
+#endif
+
 	/* search standard locations */
 	for (path = openpam_policy_path; *path != NULL; ++path) {
 		/* construct filename */
@@ -424,8 +917,8 @@ openpam_load_chain(pam_handle_t *pamh,
 		} else {
 			style = pam_conf_style;
 		}
-		ret = openpam_load_file(pamh, service, facility,
-		    filename, style);
+		ret = openpam_load_file(pamh, pass, chains, service,
+		    facilities, filename, style, 1);
 		/* success */
 		if (ret > 0)
 			RETURNN(ret);
@@ -437,6 +930,14 @@ openpam_load_chain(pam_handle_t *pamh,
 			RETURNN(ret);
 	}
 
+#if defined(OPENPAM_EMBEDDED)
+	/* compiled-in policies, if they are a fallback */
+	if (!OPENPAM_FEATURE(PREFER_EMBEDDED)) {
+		ret = openpam_load_embedded(chains, service, facilities);
+		RETURNN(ret);
+	}
+#endif
+
 	/* no hit */
 	errno = ENOENT;
 	RETURNN(-1);
@@ -452,29 +953,56 @@ int
 openpam_configure(pam_handle_t *pamh,
 	const char *service)
 {
+	openpam_pass_t pass;
 	pam_facility_t fclt;
-	int serrno;
+	int caching, missing, serrno;
 
 	ENTERS(service);
 	if (!valid_service_name(service)) {
 		openpam_log(PAM_LOG_ERROR, "invalid service name");
 		RETURNC(PAM_SYSTEM_ERR);
 	}
-	if (openpam_load_chain(pamh, service, PAM_FACILITY_ANY) < 0) {
+	/*
+	 * If the caller is already recording which files the policy is
+	 * read from, it wants them actually read, so skip the shortcuts.
+	 */
+	caching = 0;
+	if (pamh->policy == NULL) {
+		if (OPENPAM_FEATURE(POLICY_IMAGE) &&
+		    openpam_image_lookup(pamh, service))
+			RETURNC(PAM_SUCCESS);
+		if (OPENPAM_FEATURE(CACHE_POLICY)) {
+			if (openpam_cache_lookup(pamh, service))
+				RETURNC(PAM_SUCCESS);
+			openpam_cache_begin(pamh, service);
+			caching = 1;
+		}
+	}
+	memset(&pass, 0, sizeof pass);
+	if (openpam_load_chain(pamh, &pass, pamh->chains, service,
+	    PAM_FACILITY_ALL) < 0) {
 		if (errno != ENOENT)
 			goto load_err;
 	}
-	for (fclt = 0; fclt < PAM_NUM_FACILITIES; ++fclt) {
-		if (pamh->chains[fclt] != NULL)
-			continue;
-		if (OPENPAM_FEATURE(FALLBACK_TO_OTHER)) {
-			if (openpam_load_chain(pamh, PAM_OTHER, fclt) < 0)
-				goto load_err;
-		}
+	/* fill in all the missing facilities from a single parse */
+	missing = 0;
+	for (fclt = 0; fclt < PAM_NUM_FACILITIES; ++fclt)
+		if (pamh->chains[fclt] == NULL)
+			missing |= PAM_FACILITY_BIT(fclt);
+	if (missing != 0 && OPENPAM_FEATURE(FALLBACK_TO_OTHER)) {
+		if (openpam_load_chain(pamh, &pass, pamh->chains, PAM_OTHER,
+		    missing) < 0)
+			goto load_err;
 	}
+	openpam_pass_fini(&pass);
+	if (caching)
+		openpam_cache_commit(pamh);
 	RETURNC(PAM_SUCCESS);
 load_err:
 	serrno = errno;
+	openpam_pass_fini(&pass);
+	if (caching)
+		openpam_cache_abort(pamh);
 	openpam_clear_chains(pamh->chains);
 	errno = serrno;
 	RETURNC(PAM_SYSTEM_ERR);
@@ -174,6 +174,8 @@ const char *openpam_policy_path[] = {
 	NULL
 };
 
+const char *openpam_policy_image = "/etc/pam.img";
+
 const char *openpam_module_path[] = {
 #ifdef OPENPAM_MODULES_DIRECTORY
 	OPENPAM_MODULES_DIRECTORY,
@@ -41,6 +41,7 @@ extern const char *pam_func_name[PAM_NUM_PRIMITIVES];
 extern const char *pam_sm_func_name[PAM_NUM_PRIMITIVES];
 
 extern const char *openpam_policy_path[];
+extern const char *openpam_policy_image;
 extern const char *openpam_module_path[];
 
 #endif
@@ -0,0 +1,273 @@
+/*-
+ * Copyright (c) 2026 Dag-Erling Smørgrav
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote
+ *    products derived from this software without specific prior written
+ *    permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $OpenPAM$
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <security/pam_appl.h>
+
+#include "openpam_impl.h"
+
+#ifndef O_DIRECTORY
+#define O_DIRECTORY 0
+#endif
+#ifndef O_CLOEXEC
+#define O_CLOEXEC 0
+#endif
+
+/*
+ * Process-wide cache of the directories on the policy search path.  Each
+ * entry holds a descriptor for the directory, which policy files are
+ * opened relative to, and a list of names which are known not to exist
+ * in it.  If the directory itself does not exist, the entry instead
+ * holds a descriptor for its nearest existing ancestor.
+ *
+ * An entry is only trusted as long as whatever its descriptor refers to
+ * has not been modified since, which is checked with a single fstat(2)
+ * on every lookup.  Since the modification time may have a granularity
+ * as coarse as one second, an entry is not trusted either unless the
+ * directory was last modified well before we looked at it.
+ */
+typedef struct openpam_dircache openpam_dircache_t;
+struct openpam_dircache {
+	char		*path;		/* directory, with trailing slash */
+	size_t		 len;
+	int		 fd;		/* the directory or an ancestor */
+	int		 found;		/* fd refers to the directory itself */
+	pam_file_stamp_t stamp;		/* state of what fd refers to */
+	time_t		 when;		/* when the stamp was taken */
+	char		**absent;	/* names known not to exist */
+	int		 nabsent;
+	int		 absentsize;
+	openpam_dircache_t *next;
+};
+
+static pthread_mutex_t openpam_dircache_mtx = PTHREAD_MUTEX_INITIALIZER;
+static openpam_dircache_t *openpam_dircache_list;
+
+/*
+ * Forget everything we know about a directory.
+ */
+static void
+openpam_dircache_flush(openpam_dircache_t *dc)
+{
+
+	if (dc->fd >= 0)
+		close(dc->fd);
+	dc->fd = -1;
+	dc->found = 0;
+	while (dc->nabsent > 0) {
+		--dc->nabsent;
+		FREE(dc->absent[dc->nabsent]);
+	}
+}
+
+/*
+ * Check whether a directory had been left alone for long enough before
+ * we looked at it that nothing can have slipped past its mtime.
+ */
+static int
+openpam_dircache_settled(const openpam_dircache_t *dc)
+{
+
+	return (dc->fd >= 0 && dc->stamp.mtime.tv_sec + 1 < dc->when);
+}
+
+/*
+ * Check whether what we know about a directory can still be trusted.
+ */
+static int
+openpam_dircache_valid(const openpam_dircache_t *dc)
+{
+	pam_file_stamp_t now;
+	struct stat sb;
+
+	if (!openpam_dircache_settled(dc))
+		return (0);
+	if (fstat(dc->fd, &sb) != 0)
+		return (0);
+	openpam_stamp_set(&now, &sb);
+	return (now.dev == dc->stamp.dev &&
+	    now.ino == dc->stamp.ino &&
+	    now.mtime.tv_sec == dc->stamp.mtime.tv_sec &&
+	    now.mtime.tv_nsec == dc->stamp.mtime.tv_nsec);
+}
+
+/*
+ * Open a directory, or failing that, its nearest existing ancestor.
+ */
+static int
+openpam_dircache_resolve(openpam_dircache_t *dc)
+{
+	char dirname[PATH_MAX];
+	struct stat sb;
+	size_t len;
+	int fd;
+
+	if (dc->len >= sizeof dirname) {
+		errno = ENAMETOOLONG;
+		return (-1);
+	}
+	memcpy(dirname, dc->path, dc->len);
+	len = dc->len;
+	dc->found = 1;
+	for (;;) {
+		/* strip trailing slashes, but not the root */
+		while (len > 1 && dirname[len - 1] == '/')
+			--len;
+		dirname[len] = '\0';
+		fd = open(dirname, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		if (fd >= 0) {
+			if (fstat(fd, &sb) == 0 && S_ISDIR(sb.st_mode))
+				break;
+			close(fd);
+			errno = ENOTDIR;
+		}
+		if (errno != ENOENT && errno != ENOTDIR)
+			return (-1);
+		/* move up one level */
+		while (len > 0 && dirname[len - 1] != '/')
+			--len;
+		if (len == 0)
+			return (-1);
+		dc->found = 0;
+	}
+	dc->fd = fd;
+	openpam_stamp_set(&dc->stamp, &sb);
+	dc->when = time(NULL);
+	return (0);
+}
+
+/*
+ * Record that a name does not exist in a directory.  Failure is not an
+ * error; we will simply look for it again next time.
+ */
+static void
+openpam_dircache_absent(openpam_dircache_t *dc, const char *name)
+{
+	char **absent;
+	int size;
+
+	if (dc->nabsent == dc->absentsize) {
+		size = dc->absentsize ? dc->absentsize * 2 : 8;
+		absent = openpam_realloc(dc->absent, size * sizeof *absent);
+		if (absent == NULL)
+			return;
+		dc->absent = absent;
+		dc->absentsize = size;
+	}
+	if ((dc->absent[dc->nabsent] = openpam_strdup(name)) != NULL)
+		dc->nabsent++;
+}
+
+/*
+ * OpenPAM internal
+ *
+ * Open a file in one of the directories on the policy search path,
+ * answering from the cache if the file is known not to exist.  Behaves
+ * like open(2) with O_RDONLY.
+ */
+
+int
+openpam_dircache_open(const char *path)
+{
+	openpam_dircache_t *dc;
+	const char *name;
+	size_t len;
+	int fd, i, serrno;
+
+	if ((name = strrchr(path, '/')) == NULL || *++name == '\0')
+		return (open(path, O_RDONLY));
+	len = name - path;
+	pthread_mutex_lock(&openpam_dircache_mtx);
+	for (dc = openpam_dircache_list; dc != NULL; dc = dc->next)
+		if (dc->len == len && memcmp(dc->path, path, len) == 0)
+			break;
+	if (dc == NULL) {
+		if ((dc = openpam_calloc(1, sizeof *dc)) == NULL ||
+		    (dc->path = openpam_malloc(len + 1)) == NULL) {
+			FREE(dc);
+			pthread_mutex_unlock(&openpam_dircache_mtx);
+			return (open(path, O_RDONLY));
+		}
+		memcpy(dc->path, path, len);
+		dc->path[len] = '\0';
+		dc->len = len;
+		dc->fd = -1;
+		dc->next = openpam_dircache_list;
+		openpam_dircache_list = dc;
+	}
+	if (!openpam_dircache_valid(dc)) {
+		openpam_dircache_flush(dc);
+		if (openpam_dircache_resolve(dc) != 0 ||
+		    !openpam_dircache_settled(dc)) {
+			/* can't tell yet, try again next time */
+			openpam_dircache_flush(dc);
+			pthread_mutex_unlock(&openpam_dircache_mtx);
+			return (open(path, O_RDONLY));
+		}
+	}
+	if (!dc->found) {
+		pthread_mutex_unlock(&openpam_dircache_mtx);
+		errno = ENOENT;
+		return (-1);
+	}
+	for (i = 0; i < dc->nabsent; ++i) {
+		if (strcmp(dc->absent[i], name) == 0) {
+			pthread_mutex_unlock(&openpam_dircache_mtx);
+			errno = ENOENT;
+			return (-1);
+		}
+	}
+	if ((fd = openat(dc->fd, name, O_RDONLY)) < 0 && errno == ENOENT)
+		openpam_dircache_absent(dc, name);
+	serrno = errno;
+	pthread_mutex_unlock(&openpam_dircache_mtx);
+	errno = serrno;
+	return (fd);
+}
+
+/*
+ * NOPARSE
+ */
@@ -42,6 +42,8 @@
 #include <sys/param.h>
 
 #include <stdint.h>
+#include <string.h>
+#include <time.h>
 
 #include <security/pam_appl.h>
 
@@ -53,6 +55,55 @@ static void openpam_check_error_code(int, int);
 #define openpam_check_error_code(a, b)
 #endif /* !defined(OPENPAM_RELAX_CHECKS) */
 
+/*
+ * Action to take for a success, a success which may not end the chain,
+ * PAM_IGNORE and anything else, by control flag
+ */
+static const unsigned char
+openpam_control_actions[PAM_NUM_CONTROL_FLAGS][4] = {
+	[PAM_BINDING] = {
+		PAM_ACT_BREAK, PAM_ACT_SUCCEED,
+		PAM_ACT_CONTINUE, PAM_ACT_FAIL,
+	},
+	[PAM_REQUIRED] = {
+		PAM_ACT_SUCCEED, PAM_ACT_SUCCEED,
+		PAM_ACT_CONTINUE, PAM_ACT_FAIL,
+	},
+	[PAM_REQUISITE] = {
+		PAM_ACT_SUCCEED, PAM_ACT_SUCCEED,
+		PAM_ACT_CONTINUE, PAM_ACT_TERMINATE,
+	},
+	[PAM_SUFFICIENT] = {
+		PAM_ACT_BREAK, PAM_ACT_SUCCEED,
+		PAM_ACT_CONTINUE, PAM_ACT_RECORD,
+	},
+	[PAM_OPTIONAL] = {
+		PAM_ACT_SUCCEED, PAM_ACT_SUCCEED,
+		PAM_ACT_CONTINUE, PAM_ACT_RECORD,
+	},
+};
+
+/*
+ * OpenPAM internal
+ *
+ * Fill in a chain entry's action table from its control flag.
+ */
+
+void
+openpam_chain_actions(pam_chain_t *this)
+{
+	const unsigned char *row;
+	int i;
+
+	row = openpam_control_actions[this->flag];
+	for (i = 0; i < PAM_NUM_RESULTS; ++i)
+		this->action[i] = row[3];
+	this->action[PAM_SUCCESS] = row[0];
+	this->action[PAM_RC_NONFINAL] = row[1];
+	this->action[PAM_IGNORE] = row[2];
+	memset(this->skip, 0, sizeof this->skip);
+}
+
 /*
  * OpenPAM internal
  *
@@ -65,8 +116,11 @@ openpam_dispatch(pam_handle_t *pamh,
 	int flags)
 {
 	pam_chain_t *chain;
-	int err, fail, nsuccess, r;
-	int debug;
+	pam_stats_t *stats;
+	struct timespec start;
+	char **optv;
+	int act, err, fail, n, nsuccess, r, rc, success;
+	int debug, facility, optc;
 
 	ENTER();
 
@@ -84,26 +138,51 @@ openpam_dispatch(pam_handle_t *pamh,
 	switch (primitive) {
 	case PAM_SM_AUTHENTICATE:
 	case PAM_SM_SETCRED:
-		chain = pamh->chains[PAM_AUTH];
+		facility = PAM_AUTH;
 		break;
 	case PAM_SM_ACCT_MGMT:
-		chain = pamh->chains[PAM_ACCOUNT];
+		facility = PAM_ACCOUNT;
 		break;
 	case PAM_SM_OPEN_SESSION:
 	case PAM_SM_CLOSE_SESSION:
-		chain = pamh->chains[PAM_SESSION];
+		facility = PAM_SESSION;
 		break;
 	case PAM_SM_CHAUTHTOK:
-		chain = pamh->chains[PAM_PASSWORD];
+		facility = PAM_PASSWORD;
 		break;
 	default:
 		RETURNC(PAM_SYSTEM_ERR);
 	}
+	chain = pamh->chains[facility];
+
+	/*
+	 * For pam_setcred() and pam_chauthtok() with the
+	 * PAM_PRELIM_CHECK flag, treat "sufficient" as "optional".
+	 */
+	if (primitive == PAM_SM_SETCRED ||
+	    (primitive == PAM_SM_CHAUTHTOK && (flags & PAM_PRELIM_CHECK)))
+		success = PAM_RC_NONFINAL;
+	else
+		success = PAM_SUCCESS;
 
 	/* execute */
 	err = PAM_SUCCESS;
 	fail = nsuccess = 0;
-	for (; chain != NULL; chain = chain->next) {
+	for (; chain != NULL && !OPENPAM_CHAIN_END(chain); ++chain) {
+		/* skip the module, without loading it, if a guard fails */
+		if (chain->guards != NULL &&
+		    !openpam_guards_match(pamh, chain->guards)) {
+			openpam_log(PAM_LOG_LIBDEBUG, "skipping %s",
+			    chain->module != NULL ?
+			    chain->module->path : chain->modname);
+			continue;
+		}
+		if (openpam_chain_module(chain) == NULL) {
+			/* deferred load failed, treat as a broken policy */
+			err = PAM_SYSTEM_ERR;
+			fail = 1;
+			break;
+		}
 		if (chain->module->func[primitive] == NULL) {
 			openpam_log(PAM_LOG_ERROR, "%s: no %s()",
 			    chain->module->path, pam_sm_func_name[primitive]);
@@ -111,13 +190,21 @@ openpam_dispatch(pam_handle_t *pamh,
 		} else {
 			pamh->primitive = primitive;
 			pamh->current = chain;
-			debug = (openpam_get_option(pamh, "debug") != NULL);
+			debug = openpam_get_option_flag(pamh,
+			    OPENPAM_OPT_DEBUG);
 			if (debug)
 				++openpam_debug;
 			openpam_log(PAM_LOG_LIBDEBUG, "calling %s() in %s",
 			    pam_sm_func_name[primitive], chain->module->path);
+			optv = openpam_chain_optv(pamh, chain, &optc);
+			stats = openpam_stats_get(pamh, chain, facility,
+			    primitive);
+			if (stats != NULL)
+				clock_gettime(CLOCK_MONOTONIC, &start);
 			r = (chain->module->func[primitive])(pamh, flags,
-			    chain->optc, (const char **)(intptr_t)chain->optv);
+			    optc, (const char **)(intptr_t)optv);
+			if (stats != NULL)
+				openpam_stats_update(stats, r, &start);
 			pamh->current = NULL;
 			openpam_log(PAM_LOG_LIBDEBUG, "%s: %s(): %s",
 			    chain->module->path, pam_sm_func_name[primitive],
@@ -126,49 +213,76 @@ openpam_dispatch(pam_handle_t *pamh,
 				--openpam_debug;
 		}
 
-		if (r == PAM_IGNORE)
-			continue;
-		if (r == PAM_SUCCESS) {
-			++nsuccess;
-			/*
-			 * For pam_setcred() and pam_chauthtok() with the
-			 * PAM_PRELIM_CHECK flag, treat "sufficient" as
-			 * "optional".
-			 */
-			if ((chain->flag == PAM_SUFFICIENT ||
-			    chain->flag == PAM_BINDING) && !fail &&
-			    primitive != PAM_SM_SETCRED &&
-			    !(primitive == PAM_SM_CHAUTHTOK &&
-				(flags & PAM_PRELIM_CHECK)))
-				break;
-			continue;
-		}
+		if (r == PAM_SUCCESS)
+			rc = success;
+		else if (r >= 0 && r < PAM_NUM_ERRORS)
+			rc = r;
+		else
+			rc = PAM_RC_OTHER;
+		if (r != PAM_SUCCESS && r != PAM_IGNORE)
+			openpam_check_error_code(primitive, r);
+		act = chain->action[rc];
 
-		openpam_check_error_code(primitive, r);
+		/* skip ahead, but not past the end of the chain */
+		for (n = chain->skip[rc];
+		     n > 0 && !OPENPAM_CHAIN_END(chain + 1); --n)
+			++chain;
 
 		/*
 		 * Record the return code from the first module to
 		 * fail.  If a required module fails, record the
 		 * return code from the first required module to fail.
-		 */
-		if (err == PAM_SUCCESS)
-			err = r;
-		if ((chain->flag == PAM_REQUIRED ||
-		    chain->flag == PAM_BINDING) && !fail) {
-			openpam_log(PAM_LOG_LIBDEBUG, "required module failed");
-			fail = 1;
-			err = r;
-		}
-
-		/*
 		 * If a requisite module fails, terminate the chain
-		 * immediately.
+		 * immediately.  A module can only be made to fail the
+		 * chain with PAM_SUCCESS or PAM_IGNORE by a Linux-PAM
+		 * style control, in which case the chain fails with
+		 * PAM_PERM_DENIED, as it would there.
 		 */
-		if (chain->flag == PAM_REQUISITE) {
+		switch (act) {
+		case PAM_ACT_CONTINUE:
+			continue;
+		case PAM_ACT_SUCCEED:
+			++nsuccess;
+			continue;
+		case PAM_ACT_BREAK:
+			++nsuccess;
+			if (fail)
+				continue;
+			break;
+		case PAM_ACT_DONE:
+			if (r == PAM_SUCCESS)
+				++nsuccess;
+			break;
+		case PAM_ACT_RECORD:
+			if (err == PAM_SUCCESS)
+				err = r;
+			continue;
+		case PAM_ACT_FAIL:
+			if (r == PAM_SUCCESS || r == PAM_IGNORE)
+				r = PAM_PERM_DENIED;
+			if (err == PAM_SUCCESS)
+				err = r;
+			if (!fail) {
+				openpam_log(PAM_LOG_LIBDEBUG,
+				    "required module failed");
+				fail = 1;
+				err = r;
+			}
+			continue;
+		case PAM_ACT_TERMINATE:
+			if (r == PAM_SUCCESS || r == PAM_IGNORE)
+				r = PAM_PERM_DENIED;
+			if (err == PAM_SUCCESS)
+				err = r;
 			openpam_log(PAM_LOG_LIBDEBUG, "requisite module failed");
 			fail = 1;
 			break;
+		case PAM_ACT_RESET:
+			err = PAM_SUCCESS;
+			fail = nsuccess = 0;
+			continue;
 		}
+		break;
 	}
 
 	if (!fail && err != PAM_NEW_AUTHTOK_REQD)
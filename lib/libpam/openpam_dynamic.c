@@ -40,13 +40,17 @@
 #endif
 
 #include <sys/param.h>
+#include <sys/stat.h>
 
 #include <dlfcn.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <security/pam_appl.h>
@@ -55,11 +59,267 @@
 #include "openpam_asprintf.h"
 #include "openpam_ctype.h"
 #include "openpam_dlfunc.h"
+#include "openpam_strlcpy.h"
 
 #ifndef RTLD_NOW
 #define RTLD_NOW RTLD_LAZY
 #endif
 
+/*
+ * Registry of loaded modules, keyed by path.  A module is loaded once no
+ * matter how many chain entries or handles refer to it, and unloaded
+ * when the last reference is released, unless OPENPAM_RESIDENT_MODULES
+ * is in effect or the module has been pinned.
+ */
+typedef struct pam_module_ref pam_module_ref_t;
+struct pam_module_ref {
+	pam_module_t	*module;
+	unsigned int	 refcount;
+	int		 pinned;
+	pam_module_ref_t *next;
+};
+
+static pthread_mutex_t openpam_modules_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pam_module_ref_t *openpam_modules;
+
+/*
+ * Cache of the results of searching the module path for bare module
+ * names, including names which were not found anywhere.  The cache is
+ * flushed whenever one of the directories on the module path changes.
+ * As with any cache which relies on modification times, results are
+ * only recorded if none of the directories changed in the second or so
+ * before we looked at them.
+ */
+#define OPENPAM_MODNAME_BUCKETS	64
+
+typedef struct pam_modname pam_modname_t;
+struct pam_modname {
+	char		*name;
+	char		*path;		/* NULL if not found */
+	pam_modname_t	*next;
+};
+
+static pthread_mutex_t openpam_modname_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pam_modname_t *openpam_modnames[OPENPAM_MODNAME_BUCKETS];
+static pam_file_stamp_t *openpam_modname_dirs;
+static int openpam_modname_ndirs;
+static unsigned int openpam_modname_gen;
+
+static unsigned int
+openpam_modname_hash(const char *name)
+{
+	unsigned int hash;
+
+	for (hash = 2166136261U; *name != '\0'; ++name)
+		hash = (hash ^ (unsigned char)*name) * 16777619U;
+	return (hash % OPENPAM_MODNAME_BUCKETS);
+}
+
+/*
+ * Forget all cached search results.  Must be called with the lock held.
+ */
+static void
+openpam_modname_flush(void)
+{
+	pam_modname_t *mn;
+	int i;
+
+	for (i = 0; i < OPENPAM_MODNAME_BUCKETS; ++i) {
+		while ((mn = openpam_modnames[i]) != NULL) {
+			openpam_modnames[i] = mn->next;
+			FREE(mn->name);
+			FREE(mn->path);
+			FREE(mn);
+		}
+	}
+	while (openpam_modname_ndirs > 0) {
+		--openpam_modname_ndirs;
+		FREE(openpam_modname_dirs[openpam_modname_ndirs].path);
+	}
+	FREE(openpam_modname_dirs);
+	++openpam_modname_gen;
+}
+
+/*
+ * Check that the directories on the module path are in the state they
+ * were in when the cache was populated, and if they are not, flush the
+ * cache and take note of their current state.  Must be called with the
+ * lock held.  Returns non-zero if the cache can be used.
+ */
+static int
+openpam_modname_check(void)
+{
+	pam_file_stamp_t *dirs, *was, now;
+	struct stat sb;
+	time_t when;
+	int i, n, settled;
+
+	for (n = 0; openpam_module_path[n] != NULL; ++n)
+		/* nothing */ ;
+	for (i = 0; i < n && i < openpam_modname_ndirs; ++i) {
+		was = &openpam_modname_dirs[i];
+		if (strcmp(was->path, openpam_module_path[i]) != 0)
+			break;
+		memset(&now, 0, sizeof now);
+		if (stat(was->path, &sb) == 0) {
+			now.found = 1;
+			openpam_stamp_set(&now, &sb);
+		}
+		if (now.found != was->found ||
+		    now.dev != was->dev ||
+		    now.ino != was->ino ||
+		    now.mtime.tv_sec != was->mtime.tv_sec ||
+		    now.mtime.tv_nsec != was->mtime.tv_nsec)
+			break;
+	}
+	if (i == n && n == openpam_modname_ndirs)
+		return (1);
+
+	/* something changed, start over */
+	openpam_modname_flush();
+	if ((dirs = openpam_calloc(n, sizeof *dirs)) == NULL)
+		return (0);
+	when = time(NULL);
+	settled = 1;
+	for (i = 0; i < n; ++i) {
+		dirs[i].path = openpam_strdup(openpam_module_path[i]);
+		if (dirs[i].path == NULL)
+			break;
+		if (stat(openpam_module_path[i], &sb) == 0) {
+			dirs[i].found = 1;
+			openpam_stamp_set(&dirs[i], &sb);
+			if (dirs[i].mtime.tv_sec + 1 >= when)
+				settled = 0;
+		}
+	}
+	openpam_modname_dirs = dirs;
+	openpam_modname_ndirs = i;
+	if (i < n || !settled) {
+		/* try again next time */
+		openpam_modname_flush();
+		return (0);
+	}
+	return (1);
+}
+
+/*
+ * Look up a module name in the cache.  Returns -1 if it is not there,
+ * 0 if it is known not to exist, and 1 if it was found, in which case the
+ * path is copied into the provided buffer.  In all cases, the current
+ * generation of the cache is returned, or 0 if it cannot be used.
+ */
+static int
+openpam_modname_get(const char *modname, char *modpath, size_t size,
+	unsigned int *gen)
+{
+	pam_modname_t *mn;
+	int ret;
+
+	ret = -1;
+	pthread_mutex_lock(&openpam_modname_mtx);
+	if (!openpam_modname_check()) {
+		pthread_mutex_unlock(&openpam_modname_mtx);
+		*gen = 0;
+		return (-1);
+	}
+	*gen = openpam_modname_gen;
+	for (mn = openpam_modnames[openpam_modname_hash(modname)];
+	     mn != NULL; mn = mn->next) {
+		if (strcmp(mn->name, modname) == 0) {
+			if (mn->path == NULL)
+				ret = 0;
+			else if (strlcpy(modpath, mn->path, size) < size)
+				ret = 1;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&openpam_modname_mtx);
+	return (ret);
+}
+
+/*
+ * Record the result of a search, unless the cache has been flushed since
+ * we started.
+ */
+static void
+openpam_modname_put(const char *modname, const char *modpath,
+	unsigned int gen)
+{
+	pam_modname_t *mn, **bucket;
+	char *path;
+
+	path = NULL;
+	if (modpath != NULL && (path = openpam_strdup(modpath)) == NULL)
+		return;
+	pthread_mutex_lock(&openpam_modname_mtx);
+	if (gen == 0 || gen != openpam_modname_gen)
+		goto done;
+	bucket = &openpam_modnames[openpam_modname_hash(modname)];
+	for (mn = *bucket; mn != NULL; mn = mn->next)
+		if (strcmp(mn->name, modname) == 0)
+			break;
+	if (mn == NULL) {
+		if ((mn = openpam_calloc(1, sizeof *mn)) == NULL ||
+		    (mn->name = openpam_strdup(modname)) == NULL) {
+			FREE(mn);
+			goto done;
+		}
+		mn->next = *bucket;
+		*bucket = mn;
+	}
+	FREE(mn->path);
+	mn->path = path;
+	path = NULL;
+done:
+	pthread_mutex_unlock(&openpam_modname_mtx);
+	FREE(path);
+}
+
+/*
+ * Look up a module by path and, if found, add a reference to it.  Must
+ * be called with the lock held.
+ */
+static pam_module_t *
+openpam_registry_get(const char *modpath)
+{
+	pam_module_ref_t *ref;
+
+	for (ref = openpam_modules; ref != NULL; ref = ref->next) {
+		if (strcmp(ref->module->path, modpath) == 0) {
+			++ref->refcount;
+			return (ref->module);
+		}
+	}
+	return (NULL);
+}
+
+/*
+ * Look up a module.  Must be called with the lock held.
+ */
+static pam_module_ref_t *
+openpam_registry_find(const pam_module_t *module)
+{
+	pam_module_ref_t *ref;
+
+	for (ref = openpam_modules; ref != NULL; ref = ref->next)
+		if (ref->module == module)
+			return (ref);
+	return (NULL);
+}
+
+/*
+ * Unload a module and free the structure that describes it.
+ */
+static void
+openpam_unload(pam_module_t *module)
+{
+
+	openpam_log(PAM_LOG_DEBUG, "releasing %s", module->path);
+	dlclose(module->dlh);
+	FREE(module->path);
+	FREE(module);
+}
+
 /*
  * OpenPAM internal
  *
@@ -97,16 +357,26 @@ try_dlopen(const char *modfn)
 static void *
 try_dlopen(const char *modfn)
 {
+	char realfn[PATH_MAX];
+	struct stat sb;
 	int check_module_file;
 	void *dlh;
 
 	openpam_log(PAM_LOG_LIBDEBUG, "dlopen(%s)", modfn);
 	openpam_get_feature(OPENPAM_VERIFY_MODULE_FILE,
 	    &check_module_file);
-	if (check_module_file &&
-	    openpam_check_path_owner_perms(modfn) != 0)
+	if (check_module_file) {
+		/* load what was checked rather than following links again */
+		if (openpam_check_path_owner_perms(modfn, realfn) != 0)
+			return (NULL);
+	} else if (stat(modfn, &sb) != 0) {
+		if (errno != ENOENT)
+			openpam_log(PAM_LOG_ERROR, "%s: %m", modfn);
 		return (NULL);
-	if ((dlh = dlopen(modfn, RTLD_NOW)) == NULL) {
+	} else {
+		strlcpy(realfn, modfn, sizeof realfn);
+	}
+	if ((dlh = dlopen(realfn, RTLD_NOW)) == NULL) {
 		openpam_log(PAM_LOG_ERROR, "%s: %s", modfn, dlerror());
 		errno = 0;
 		return (NULL);
@@ -122,11 +392,21 @@ static pam_module_t *
 try_module(const char *modpath)
 {
 	const pam_module_t *dlmodule;
-	pam_module_t *module;
+	pam_module_t *module, *other;
+	pam_module_ref_t *ref;
 	int i, serrno;
 
-	if ((module = calloc(1, sizeof *module)) == NULL ||
-	    (module->path = strdup(modpath)) == NULL ||
+	/* already loaded? */
+	pthread_mutex_lock(&openpam_modules_mtx);
+	module = openpam_registry_get(modpath);
+	pthread_mutex_unlock(&openpam_modules_mtx);
+	if (module != NULL) {
+		openpam_log(PAM_LOG_LIBDEBUG, "reusing %s", modpath);
+		return (module);
+	}
+
+	if ((module = openpam_calloc(1, sizeof *module)) == NULL ||
+	    (module->path = openpam_strdup(modpath)) == NULL ||
 	    (module->dlh = try_dlopen(modpath)) == NULL)
 		goto err;
 	dlmodule = dlsym(module->dlh, "_pam_module");
@@ -152,6 +432,23 @@ try_module(const char *modpath)
 #endif
 		}
 	}
+
+	/* register it, unless someone beat us to it */
+	if ((ref = openpam_calloc(1, sizeof *ref)) == NULL)
+		goto err;
+	pthread_mutex_lock(&openpam_modules_mtx);
+	if ((other = openpam_registry_get(modpath)) == NULL) {
+		ref->module = module;
+		ref->refcount = 1;
+		ref->next = openpam_modules;
+		openpam_modules = ref;
+	}
+	pthread_mutex_unlock(&openpam_modules_mtx);
+	if (other != NULL) {
+		FREE(ref);
+		openpam_unload(module);
+		module = other;
+	}
 	return (module);
 err:
 	serrno = errno;
@@ -181,8 +478,9 @@ openpam_dynamic(const char *modname)
 	pam_module_t *module;
 	char modpath[PATH_MAX];
 	const char **path, *p;
+	unsigned int gen;
 	int has_so, has_ver;
-	int dot, len;
+	int cached, dot, len, notfound;
 
 	/*
 	 * Simple case: module name contains path separator(s)
@@ -220,9 +518,28 @@ openpam_dynamic(const char *modname)
 		has_so = 1;
 	}
 
+	/*
+	 * Perhaps we already know where it is, or that it isn't anywhere.
+	 */
+	cached = openpam_modname_get(modname, modpath, sizeof modpath, &gen);
+	if (cached == 0) {
+		openpam_log(PAM_LOG_LIBDEBUG, "%s: known missing", modname);
+		errno = ENOENT;
+		return (NULL);
+	}
+	if (cached == 1) {
+		openpam_log(PAM_LOG_LIBDEBUG, "%s: known as %s",
+		    modname, modpath);
+		if ((module = try_module(modpath)) != NULL)
+			return (module);
+	}
+
 	/*
 	 * Complicated case: search for the module in the usual places.
+	 * Only remember the outcome if every attempt failed because
+	 * there was nothing there.
 	 */
+	notfound = 1;
 	for (path = openpam_module_path; *path != NULL; ++path) {
 		/*
 		 * Assemble the full path, including the version suffix.  Take
@@ -244,17 +561,87 @@ openpam_dynamic(const char *modname)
 		}
 		/* try the versioned path */
 		if ((module = try_module(modpath)) != NULL)
-			return (module);
+			goto found;
 		if (errno == ENOENT && modpath[dot] != '\0') {
 			/* no luck, try the unversioned path */
 			modpath[dot] = '\0';
 			if ((module = try_module(modpath)) != NULL)
-				return (module);
+				goto found;
 		}
+		if (errno != ENOENT)
+			notfound = 0;
 	}
 
 	/* :( */
+	if (notfound)
+		openpam_modname_put(modname, NULL, gen);
 	return (NULL);
+found:
+	openpam_modname_put(modname, modpath, gen);
+	return (module);
+}
+
+/*
+ * OpenPAM internal
+ *
+ * Add a reference to a dynamically linked module
+ */
+
+void
+openpam_dynamic_retain(pam_module_t *module)
+{
+	pam_module_ref_t *ref;
+
+	pthread_mutex_lock(&openpam_modules_mtx);
+	if ((ref = openpam_registry_find(module)) != NULL)
+		++ref->refcount;
+	pthread_mutex_unlock(&openpam_modules_mtx);
+}
+
+/*
+ * OpenPAM internal
+ *
+ * Keep a dynamically linked module loaded even after its last reference
+ * has been released.
+ */
+
+void
+openpam_dynamic_pin(pam_module_t *module)
+{
+	pam_module_ref_t *ref;
+
+	pthread_mutex_lock(&openpam_modules_mtx);
+	if ((ref = openpam_registry_find(module)) != NULL)
+		ref->pinned = 1;
+	pthread_mutex_unlock(&openpam_modules_mtx);
+}
+
+/*
+ * OpenPAM internal
+ *
+ * Release a reference to a dynamically linked module, and unload it if
+ * it is no longer needed.
+ */
+
+void
+openpam_dynamic_release(pam_module_t *module)
+{
+	pam_module_ref_t *ref, **prev;
+
+	pthread_mutex_lock(&openpam_modules_mtx);
+	for (prev = &openpam_modules; (ref = *prev) != NULL;
+	     prev = &ref->next)
+		if (ref->module == module)
+			break;
+	if (ref == NULL || --ref->refcount > 0 || ref->pinned ||
+	    OPENPAM_FEATURE(RESIDENT_MODULES)) {
+		pthread_mutex_unlock(&openpam_modules_mtx);
+		return;
+	}
+	*prev = ref->next;
+	pthread_mutex_unlock(&openpam_modules_mtx);
+	FREE(ref);
+	openpam_unload(module);
 }
 
 /*
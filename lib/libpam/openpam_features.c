@@ -70,4 +70,39 @@ struct openpam_feature openpam_features[OPENPAM_NUM_FEATURES] = {
 	    "Fall back to \"other\" policy for empty chains",
 	    1
 	),
+	STRUCT_OPENPAM_FEATURE(
+	    CACHE_POLICY,
+	    "Cache parsed policies across transactions",
+	    0
+	),
+	STRUCT_OPENPAM_FEATURE(
+	    RESIDENT_MODULES,
+	    "Keep modules loaded after their last user is gone",
+	    0
+	),
+	STRUCT_OPENPAM_FEATURE(
+	    POLICY_IMAGE,
+	    "Load policies from a compiled policy image",
+	    0
+	),
+	STRUCT_OPENPAM_FEATURE(
+	    CACHE_POLICY_PATH,
+	    "Cache policy search path lookups",
+	    0
+	),
+	STRUCT_OPENPAM_FEATURE(
+	    LAZY_MODULES,
+	    "Load modules when they are first needed",
+	    0
+	),
+	STRUCT_OPENPAM_FEATURE(
+	    PREFER_EMBEDDED,
+	    "Prefer embedded policies to policy files",
+	    1
+	),
+	STRUCT_OPENPAM_FEATURE(
+	    MODULE_STATS,
+	    "Collect per-module dispatch statistics",
+	    1
+	),
 };
@@ -61,7 +61,7 @@ openpam_free_data(pam_handle_t *pamh,
 	ENTER();
 	(void)pamh;
 	(void)status;
-	FREE(data);
+	free(data);
 	RETURNV();
 }
 
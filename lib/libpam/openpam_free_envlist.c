@@ -52,8 +52,8 @@ openpam_free_envlist(char **envlist)
 	if (envlist == NULL)
 		RETURNV();
 	for (env = envlist; *env != NULL; ++env)
-		FREE(*env);
-	FREE(envlist);
+		free(*env);
+	free(envlist);
 	RETURNV();
 }
 
@@ -91,6 +91,71 @@ openpam_get_feature(int feature, int *onoff)
  *		module and the path leading up to it.
  *		This feature is enabled by default.
  *
+ *	=OPENPAM_FALLBACK_TO_OTHER:
+ *		Fall back to the "other" policy for facilities which have
+ *		no entries in the service's own policy.
+ *		This feature is enabled by default.
+ *
+ *	=OPENPAM_CACHE_POLICY:
+ *		Keep parsed policies and the modules they reference in a
+ *		process-wide cache, keyed by service name, so that
+ *		subsequent transactions for the same service need not
+ *		parse the policy again.
+ *		A cached policy is discarded as soon as any of the files
+ *		it was read from, or any of the locations which were
+ *		searched before it was found, changes.
+ *		This feature is disabled by default.
+ *
+ *	=OPENPAM_RESIDENT_MODULES:
+ *		Keep modules loaded once the last policy which references
+ *		them has been released, so that subsequent transactions do
+ *		not have to load them again.
+ *		This feature is disabled by default.
+ *
+ *	=OPENPAM_POLICY_IMAGE:
+ *		Look up policies in the compiled policy image produced by
+ *		=openpam_dump_policy before parsing the policy files.
+ *		A service is only taken from the image if none of the
+ *		files it was compiled from have changed since; otherwise,
+ *		or if the image is missing, the policy files are parsed as
+ *		usual.
+ *		This feature is disabled by default.
+ *
+ *	=OPENPAM_CACHE_POLICY_PATH:
+ *		Keep the directories on the policy search path open, and
+ *		remember which policy files were not found in them, so
+ *		that searching for a service does not have to look up
+ *		the same paths over and over.
+ *		What is remembered about a directory is discarded when
+ *		its modification time changes.
+ *		This feature is disabled by default.
+ *
+ *	=OPENPAM_LAZY_MODULES:
+ *		Do not load the modules a policy refers to until they are
+ *		first called upon, so that a transaction which only
+ *		authenticates the user never loads the session and
+ *		password modules.
+ *		A module which cannot be loaded causes the primitive which
+ *		needed it to fail, instead of =pam_start.
+ *		Use =openpam_check_modules to detect such errors up front.
+ *		This feature is disabled by default.
+ *
+ *	=OPENPAM_PREFER_EMBEDDED:
+ *		If the library was built with policies compiled into it,
+ *		use the compiled-in policy for a service rather than
+ *		searching for a policy file.
+ *		If this feature is disabled, a compiled-in policy is only
+ *		used if no policy file for the service is found.
+ *		This feature has no effect on libraries built without
+ *		compiled-in policies.
+ *		This feature is enabled by default.
+ *
+ *	=OPENPAM_MODULE_STATS:
+ *		Count the calls made to each module, the codes they
+ *		return and how long they take, for retrieval with
+ *		=openpam_get_stats.
+ *		This feature is enabled by default.
+ *
  *
  * >openpam_set_feature
  *
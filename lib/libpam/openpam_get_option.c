@@ -57,21 +57,26 @@ const char *
 openpam_get_option(pam_handle_t *pamh,
 	const char *option)
 {
-	pam_chain_t *cur;
+	pam_optidx_t *idx;
+	char **optv;
 	size_t len;
-	int i;
+	int i, optc;
 
 	ENTERS(option);
 	if (pamh == NULL || pamh->current == NULL || option == NULL)
 		RETURNS(NULL);
-	cur = pamh->current;
+	/* the index only knows names, which cannot contain '=' */
+	if ((idx = openpam_chain_optidx(pamh, pamh->current)) != NULL &&
+	    strchr(option, '=') == NULL)
+		RETURNS(openpam_optidx_find(idx, option));
+	optv = openpam_chain_optv(pamh, pamh->current, &optc);
 	len = strlen(option);
-	for (i = 0; i < cur->optc; ++i) {
-		if (strncmp(cur->optv[i], option, len) == 0) {
-			if (cur->optv[i][len] == '\0')
-				RETURNS(&cur->optv[i][len]);
-			else if (cur->optv[i][len] == '=')
-				RETURNS(&cur->optv[i][len + 1]);
+	for (i = 0; i < optc; ++i) {
+		if (strncmp(optv[i], option, len) == 0) {
+			if (optv[i][len] == '\0')
+				RETURNS(&optv[i][len]);
+			else if (optv[i][len] == '=')
+				RETURNS(&optv[i][len + 1]);
 		}
 	}
 	RETURNS(NULL);
@@ -0,0 +1,119 @@
+/*-
+ * Copyright (c) 2026 Dag-Erling Smørgrav
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote
+ *    products derived from this software without specific prior written
+ *    permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $OpenPAM$
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <security/pam_appl.h>
+
+#include "openpam_impl.h"
+
+/*
+ * OpenPAM extension
+ *
+ * Retrieve per-module dispatch statistics
+ */
+
+int
+openpam_get_stats(struct openpam_stats **stats, size_t *nstats)
+{
+
+	ENTER();
+	RETURNC(openpam_stats_export(stats, nstats));
+}
+
+/*
+ * Error codes:
+ *
+ *	PAM_BUF_ERR
+ */
+
+/**
+ * EXPERIMENTAL
+ *
+ * The =openpam_get_stats function retrieves the statistics the library
+ * keeps on each module it calls, provided the =OPENPAM_MODULE_STATS
+ * feature is enabled, which it is by default.
+ *
+ * A separate record is kept for each combination of service, facility,
+ * module and primitive which has been called at least once since the
+ * library was loaded.
+ * Each record is described by a structure which has the following
+ * members:
+ *
+ *	service:
+ *		The name of the service whose policy the module was
+ *		called from.
+ *	facility:
+ *		The name of the facility ("auth", "account", "session" or
+ *		"password").
+ *	module:
+ *		The path to the module, or its name if it is a static
+ *		module.
+ *	primitive:
+ *		The service function which was called, e.g.
+ *		=PAM_SM_AUTHENTICATE.
+ *	calls:
+ *		The number of calls.
+ *	result:
+ *		The number of calls which returned each PAM error code,
+ *		indexed by error code.
+ *		The last element, at index =PAM_NUM_ERRORS, counts calls
+ *		which returned a value which is not a valid error code.
+ *	latency:
+ *		A histogram of the time each call took, as measured by
+ *		the monotonic clock.
+ *		The first element counts calls which took less than a
+ *		microsecond; element n counts calls which took at least
+ *		2^(n-1) but less than 2^n microseconds, except the last,
+ *		which counts all calls which took longer still.
+ *	nsec:
+ *		The total time spent in the module, in nanoseconds.
+ *
+ * The counters are updated without locking, so a snapshot taken while
+ * other threads are calling modules may be slightly inconsistent, e.g.
+ * the sum of the :result array may differ from :calls by the number of
+ * calls in progress.
+ *
+ * If successful, =openpam_get_stats sets the variable =stats points to
+ * to an array of records, and the variable =nstats points to to the
+ * number of records in that array.
+ * The array is allocated in a single block which the caller must free
+ * with =free.
+ * If no statistics have been recorded yet, =stats is set to =NULL and
+ * =nstats to zero.
+ *
+ * >openpam_reset_stats
+ * >openpam_set_feature
+ *
+ * AUTHOR DES
+ */
@@ -0,0 +1,187 @@
+/*-
+ * Copyright (c) 2026 Dag-Erling Smørgrav
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote
+ *    products derived from this software without specific prior written
+ *    permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $OpenPAM$
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <errno.h>
+#include <fnmatch.h>
+#include <string.h>
+
+#include <security/pam_appl.h>
+
+#include "openpam_impl.h"
+
+/*
+ * Items which may be used in guards.  These are the ones which describe
+ * who is asking and from where; authentication tokens are deliberately
+ * not among them.
+ */
+static const struct {
+	const char	*name;
+	int		 item;
+} openpam_guard_items[] = {
+	{ "service",	PAM_SERVICE },
+	{ "user",	PAM_USER },
+	{ "tty",	PAM_TTY },
+	{ "rhost",	PAM_RHOST },
+	{ "ruser",	PAM_RUSER },
+	{ NULL,		0 }
+};
+
+/*
+ * Parse a single guard, e.g. "?user!=root", and sort its pattern into
+ * one of the kinds which can be matched without fnmatch(3).  Returns 0
+ * on success and -1 if the guard is invalid.
+ */
+static int
+openpam_guard_parse(pam_guard_t *guard, const char *str)
+{
+	const char *op, *p, *star;
+	size_t len;
+	int glob, i, nstar;
+
+	if (*str++ != '?' || (op = strchr(str, '=')) == NULL)
+		return (-1);
+	guard->negate = op > str && op[-1] == '!';
+	len = (size_t)(op - str) - guard->negate;
+	for (i = 0; openpam_guard_items[i].name != NULL; ++i)
+		if (strlen(openpam_guard_items[i].name) == len &&
+		    memcmp(openpam_guard_items[i].name, str, len) == 0)
+			break;
+	if (openpam_guard_items[i].name == NULL)
+		return (-1);
+	guard->item = openpam_guard_items[i].item;
+	guard->pattern = ++op;
+	guard->len = strlen(op);
+	/* count the stars; anything fancier needs fnmatch(3) */
+	for (glob = nstar = 0, star = NULL, p = op; *p != '\0'; ++p) {
+		if (*p == '*') {
+			++nstar;
+			star = p;
+		} else if (*p == '?' || *p == '[' || *p == '\\') {
+			glob = 1;
+		}
+	}
+	if (glob || nstar > 1) {
+		guard->kind = PAM_GUARD_GLOB;
+	} else if (nstar == 0) {
+		guard->kind = PAM_GUARD_EXACT;
+	} else if (star == op + guard->len - 1) {
+		guard->kind = PAM_GUARD_PREFIX;
+		guard->len--;
+	} else if (star == op) {
+		guard->kind = PAM_GUARD_SUFFIX;
+		guard->pattern++;
+		guard->len--;
+	} else {
+		guard->kind = PAM_GUARD_GLOB;
+	}
+	return (0);
+}
+
+/*
+ * OpenPAM internal
+ *
+ * Compile the given guards.  The result points into the vector it was
+ * built from.  Returns NULL and sets errno to EINVAL if one of them is
+ * invalid, or to ENOMEM if memory is short.
+ */
+
+pam_guardset_t *
+openpam_guards(int guardc, char **guardv)
+{
+	pam_guardset_t *gs;
+	int i;
+
+	gs = openpam_malloc(sizeof *gs + guardc * sizeof *gs->guardv);
+	if (gs == NULL)
+		return (NULL);
+	gs->guardc = guardc;
+	for (i = 0; i < guardc; ++i) {
+		if (openpam_guard_parse(&gs->guardv[i], guardv[i]) != 0) {
+			openpam_log(PAM_LOG_ERROR, "invalid guard: %s",
+			    guardv[i]);
+			openpam_free(gs);
+			errno = EINVAL;
+			return (NULL);
+		}
+	}
+	return (gs);
+}
+
+/*
+ * OpenPAM internal
+ *
+ * Check whether the items of a PAM context satisfy a set of guards.  An
+ * item which is not set is treated as an empty string.
+ */
+
+int
+openpam_guards_match(pam_handle_t *pamh, const pam_guardset_t *gs)
+{
+	const pam_guard_t *guard;
+	const char *value;
+	size_t len;
+	int i, match;
+
+	for (i = 0; i < gs->guardc; ++i) {
+		guard = &gs->guardv[i];
+		if ((value = pamh->item[guard->item]) == NULL)
+			value = "";
+		switch (guard->kind) {
+		case PAM_GUARD_EXACT:
+			match = strcmp(value, guard->pattern) == 0;
+			break;
+		case PAM_GUARD_PREFIX:
+			match = strncmp(value, guard->pattern,
+			    guard->len) == 0;
+			break;
+		case PAM_GUARD_SUFFIX:
+			len = strlen(value);
+			match = len >= guard->len &&
+			    memcmp(value + len - guard->len, guard->pattern,
+			    guard->len) == 0;
+			break;
+		default:
+			match = fnmatch(guard->pattern, value, 0) == 0;
+			break;
+		}
+		if (match == guard->negate)
+			return (0);
+	}
+	return (1);
+}
+
+/*
+ * NOPARSE
+ */
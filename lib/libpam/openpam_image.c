@@ -0,0 +1,419 @@
+/*-
+ * Copyright (c) 2026 Dag-Erling Smørgrav
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote
+ *    products derived from this software without specific prior written
+ *    permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $OpenPAM$
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <security/pam_appl.h>
+
+#include "openpam_impl.h"
+#include "openpam_image.h"
+
+/*
+ * A mapped policy image.  Handles whose chains were built from an image
+ * point straight into it, so each of them holds a reference, as does
+ * openpam_image_current for as long as the image is current.
+ */
+struct pam_policy_image {
+	void		*base;		/* NULL if missing or unusable */
+	size_t		 size;
+	pam_file_stamp_t stamp;		/* the image file itself */
+	unsigned int	 refcount;
+};
+
+static pthread_mutex_t openpam_image_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pam_policy_image_t *openpam_image_current;
+
+/*
+ * Drop a reference to an image, and unmap it if it was the last.
+ */
+static void
+openpam_image_unref(pam_policy_image_t *image)
+{
+	unsigned int refcount;
+
+	pthread_mutex_lock(&openpam_image_mtx);
+	refcount = --image->refcount;
+	pthread_mutex_unlock(&openpam_image_mtx);
+	if (refcount > 0)
+		return;
+	if (image->base != NULL)
+		munmap(image->base, image->size);
+	FREE(image->stamp.path);
+	FREE(image);
+}
+
+/*
+ * Map the image file.  Returns NULL only if memory allocation fails; if
+ * the file is missing or unusable, returns an image with no contents,
+ * which will be retried once the file changes.
+ */
+static pam_policy_image_t *
+openpam_image_map(const char *path)
+{
+	const struct openpam_image_header *hdr;
+	pam_policy_image_t *image;
+	struct stat sb;
+	void *base;
+	int fd;
+
+	if ((image = openpam_calloc(1, sizeof *image)) == NULL ||
+	    (image->stamp.path = openpam_strdup(path)) == NULL) {
+		openpam_log(PAM_LOG_ERROR, "malloc(): %m");
+		FREE(image);
+		return (NULL);
+	}
+	if ((fd = open(path, O_RDONLY)) < 0) {
+		openpam_log(errno == ENOENT ? PAM_LOG_DEBUG : PAM_LOG_ERROR,
+		    "%s: %m", path);
+		return (image);
+	}
+	if (fstat(fd, &sb) != 0) {
+		openpam_log(PAM_LOG_ERROR, "%s: %m", path);
+		close(fd);
+		return (image);
+	}
+	image->stamp.found = 1;
+	openpam_stamp_set(&image->stamp, &sb);
+	if (OPENPAM_FEATURE(VERIFY_POLICY_FILE) &&
+	    openpam_check_stat_owner_perms(path, &sb) != 0) {
+		/* already logged the cause */
+		close(fd);
+		return (image);
+	}
+	if (sb.st_size < (off_t)sizeof *hdr || sb.st_size > UINT32_MAX) {
+		openpam_log(PAM_LOG_ERROR, "%s: invalid policy image", path);
+		close(fd);
+		return (image);
+	}
+	base = mmap(NULL, (size_t)sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED) {
+		openpam_log(PAM_LOG_ERROR, "%s: %m", path);
+		return (image);
+	}
+	hdr = base;
+	if (memcmp(hdr->magic, OPENPAM_IMAGE_MAGIC, sizeof hdr->magic) != 0 ||
+	    hdr->version != OPENPAM_IMAGE_VERSION ||
+	    hdr->size != (uint32_t)sb.st_size) {
+		openpam_log(PAM_LOG_ERROR, "%s: invalid policy image", path);
+		munmap(base, (size_t)sb.st_size);
+		return (image);
+	}
+	openpam_log(PAM_LOG_DEBUG, "mapped %s", path);
+	image->base = base;
+	image->size = (size_t)sb.st_size;
+	return (image);
+}
+
+/*
+ * Bounds-checked access to the contents of an image.
+ */
+static const void *
+openpam_image_ptr(const pam_policy_image_t *image, uint32_t off,
+	uint32_t n, size_t size)
+{
+
+	if (off == 0 || off % OPENPAM_IMAGE_ALIGN != 0 || off > image->size)
+		return (NULL);
+	if (size > 0 && n > (image->size - off) / size)
+		return (NULL);
+	return ((const char *)image->base + off);
+}
+
+static const char *
+openpam_image_str(const pam_policy_image_t *image, uint32_t off)
+{
+	const char *str;
+
+	if (off == 0 || off >= image->size)
+		return (NULL);
+	str = (const char *)image->base + off;
+	if (memchr(str, '\0', image->size - off) == NULL)
+		return (NULL);
+	return (str);
+}
+
+/*
+ * Build the handle's chains from the image.  Returns 1 on success and 0
+ * if the service is not in the image, its sources have changed, or the
+ * image is corrupt, in which case the handle is left untouched.
+ */
+static int
+openpam_image_load(pam_handle_t *pamh, const pam_policy_image_t *image,
+	const char *service)
+{
+	const struct openpam_image_header *hdr;
+	const struct openpam_image_service *svc;
+	const struct openpam_image_stamp *stamps, *st;
+	const struct openpam_image_entry *entry;
+	const uint32_t *buckets, *idxv, *optv;
+	const char *name, *modpath;
+	pam_file_stamp_t stamp;
+	pam_chain_t ent, *this;
+	uint32_t h, i, n, off;
+	int fclt;
+
+	hdr = image->base;
+	if (hdr->features != (uint32_t)openpam_cache_features()) {
+		openpam_log(PAM_LOG_DEBUG,
+		    "policy image was built with different features");
+		return (0);
+	}
+	if (hdr->nbuckets == 0 || (hdr->nbuckets & (hdr->nbuckets - 1)) ||
+	    (buckets = openpam_image_ptr(image, hdr->buckets,
+	    hdr->nbuckets, sizeof *buckets)) == NULL)
+		goto corrupt;
+
+	/* look up the service */
+	svc = NULL;
+	h = openpam_image_hash(service);
+	for (n = 0; n < hdr->nbuckets; ++n, ++h) {
+		if ((i = buckets[h & (hdr->nbuckets - 1)]) == 0)
+			break;
+		if (i > hdr->nservices ||
+		    (svc = openpam_image_ptr(image, hdr->services,
+		    i, sizeof *svc)) == NULL)
+			goto corrupt;
+		svc += i - 1;
+		if ((name = openpam_image_str(image, svc->name)) == NULL)
+			goto corrupt;
+		if (strcmp(name, service) == 0)
+			break;
+		svc = NULL;
+	}
+	if (svc == NULL) {
+		openpam_log(PAM_LOG_DEBUG, "no compiled %s policy", service);
+		return (0);
+	}
+
+	/* check that the sources have not changed */
+	if (svc->nstamps > 0 &&
+	    ((idxv = openpam_image_ptr(image, svc->stamps,
+	    svc->nstamps, sizeof *idxv)) == NULL ||
+	    (stamps = openpam_image_ptr(image, hdr->stamps,
+	    hdr->nstamps, sizeof *stamps)) == NULL))
+		goto corrupt;
+	for (i = 0; i < svc->nstamps; ++i) {
+		if (idxv[i] >= hdr->nstamps)
+			goto corrupt;
+		st = &stamps[idxv[i]];
+		memset(&stamp, 0, sizeof stamp);
+		if ((name = openpam_image_str(image, st->path)) == NULL)
+			goto corrupt;
+		stamp.path = (char *)(uintptr_t)name;
+		stamp.found = st->found;
+		stamp.dev = (dev_t)st->dev;
+		stamp.ino = (ino_t)st->ino;
+		stamp.size = (off_t)st->size;
+		stamp.mtime.tv_sec = (time_t)st->mtime_sec;
+		stamp.mtime.tv_nsec = (long)st->mtime_nsec;
+		stamp.ctime.tv_sec = (time_t)st->ctime_sec;
+		stamp.ctime.tv_nsec = (long)st->ctime_nsec;
+		if (!openpam_stamp_valid(&stamp)) {
+			openpam_log(PAM_LOG_DEBUG,
+			    "compiled %s policy is stale", service);
+			return (0);
+		}
+	}
+
+	/* build the chains */
+	this = NULL;
+	for (fclt = 0; fclt < PAM_NUM_FACILITIES; ++fclt) {
+		for (n = 0, off = svc->chains[fclt]; off != 0;
+		     ++n, off = entry->next) {
+			if (n > image->size / sizeof *entry ||
+			    (entry = openpam_image_ptr(image, off,
+			    1, sizeof *entry)) == NULL ||
+			    entry->flag > PAM_CUSTOM_CONTROL ||
+			    (modpath = openpam_image_str(image,
+			    entry->module)) == NULL)
+				goto corrupt_chains;
+			optv = NULL;
+			if (entry->optc > 0 &&
+			    (optv = openpam_image_ptr(image, entry->optv,
+			    entry->optc, sizeof *optv)) == NULL)
+				goto corrupt_chains;
+			this = &ent;
+			memset(this, 0, sizeof *this);
+			this->flag = (int)entry->flag;
+			if (this->flag == PAM_CUSTOM_CONTROL) {
+				for (i = 0; i < PAM_NUM_RESULTS; ++i)
+					if (entry->action[i] >=
+					    PAM_NUM_ACTIONS)
+						goto corrupt_chains;
+				memcpy(this->action, entry->action,
+				    sizeof this->action);
+				memcpy(this->skip, entry->skip,
+				    sizeof this->skip);
+			}
+			this->optv = openpam_calloc(entry->optc + 1,
+			    sizeof *this->optv);
+			if (this->optv == NULL)
+				goto nomem;
+			/* the options point straight into the image */
+			for (i = 0; i < entry->optc; ++i) {
+				name = openpam_image_str(image, optv[i]);
+				if (name == NULL)
+					goto corrupt_chains;
+				this->optv[i] = (char *)(uintptr_t)name;
+			}
+			this->optc = (int)entry->optc;
+			this->optidx = openpam_optidx(this->optc, this->optv);
+			/* and so do the guards */
+			if (entry->guardc > 0) {
+				if ((optv = openpam_image_ptr(image,
+				    entry->guardv, entry->guardc,
+				    sizeof *optv)) == NULL)
+					goto corrupt_chains;
+				this->guardv = openpam_calloc(
+				    entry->guardc + 1, sizeof *this->guardv);
+				if (this->guardv == NULL)
+					goto nomem;
+				for (i = 0; i < entry->guardc; ++i) {
+					name = openpam_image_str(image,
+					    optv[i]);
+					if (name == NULL)
+						goto corrupt_chains;
+					this->guardv[i] =
+					    (char *)(uintptr_t)name;
+				}
+				this->guardc = (int)entry->guardc;
+				this->guards = openpam_guards(this->guardc,
+				    this->guardv);
+				if (this->guards == NULL && errno == EINVAL)
+					goto corrupt_chains;
+				if (this->guards == NULL)
+					goto nomem;
+			}
+			if (openpam_chain_init(this, modpath) != 0)
+				goto fail;
+			if (openpam_chain_append(&pamh->chains[fclt],
+			    this) != 0)
+				goto fail;
+			this = NULL;
+		}
+	}
+	return (1);
+corrupt:
+	openpam_log(PAM_LOG_ERROR, "%s: corrupt policy image",
+	    image->stamp.path);
+	return (0);
+corrupt_chains:
+	openpam_log(PAM_LOG_ERROR, "%s: corrupt policy image",
+	    image->stamp.path);
+	goto fail;
+nomem:
+	openpam_log(PAM_LOG_ERROR, "malloc(): %m");
+fail:
+	if (this != NULL)
+		openpam_chain_fini(this);
+	openpam_clear_chains(pamh->chains);
+	return (0);
+}
+
+/*
+ * OpenPAM internal
+ *
+ * Look for the given service in the compiled policy image.  If it is
+ * there and none of the files it was compiled from have changed since,
+ * build the handle's chains from it and return 1.  Otherwise, return 0.
+ */
+
+int
+openpam_image_lookup(pam_handle_t *pamh, const char *service)
+{
+	pam_policy_image_t *image, *old;
+
+	ENTERS(service);
+	pthread_mutex_lock(&openpam_image_mtx);
+	if ((image = openpam_image_current) != NULL)
+		++image->refcount;
+	pthread_mutex_unlock(&openpam_image_mtx);
+
+	/* (re)map the image if it has been replaced, created or removed */
+	if (image == NULL || !openpam_stamp_valid(&image->stamp)) {
+		if (image != NULL)
+			openpam_image_unref(image);
+		if ((image = openpam_image_map(openpam_policy_image)) == NULL)
+			RETURNN(0);
+		image->refcount = 2;
+		pthread_mutex_lock(&openpam_image_mtx);
+		old = openpam_image_current;
+		openpam_image_current = image;
+		pthread_mutex_unlock(&openpam_image_mtx);
+		if (old != NULL)
+			openpam_image_unref(old);
+	}
+
+	if (image->base == NULL ||
+	    !openpam_image_load(pamh, image, service)) {
+		openpam_image_unref(image);
+		RETURNN(0);
+	}
+	openpam_log(PAM_LOG_DEBUG, "using compiled %s policy", service);
+	pamh->image = image;
+	RETURNN(1);
+}
+
+/*
+ * OpenPAM internal
+ *
+ * Release the handle's reference to the image its chains were built
+ * from, if any.  The chains must already have been cleared.
+ */
+
+void
+openpam_image_release(pam_handle_t *pamh)
+{
+
+	if (pamh->image == NULL)
+		return;
+	openpam_image_unref(pamh->image);
+	pamh->image = NULL;
+}
+
+/*
+ * NOPARSE
+ */
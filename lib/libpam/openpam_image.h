@@ -0,0 +1,113 @@
+/*-
+ * Copyright (c) 2026 Dag-Erling Smørgrav
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote
+ *    products derived from this software without specific prior written
+ *    permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $OpenPAM$
+ */
+
+#ifndef OPENPAM_IMAGE_H_INCLUDED
+#define OPENPAM_IMAGE_H_INCLUDED
+
+#include <stdint.h>
+
+/*
+ * Compiled policy image, as written by openpam_dump_policy -o.
+ *
+ * The image is a single block, in host byte order, which starts with a
+ * header and is otherwise made up of the structures below.  All
+ * references are byte offsets from the start of the image; zero means
+ * "none".  Strings are NUL-terminated.
+ *
+ * Services are located through an open-addressing hash table.  Each
+ * service lists the policy files it was assembled from (or which were
+ * searched for and not found), so that a service whose sources have
+ * changed since the image was built can be detected and loaded from the
+ * text files instead.
+ */
+#define OPENPAM_IMAGE_MAGIC	"OpenPAM\0"
+#define OPENPAM_IMAGE_VERSION	3
+#define OPENPAM_IMAGE_ALIGN	8
+
+struct openpam_image_header {
+	char		 magic[8];
+	uint32_t	 version;
+	uint32_t	 size;		/* size of the entire image */
+	uint32_t	 features;	/* see openpam_cache_features() */
+	uint32_t	 nstamps;
+	uint32_t	 stamps;	/* struct openpam_image_stamp[] */
+	uint32_t	 nservices;
+	uint32_t	 services;	/* struct openpam_image_service[] */
+	uint32_t	 nbuckets;	/* power of two */
+	uint32_t	 buckets;	/* uint32_t[]: service index + 1 */
+	uint32_t	 reserved;
+};
+
+struct openpam_image_stamp {
+	uint32_t	 path;		/* string */
+	uint32_t	 found;
+	uint64_t	 dev;
+	uint64_t	 ino;
+	int64_t		 size;
+	int64_t		 mtime_sec;
+	int64_t		 mtime_nsec;
+	int64_t		 ctime_sec;
+	int64_t		 ctime_nsec;
+};
+
+struct openpam_image_service {
+	uint32_t	 name;		/* string */
+	uint32_t	 nstamps;
+	uint32_t	 stamps;	/* uint32_t[]: stamp indices */
+	uint32_t	 chains[PAM_NUM_FACILITIES]; /* first entry */
+};
+
+struct openpam_image_entry {
+	uint32_t	 next;		/* next entry in chain */
+	uint32_t	 flag;		/* pam_control_t */
+	uint32_t	 module;	/* string: module path */
+	uint32_t	 optc;
+	uint32_t	 optv;		/* uint32_t[]: strings */
+	uint32_t	 guardc;
+	uint32_t	 guardv;	/* uint32_t[]: strings */
+	uint8_t		 action[PAM_NUM_RESULTS]; /* see pam_chain_t */
+	uint8_t		 skip[PAM_NUM_RESULTS];
+};
+
+/*
+ * Hash function used for the service table (32-bit FNV-1a).
+ */
+static inline uint32_t
+openpam_image_hash(const char *str)
+{
+	uint32_t hash;
+
+	for (hash = 2166136261U; *str != '\0'; ++str)
+		hash = (hash ^ (unsigned char)*str) * 16777619U;
+	return (hash);
+}
+
+#endif
@@ -0,0 +1,459 @@
+/*-
+ * Copyright (c) 2026 Dag-Erling Smørgrav
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote
+ *    products derived from this software without specific prior written
+ *    permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $OpenPAM$
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <security/pam_appl.h>
+
+#include "openpam_impl.h"
+#include "openpam_asprintf.h"
+#include "openpam_image.h"
+
+/*
+ * Image under construction.  Objects are referred to by offset, since
+ * the buffer moves as it grows.
+ */
+struct openpam_image_buf {
+	char		*img;
+	size_t		 size;
+	size_t		 len;
+	uint32_t	*strv;		/* strings already in the image */
+	size_t		 strc;
+	size_t		 strsize;
+	pam_file_stamp_t *stamps;	/* files the services depend on */
+	int		 nstamps;
+};
+
+#define IMG(b, off, type) ((type *)(void *)((b)->img + (off)))
+
+static int
+openpam_image_grow(struct openpam_image_buf *b, size_t len)
+{
+	size_t size;
+	char *tmp;
+
+	if (len > UINT32_MAX - b->len) {
+		errno = EFBIG;
+		return (-1);
+	}
+	for (size = b->size ? b->size : 4096; b->len + len > size; size *= 2)
+		/* nothing */ ;
+	if (size > b->size) {
+		if ((tmp = openpam_realloc(b->img, size)) == NULL)
+			return (-1);
+		b->img = tmp;
+		b->size = size;
+	}
+	return (0);
+}
+
+/*
+ * Reserve a zeroed, aligned object and return its offset, or 0 on
+ * failure.
+ */
+static uint32_t
+openpam_image_alloc(struct openpam_image_buf *b, size_t len)
+{
+	size_t off;
+
+	off = (b->len + OPENPAM_IMAGE_ALIGN - 1) &
+	    ~(size_t)(OPENPAM_IMAGE_ALIGN - 1);
+	if (openpam_image_grow(b, off - b->len + len) != 0)
+		return (0);
+	memset(b->img + b->len, 0, off - b->len + len);
+	b->len = off + len;
+	return ((uint32_t)off);
+}
+
+/*
+ * Add a string, or find an identical one which was added earlier, and
+ * return its offset, or 0 on failure.
+ */
+static uint32_t
+openpam_image_addstr(struct openpam_image_buf *b, const char *str)
+{
+	uint32_t *tmp, off;
+	size_t i, len;
+
+	for (i = 0; i < b->strc; ++i)
+		if (strcmp(b->img + b->strv[i], str) == 0)
+			return (b->strv[i]);
+	if (b->strc == b->strsize) {
+		len = b->strsize ? b->strsize * 2 : 256;
+		tmp = openpam_realloc(b->strv, len * sizeof *tmp);
+		if (tmp == NULL)
+			return (0);
+		b->strv = tmp;
+		b->strsize = len;
+	}
+	len = strlen(str) + 1;
+	if (openpam_image_grow(b, len) != 0)
+		return (0);
+	off = (uint32_t)b->len;
+	memcpy(b->img + off, str, len);
+	b->len += len;
+	b->strv[b->strc++] = off;
+	return (off);
+}
+
+/*
+ * Add a non-empty array of strings and return its offset, or 0 on
+ * failure.
+ */
+static uint32_t
+openpam_image_strv(struct openpam_image_buf *b, int strc, char **strv)
+{
+	uint32_t off, str;
+	int i;
+
+	off = openpam_image_alloc(b, strc * sizeof(uint32_t));
+	if (off == 0)
+		return (0);
+	for (i = 0; i < strc; ++i) {
+		if ((str = openpam_image_addstr(b, strv[i])) == 0)
+			return (0);
+		IMG(b, off, uint32_t)[i] = str;
+	}
+	return (off);
+}
+
+/*
+ * Add a chain and return the offset of its first entry, or 0 if it is
+ * empty.  Returns -1 on failure.
+ */
+static int64_t
+openpam_image_chain(struct openpam_image_buf *b, const pam_chain_t *chain)
+{
+	struct openpam_image_entry *entry;
+	uint32_t first, prev, off, module, strv;
+
+	first = prev = 0;
+	for (; chain != NULL && !OPENPAM_CHAIN_END(chain); ++chain) {
+		module = openpam_image_addstr(b, chain->module != NULL ?
+		    chain->module->path : chain->modname);
+		if (module == 0 ||
+		    (off = openpam_image_alloc(b, sizeof *entry)) == 0)
+			return (-1);
+		if (prev != 0)
+			IMG(b, prev, struct openpam_image_entry)->next = off;
+		else
+			first = off;
+		prev = off;
+		entry = IMG(b, off, struct openpam_image_entry);
+		entry->flag = (uint32_t)chain->flag;
+		memcpy(entry->action, chain->action, sizeof entry->action);
+		memcpy(entry->skip, chain->skip, sizeof entry->skip);
+		entry->module = module;
+		entry->optc = (uint32_t)chain->optc;
+		entry->guardc = (uint32_t)chain->guardc;
+		if (chain->optc > 0) {
+			if ((strv = openpam_image_strv(b, chain->optc,
+			    chain->optv)) == 0)
+				return (-1);
+			IMG(b, off, struct openpam_image_entry)->optv = strv;
+		}
+		if (chain->guardc > 0) {
+			if ((strv = openpam_image_strv(b, chain->guardc,
+			    chain->guardv)) == 0)
+				return (-1);
+			IMG(b, off, struct openpam_image_entry)->guardv = strv;
+		}
+	}
+	return (first);
+}
+
+/*
+ * Add the stamps collected while configuring a service to the image's
+ * list, and return the offset of the service's array of indices into
+ * that list, or 0 on failure.
+ */
+static uint32_t
+openpam_image_stamps(struct openpam_image_buf *b,
+	const pam_cached_policy_t *policy)
+{
+	pam_file_stamp_t *tmp;
+	uint32_t idxv;
+	int i, j;
+
+	idxv = openpam_image_alloc(b,
+	    (policy->nstamps ? policy->nstamps : 1) * sizeof(uint32_t));
+	if (idxv == 0)
+		return (0);
+	for (i = 0; i < policy->nstamps; ++i) {
+		for (j = 0; j < b->nstamps; ++j)
+			if (strcmp(b->stamps[j].path,
+			    policy->stamps[i].path) == 0)
+				break;
+		if (j == b->nstamps) {
+			tmp = openpam_realloc(b->stamps,
+			    (j + 1) * sizeof *tmp);
+			if (tmp == NULL)
+				return (0);
+			b->stamps = tmp;
+			tmp[j] = policy->stamps[i];
+			tmp[j].path = openpam_strdup(policy->stamps[i].path);
+			if (tmp[j].path == NULL)
+				return (0);
+			++b->nstamps;
+		}
+		IMG(b, idxv, uint32_t)[i] = (uint32_t)j;
+	}
+	return (idxv);
+}
+
+/*
+ * Configure a service and add it to the image.
+ */
+static int
+openpam_image_service(struct openpam_image_buf *b, uint32_t svcoff,
+	const char *service)
+{
+	struct openpam_image_service *svc;
+	pam_handle_t *pamh;
+	uint32_t name, stamps;
+	int64_t chain;
+	int fclt, nstamps, ret;
+
+	if ((pamh = openpam_calloc(1, sizeof *pamh)) == NULL)
+		return (PAM_BUF_ERR);
+	/* borrow the policy cache's bookkeeping to learn the sources */
+	openpam_cache_begin(pamh, service);
+	if (pamh->policy == NULL) {
+		FREE(pamh);
+		return (PAM_BUF_ERR);
+	}
+	if ((ret = openpam_configure(pamh, service)) != PAM_SUCCESS)
+		goto done;
+	ret = PAM_BUF_ERR;
+	nstamps = pamh->policy->nstamps;
+	if ((name = openpam_image_addstr(b, service)) == 0 ||
+	    (stamps = openpam_image_stamps(b, pamh->policy)) == 0)
+		goto done;
+	svc = IMG(b, svcoff, struct openpam_image_service);
+	svc->name = name;
+	svc->nstamps = (uint32_t)nstamps;
+	svc->stamps = stamps;
+	for (fclt = 0; fclt < PAM_NUM_FACILITIES; ++fclt) {
+		if ((chain = openpam_image_chain(b, pamh->chains[fclt])) < 0)
+			goto done;
+		IMG(b, svcoff, struct openpam_image_service)->chains[fclt] =
+		    (uint32_t)chain;
+	}
+	ret = PAM_SUCCESS;
+done:
+	openpam_cache_abort(pamh);
+	openpam_clear_chains(pamh->chains);
+	FREE(pamh);
+	return (ret);
+}
+
+/*
+ * Write the image to the specified file.  The image is written to a
+ * temporary file which is then renamed into place, so that readers never
+ * see a partial image.
+ */
+static int
+openpam_image_save(const struct openpam_image_buf *b, const char *path)
+{
+	char *tmppath;
+	size_t len;
+	ssize_t wlen;
+	int fd, serrno;
+
+	if (asprintf(&tmppath, "%s.XXXXXX", path) < 0)
+		return (-1);
+	if ((fd = mkstemp(tmppath)) < 0) {
+		serrno = errno;
+		free(tmppath);
+		errno = serrno;
+		return (-1);
+	}
+	for (len = 0; len < b->len; len += (size_t)wlen)
+		if ((wlen = write(fd, b->img + len, b->len - len)) < 0)
+			goto fail;
+	if (fchmod(fd, 0644) != 0 || fsync(fd) != 0)
+		goto fail;
+	if (close(fd) != 0) {
+		fd = -1;
+		goto fail;
+	}
+	if (rename(tmppath, path) != 0) {
+		fd = -1;
+		goto fail;
+	}
+	free(tmppath);
+	return (0);
+fail:
+	serrno = errno;
+	if (fd >= 0)
+		close(fd);
+	unlink(tmppath);
+	free(tmppath);
+	errno = serrno;
+	return (-1);
+}
+
+/*
+ * OpenPAM internal
+ *
+ * Configure each of the specified services and write the result to a
+ * compiled policy image.
+ */
+
+int
+openpam_image_write(const char *path, int nservices, const char **services)
+{
+	struct openpam_image_buf b;
+	struct openpam_image_header *hdr;
+	struct openpam_image_stamp *st;
+	uint32_t buckets, h, nbuckets, off, stamps, svcoff;
+	int i, j, ret;
+
+	ENTERS(path);
+	memset(&b, 0, sizeof b);
+	ret = PAM_BUF_ERR;
+	/* the header lives at offset 0, which is otherwise never used */
+	if (openpam_image_grow(&b, sizeof *hdr) != 0)
+		goto nomem;
+	memset(b.img, 0, sizeof *hdr);
+	b.len = sizeof *hdr;
+	if ((svcoff = openpam_image_alloc(&b, (nservices ? nservices : 1) *
+	    sizeof(struct openpam_image_service))) == 0)
+		goto nomem;
+
+	/* services */
+	for (i = 0; i < nservices; ++i) {
+		for (j = 0; j < i; ++j)
+			if (strcmp(services[i], services[j]) == 0)
+				break;
+		if (j < i)
+			continue;
+		off = svcoff + i * sizeof(struct openpam_image_service);
+		if ((ret = openpam_image_service(&b, off, services[i])) !=
+		    PAM_SUCCESS) {
+			openpam_log(PAM_LOG_ERROR, "%s: %s", services[i],
+			    pam_strerror(NULL, ret));
+			goto done;
+		}
+	}
+
+	/* sources */
+	ret = PAM_BUF_ERR;
+	stamps = openpam_image_alloc(&b,
+	    (b.nstamps ? b.nstamps : 1) * sizeof *st);
+	if (stamps == 0)
+		goto nomem;
+	for (i = 0; i < b.nstamps; ++i) {
+		if ((off = openpam_image_addstr(&b, b.stamps[i].path)) == 0)
+			goto nomem;
+		st = &IMG(&b, stamps, struct openpam_image_stamp)[i];
+		st->path = off;
+		st->found = (uint32_t)b.stamps[i].found;
+		st->dev = (uint64_t)b.stamps[i].dev;
+		st->ino = (uint64_t)b.stamps[i].ino;
+		st->size = (int64_t)b.stamps[i].size;
+		st->mtime_sec = (int64_t)b.stamps[i].mtime.tv_sec;
+		st->mtime_nsec = (int64_t)b.stamps[i].mtime.tv_nsec;
+		st->ctime_sec = (int64_t)b.stamps[i].ctime.tv_sec;
+		st->ctime_nsec = (int64_t)b.stamps[i].ctime.tv_nsec;
+	}
+
+	/* hash table */
+	for (nbuckets = 1; nbuckets < 2 * (uint32_t)nservices; nbuckets *= 2)
+		/* nothing */ ;
+	if ((buckets = openpam_image_alloc(&b,
+	    nbuckets * sizeof(uint32_t))) == 0)
+		goto nomem;
+	for (i = 0; i < nservices; ++i) {
+		off = svcoff + i * sizeof(struct openpam_image_service);
+		if (IMG(&b, off, struct openpam_image_service)->name == 0)
+			continue; /* duplicate */
+		h = openpam_image_hash(services[i]);
+		while (IMG(&b, buckets, uint32_t)[h & (nbuckets - 1)] != 0)
+			++h;
+		IMG(&b, buckets, uint32_t)[h & (nbuckets - 1)] = i + 1;
+	}
+
+	/* header */
+	hdr = IMG(&b, 0, struct openpam_image_header);
+	memcpy(hdr->magic, OPENPAM_IMAGE_MAGIC, sizeof hdr->magic);
+	hdr->version = OPENPAM_IMAGE_VERSION;
+	hdr->size = (uint32_t)b.len;
+	hdr->features = (uint32_t)openpam_cache_features();
+	hdr->nstamps = (uint32_t)b.nstamps;
+	hdr->stamps = stamps;
+	hdr->nservices = (uint32_t)nservices;
+	hdr->services = svcoff;
+	hdr->nbuckets = nbuckets;
+	hdr->buckets = buckets;
+
+	if (openpam_image_save(&b, path) != 0) {
+		openpam_log(PAM_LOG_ERROR, "%s: %m", path);
+		ret = PAM_SYSTEM_ERR;
+		goto done;
+	}
+	ret = PAM_SUCCESS;
+	goto done;
+nomem:
+	openpam_log(PAM_LOG_ERROR, "%s: %m", path);
+done:
+	while (b.nstamps > 0) {
+		--b.nstamps;
+		FREE(b.stamps[b.nstamps].path);
+	}
+	FREE(b.stamps);
+	FREE(b.strv);
+	FREE(b.img);
+	RETURNC(ret);
+}
+
+/*
+ * Error codes:
+ *
+ *	PAM_BUF_ERR
+ *	PAM_SYSTEM_ERR
+ */
+
+/*
+ * NOPARSE
+ */
@@ -38,6 +38,11 @@
 #ifndef OPENPAM_IMPL_H_INCLUDED
 #define OPENPAM_IMPL_H_INCLUDED
 
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <time.h>
+
 #include <security/openpam.h>
 
 extern int openpam_debug;
@@ -54,6 +59,9 @@ typedef enum {
 	PAM_NUM_CONTROL_FLAGS
 } pam_control_t;
 
+/* an entry whose control is a Linux-PAM style list of actions */
+#define PAM_CUSTOM_CONTROL	PAM_NUM_CONTROL_FLAGS
+
 /*
  * Facilities
  */
@@ -67,19 +75,119 @@ typedef enum {
 } pam_facility_t;
 
 /*
- * Module chains
+ * Module options, indexed by name so they need not be scanned every time
+ * one is looked up.  The entries are sorted by name and point into the
+ * option vector the index was built from.  Options which occur more than
+ * once keep their original order, so the first one still wins.  The
+ * well-known options which the library itself checks for are also
+ * recorded in a bitmap.
+ */
+#define OPENPAM_OPT_DEBUG		(1U << 0)
+#define OPENPAM_OPT_ECHO_PASS		(1U << 1)
+#define OPENPAM_OPT_TRY_FIRST_PASS	(1U << 2)
+#define OPENPAM_OPT_USE_FIRST_PASS	(1U << 3)
+
+typedef struct pam_option pam_option_t;
+struct pam_option {
+	const char	*name;
+	size_t		 len;		/* of the name */
+	const char	*value;		/* "" if none */
+};
+
+typedef struct pam_optidx pam_optidx_t;
+struct pam_optidx {
+	unsigned int	 flags;
+	int		 optc;
+	pam_option_t	 optv[];
+};
+
+/*
+ * Guards, e.g. "?user!=root", which make a chain entry conditional on
+ * the value of an item.  They are checked before the module is called,
+ * or even loaded, and the entry is skipped if any of them fails.  Each
+ * pattern is sorted into one of a few kinds when the chain is built, so
+ * that most of them can be matched without fnmatch(3).
+ */
+typedef enum {
+	PAM_GUARD_EXACT,	/* "root" */
+	PAM_GUARD_PREFIX,	/* "adm*" */
+	PAM_GUARD_SUFFIX,	/* "*.example.com" */
+	PAM_GUARD_GLOB,		/* anything else */
+} pam_guard_kind_t;
+
+typedef struct pam_guard pam_guard_t;
+struct pam_guard {
+	int		 item;
+	int		 negate;
+	pam_guard_kind_t kind;
+	const char	*pattern;	/* without the star, if any */
+	size_t		 len;
+};
+
+typedef struct pam_guardset pam_guardset_t;
+struct pam_guardset {
+	int		 guardc;
+	pam_guard_t	 guardv[];
+};
+
+/*
+ * Dispatch statistics for a (service, facility, module, primitive)
+ * tuple.  The records are private to openpam_stats.c.
+ */
+typedef struct pam_stats pam_stats_t;
+
+/*
+ * What openpam_dispatch() does with the result of a module call.  Each
+ * chain entry has a table, filled in when the chain is built either
+ * from its control flag or from a Linux-PAM style list of actions,
+ * which gives the action to take for each return code, and how many of
+ * the entries which follow to skip afterwards.  Besides one slot per
+ * return code, there is one for PAM_SUCCESS when it may not end the
+ * chain, and one for return codes we do not know.
+ */
+#define PAM_RC_NONFINAL		PAM_NUM_ERRORS
+#define PAM_RC_OTHER		(PAM_NUM_ERRORS + 1)
+#define PAM_NUM_RESULTS		(PAM_NUM_ERRORS + 2)
+
+typedef enum {
+	PAM_ACT_CONTINUE,	/* move on */
+	PAM_ACT_SUCCEED,	/* count the success and move on */
+	PAM_ACT_BREAK,		/* count the success, stop unless failed */
+	PAM_ACT_DONE,		/* count the success and stop */
+	PAM_ACT_RECORD,		/* note the result if it is the first */
+	PAM_ACT_FAIL,		/* fail the chain with this result */
+	PAM_ACT_TERMINATE,	/* note the result, fail and stop */
+	PAM_ACT_RESET,		/* forget everything so far and move on */
+	PAM_NUM_ACTIONS
+} pam_action_t;
+
+/*
+ * Module chains.  Each chain is an array of entries, terminated by one
+ * which has neither a module nor a module name.
  */
 typedef struct pam_chain pam_chain_t;
 struct pam_chain {
 	pam_module_t	*module;
+	char		*modname;	/* until the module is loaded */
 	int		 flag;
+	unsigned char	 action[PAM_NUM_RESULTS];
+	unsigned char	 skip[PAM_NUM_RESULTS];
 	int		 optc;
 	char	       **optv;
-	pam_chain_t	*next;
+	pam_optidx_t	*optidx;	/* may be NULL */
+	int		 guardc;
+	char	       **guardv;
+	pam_guardset_t	*guards;	/* NULL if there are none */
 };
 
+#define OPENPAM_CHAIN_END(c)						\
+	((c)->module == NULL && (c)->modname == NULL)
+
 /*
- * Service policies
+ * Service policies.  The table of embedded policies is generated by
+ * openpam_dump_policy and linked into the library last; it is weak so
+ * that the library can be linked without it while the table is being
+ * generated.
  */
 #if defined(OPENPAM_EMBEDDED)
 typedef struct pam_policy pam_policy_t;
@@ -87,9 +195,45 @@ struct pam_policy {
 	const char	*service;
 	pam_chain_t	*chains[PAM_NUM_FACILITIES];
 };
-extern pam_policy_t *pam_embedded_policies[];
+extern pam_policy_t *pam_embedded_policies[] __attribute__((__weak__));
 #endif
 
+/*
+ * Identity and state of a file which contributed to a cached policy, or
+ * of a file which was searched for but not found.
+ */
+typedef struct pam_file_stamp pam_file_stamp_t;
+struct pam_file_stamp {
+	char		*path;
+	int		 found;
+	dev_t		 dev;
+	ino_t		 ino;
+	off_t		 size;
+	struct timespec	 mtime;
+	struct timespec	 ctime;
+};
+
+/*
+ * Compiled policy image
+ */
+typedef struct pam_policy_image pam_policy_image_t;
+
+/*
+ * Cached policies
+ */
+typedef struct pam_cached_policy pam_cached_policy_t;
+struct pam_cached_policy {
+	char		*service;
+	unsigned int	 refcount;
+	int		 features;
+	unsigned int	 dirty;		/* changes seen by the watcher */
+	unsigned int	 watchgen;	/* watcher it was validated under */
+	pam_chain_t	*chains[PAM_NUM_FACILITIES];
+	int		 nstamps;
+	pam_file_stamp_t *stamps;
+	pam_cached_policy_t *next;
+};
+
 /*
  * Module-specific data
  */
@@ -101,6 +245,42 @@ struct pam_data {
 	pam_data_t	*next;
 };
 
+/*
+ * Options which a clone has set on a chain entry it shares with its
+ * template
+ */
+typedef struct pam_overlay pam_overlay_t;
+struct pam_overlay {
+	const pam_chain_t *chain;
+	int		 optc;
+	char	       **optv;
+	pam_optidx_t	*optidx;
+	pam_overlay_t	*next;
+};
+
+/*
+ * Items which describe the context rather than the transaction: they
+ * survive openpam_reset(), clones borrow them from their template, and
+ * they are allocated from the heap rather than from the arena.
+ */
+#define OPENPAM_PRESET_ITEM(t)						\
+	((t) == PAM_SERVICE || (t) == PAM_HOST || (t) == PAM_CONV)
+
+/*
+ * Per-handle arena
+ */
+typedef struct pam_arena_chunk pam_arena_chunk_t;
+struct pam_arena_chunk {
+	pam_arena_chunk_t *next;
+	size_t		 size;		/* bytes available for blocks */
+	size_t		 used;
+};
+typedef struct pam_arena pam_arena_t;
+struct pam_arena {
+	pam_arena_chunk_t *chunks;
+	void		*freelist;	/* wiped blocks, ready for reuse */
+};
+
 /*
  * PAM context
  */
@@ -112,6 +292,18 @@ struct pam_handle {
 	pam_chain_t	*current;
 	int		 primitive;
 
+	/* template the chains belong to, if this is a clone */
+	pam_handle_t	*parent;
+	unsigned int	 refcount;	/* self plus clones */
+	unsigned int	 borrowed;	/* items owned by the parent */
+	pam_overlay_t	*overlay;
+
+	/* cache entry under construction */
+	pam_cached_policy_t *policy;
+
+	/* image the chains point into, if any */
+	pam_policy_image_t *image;
+
 	/* items and data */
 	void		*item[PAM_NUM_ITEMS];
 	pam_data_t	*module_data;
@@ -120,6 +312,9 @@ struct pam_handle {
 	char	       **env;
 	int		 env_count;
 	int		 env_size;
+
+	/* memory for the above which is wiped when the transaction ends */
+	pam_arena_t	 arena;
 };
 
 /*
@@ -138,12 +333,99 @@ int		 openpam_findenv(pam_handle_t *, const char *, size_t)
 	OPENPAM_NONNULL((1,2));
 pam_module_t	*openpam_load_module(const char *)
 	OPENPAM_NONNULL((1));
+void		 openpam_retain_module(pam_module_t *);
+void		 openpam_release_module(pam_module_t *);
+void		 openpam_pin_module(pam_module_t *);
+int		 openpam_chain_init(pam_chain_t *, const char *)
+	OPENPAM_NONNULL((1,2));
+pam_module_t	*openpam_chain_module(pam_chain_t *)
+	OPENPAM_NONNULL((1));
+void		 openpam_chain_fini(pam_chain_t *)
+	OPENPAM_NONNULL((1));
+int		 openpam_chain_length(const pam_chain_t *);
+int		 openpam_chain_append(pam_chain_t **, const pam_chain_t *)
+	OPENPAM_NONNULL((1,2));
+void		 openpam_chain_actions(pam_chain_t *)
+	OPENPAM_NONNULL((1));
+int		 openpam_copy_chain(pam_chain_t **, const pam_chain_t *)
+	OPENPAM_NONNULL((1));
 void		 openpam_clear_chains(pam_chain_t **)
 	OPENPAM_NONNULL((1));
+char		**openpam_packv(int, char * const *);
+char		**openpam_chain_optv(pam_handle_t *, const pam_chain_t *,
+    int *)
+	OPENPAM_NONNULL((1,2,3));
+int		 openpam_chain_set_optv(pam_handle_t *, pam_chain_t *, int,
+    char **)
+	OPENPAM_NONNULL((1,2,4));
+pam_optidx_t	*openpam_chain_optidx(pam_handle_t *, const pam_chain_t *)
+	OPENPAM_NONNULL((1,2));
+pam_optidx_t	*openpam_optidx(int, char **);
+const char	*openpam_optidx_find(const pam_optidx_t *, const char *)
+	OPENPAM_NONNULL((1,2));
+int		 openpam_get_option_flag(pam_handle_t *, unsigned int)
+	OPENPAM_NONNULL((1));
+pam_guardset_t	*openpam_guards(int, char **);
+int		 openpam_guards_match(pam_handle_t *, const pam_guardset_t *)
+	OPENPAM_NONNULL((1,2));
+unsigned int	 openpam_unref_handle(pam_handle_t *)
+	OPENPAM_NONNULL((1));
+void		*openpam_arena_alloc(pam_handle_t *, size_t)
+	OPENPAM_NONNULL((1));
+char		*openpam_arena_strdup(pam_handle_t *, const char *)
+	OPENPAM_NONNULL((1,2));
+void		 openpam_arena_free(pam_handle_t *, void *)
+	OPENPAM_NONNULL((1));
+void		 openpam_arena_clear(pam_handle_t *, int)
+	OPENPAM_NONNULL((1));
+int		 openpam_putenv(pam_handle_t *, char *)
+	OPENPAM_NONNULL((1,2));
+pam_stats_t	*openpam_stats_get(pam_handle_t *, pam_chain_t *, int, int)
+	OPENPAM_NONNULL((1,2));
+void		 openpam_stats_update(pam_stats_t *, int,
+    const struct timespec *)
+	OPENPAM_NONNULL((1,3));
+int		 openpam_stats_export(struct openpam_stats **, size_t *)
+	OPENPAM_NONNULL((1,2));
+void		 openpam_stats_clear(void);
+
+int		 openpam_cache_lookup(pam_handle_t *, const char *)
+	OPENPAM_NONNULL((1,2));
+void		 openpam_cache_begin(pam_handle_t *, const char *)
+	OPENPAM_NONNULL((1,2));
+void		 openpam_cache_stamp(pam_handle_t *, const char *,
+    const struct stat *)
+	OPENPAM_NONNULL((1,2));
+void		 openpam_cache_commit(pam_handle_t *)
+	OPENPAM_NONNULL((1));
+void		 openpam_cache_abort(pam_handle_t *)
+	OPENPAM_NONNULL((1));
+int		 openpam_cache_features(void);
+void		 openpam_stamp_set(pam_file_stamp_t *, const struct stat *)
+	OPENPAM_NONNULL((1,2));
+int		 openpam_stamp_valid(const pam_file_stamp_t *)
+	OPENPAM_NONNULL((1));
+
+int		 openpam_dircache_open(const char *)
+	OPENPAM_NONNULL((1));
 
+int		 openpam_watch_arm(const pam_file_stamp_t *, int);
+unsigned int	 openpam_watch_drain(void (*)(const char *))
+	OPENPAM_NONNULL((1));
+
+int		 openpam_image_lookup(pam_handle_t *, const char *)
+	OPENPAM_NONNULL((1,2));
+void		 openpam_image_release(pam_handle_t *)
+	OPENPAM_NONNULL((1));
+int		 openpam_image_write(const char *, int, const char **)
+	OPENPAM_NONNULL((1));
+
+int		 openpam_check_stat_owner_perms(const char *,
+    const struct stat *)
+	OPENPAM_NONNULL((1,2));
 int		 openpam_check_desc_owner_perms(const char *, int)
 	OPENPAM_NONNULL((1));
-int		 openpam_check_path_owner_perms(const char *)
+int		 openpam_check_path_owner_perms(const char *, char *)
 	OPENPAM_NONNULL((1));
 
 #ifdef OPENPAM_STATIC_MODULES
@@ -152,10 +434,23 @@ pam_module_t	*openpam_static(const char *)
 #endif
 pam_module_t	*openpam_dynamic(const char *)
 	OPENPAM_NONNULL((1));
+void		 openpam_dynamic_retain(pam_module_t *)
+	OPENPAM_NONNULL((1));
+void		 openpam_dynamic_pin(pam_module_t *)
+	OPENPAM_NONNULL((1));
+void		 openpam_dynamic_release(pam_module_t *)
+	OPENPAM_NONNULL((1));
+
+void		*openpam_malloc(size_t);
+void		*openpam_calloc(size_t, size_t);
+void		*openpam_realloc(void *, size_t);
+char		*openpam_strdup(const char *)
+	OPENPAM_NONNULL((1));
+void		 openpam_free(void *);
 
 #define	FREE(p)					\
 	do {					\
-		free(p);			\
+		openpam_free(p);		\
 		(p) = NULL;			\
 	} while (0)
 
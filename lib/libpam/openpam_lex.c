@@ -0,0 +1,369 @@
+/*-
+ * Copyright (c) 2026 Dag-Erling Smørgrav
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote
+ *    products derived from this software without specific prior written
+ *    permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $OpenPAM$
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <security/pam_appl.h>
+
+#include "openpam_impl.h"
+#include "openpam_lex.h"
+
+#define MIN_WORDV_SIZE	32
+#define MIN_READ_SIZE	4096
+
+/*
+ * Files at least this large are mapped rather than read.
+ */
+#define MIN_MMAP_SIZE	65536
+
+/*
+ * OpenPAM internal
+ *
+ * Prepare to split an existing buffer into words.
+ */
+
+void
+openpam_lex_init(struct openpam_lexer *lx, const char *buf, size_t len)
+{
+
+	memset(lx, 0, sizeof *lx);
+	lx->buf = buf;
+	lx->len = len;
+}
+
+/*
+ * OpenPAM internal
+ *
+ * Map or read the entire contents of a file into memory and prepare to
+ * split it into words.  The descriptor is no longer needed once this
+ * function returns.
+ */
+
+int
+openpam_lex_open(struct openpam_lexer *lx, int fd)
+{
+	struct stat st;
+	char *data, *tmp;
+	size_t size, len;
+	ssize_t rlen;
+	void *map;
+	int serrno;
+
+	openpam_lex_init(lx, NULL, 0);
+	if (fstat(fd, &st) != 0)
+		return (-1);
+	if (S_ISREG(st.st_mode) && st.st_size >= MIN_MMAP_SIZE &&
+	    (uintmax_t)st.st_size <= SIZE_MAX) {
+		map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE,
+		    fd, 0);
+		if (map != MAP_FAILED) {
+			lx->buf = lx->data = map;
+			lx->len = (size_t)st.st_size;
+			lx->mapped = 1;
+			return (0);
+		}
+		/* fall back to read() */
+	}
+	size = MIN_READ_SIZE;
+	if (S_ISREG(st.st_mode) && st.st_size > 0 &&
+	    (uintmax_t)st.st_size < SIZE_MAX)
+		size = (size_t)st.st_size + 1;
+	if ((data = openpam_malloc(size)) == NULL)
+		return (-1);
+	len = 0;
+	for (;;) {
+		if (len == size) {
+			if ((tmp = openpam_realloc(data, size * 2)) == NULL)
+				goto fail;
+			data = tmp;
+			size *= 2;
+		}
+		if ((rlen = read(fd, data + len, size - len)) < 0) {
+			if (errno == EINTR)
+				continue;
+			goto fail;
+		}
+		if (rlen == 0)
+			break;
+		len += (size_t)rlen;
+	}
+	lx->buf = lx->data = data;
+	lx->len = len;
+	return (0);
+fail:
+	serrno = errno;
+	openpam_free(data);
+	errno = serrno;
+	return (-1);
+}
+
+/*
+ * Make room for one more word plus the terminating entry.
+ */
+static int
+openpam_lex_grow(struct openpam_lexer *lx)
+{
+	struct openpam_word *tmp;
+	int size;
+
+	if (lx->wordc + 1 < lx->wordsize)
+		return (0);
+	size = lx->wordsize ? lx->wordsize * 2 : MIN_WORDV_SIZE;
+	if ((tmp = openpam_realloc(lx->wordv, size * sizeof *tmp)) == NULL)
+		return (-1);
+	lx->wordv = tmp;
+	lx->wordsize = size;
+	return (0);
+}
+
+/*
+ * Move the current word into the scratch buffer so that characters which
+ * are not contiguous in the input can be appended to it.
+ */
+static int
+openpam_lex_cook(struct openpam_lexer *lx, struct openpam_word *word)
+{
+	char *p;
+
+	if (lx->scratch == NULL &&
+	    (lx->scratch = openpam_malloc(lx->len + 1)) == NULL)
+		return (-1);
+	p = lx->scratch + lx->scratchlen;
+	memmove(p, word->str, word->len);
+	word->str = p;
+	return (0);
+}
+
+/*
+ * OpenPAM internal
+ *
+ * Split the next line into words.  Words which contain no quotes or
+ * escapes point directly into the input; only those which need to be
+ * rewritten are copied.
+ *
+ * Returns the number of words on the line, which may be zero, or -1 at
+ * the end of the input (errno is zero) or on error (errno is non-zero).
+ */
+
+int
+openpam_lex_line(struct openpam_lexer *lx)
+{
+	struct openpam_lexstate ls;
+	struct openpam_word *word;
+	char *p;
+	int action, ch, cooked;
+
+	lx->wordc = 0;
+	lx->scratchlen = 0;
+	memset(&ls, 0, sizeof ls);
+	word = NULL;
+	cooked = 0;
+	for (;;) {
+		ch = lx->pos < lx->len ? (unsigned char)lx->buf[lx->pos] : EOF;
+		action = openpam_lexch(&ls, ch);
+		if (word == NULL && (action == OPENPAM_LEX_CHAR ||
+		    action == OPENPAM_LEX_ESCAPED ||
+		    action == OPENPAM_LEX_OPEN)) {
+			/* start of a new word */
+			if (openpam_lex_grow(lx) != 0)
+				goto nomem;
+			word = &lx->wordv[lx->wordc++];
+			word->str = lx->buf + lx->pos;
+			if (action == OPENPAM_LEX_OPEN)
+				++word->str;
+			word->len = 0;
+			cooked = 0;
+		}
+		switch (action) {
+		case OPENPAM_LEX_SKIP:
+		case OPENPAM_LEX_OPEN:
+			break;
+		case OPENPAM_LEX_CHAR:
+			if (!cooked &&
+			    word->str + word->len == lx->buf + lx->pos) {
+				/* still contiguous */
+				++word->len;
+				break;
+			}
+			/* fall through */
+		case OPENPAM_LEX_ESCAPED:
+			if (!cooked) {
+				if (openpam_lex_cook(lx, word) != 0)
+					goto nomem;
+				cooked = 1;
+			}
+			p = lx->scratch + lx->scratchlen;
+			if (action == OPENPAM_LEX_ESCAPED)
+				p[word->len++] = '\\';
+			p[word->len++] = (char)ch;
+			break;
+		case OPENPAM_LEX_END:
+			if (cooked)
+				lx->scratchlen += word->len;
+			word = NULL;
+			memset(&ls, 0, sizeof ls);
+			continue;
+		case OPENPAM_LEX_EOL:
+			++lx->pos;
+			++lx->lineno;
+			/* fall through */
+		case OPENPAM_LEX_EOF:
+			if (action == OPENPAM_LEX_EOF && lx->wordc == 0) {
+				errno = 0;
+				return (-1);
+			}
+			if (openpam_lex_grow(lx) != 0)
+				goto nomem;
+			lx->wordv[lx->wordc].str = NULL;
+			lx->wordv[lx->wordc].len = 0;
+			errno = 0;
+			return (lx->wordc);
+		default:
+			/* missing escaped character or closing quote */
+			openpam_log(PAM_LOG_DEBUG, "unexpected end of file");
+			errno = EINVAL;
+			return (-1);
+		}
+		if (ch == '\n')
+			++lx->lineno;
+		++lx->pos;
+	}
+nomem:
+	openpam_log(PAM_LOG_ERROR, "malloc(): %m");
+	errno = ENOMEM;
+	return (-1);
+}
+
+/*
+ * OpenPAM internal
+ *
+ * Copy the words on the current line, from the first specified one up to
+ * but not including the last, into a single allocation laid out as by
+ * openpam_packv().
+ */
+
+char **
+openpam_lex_pack(const struct openpam_lexer *lx, int first, int last)
+{
+	char **packv, *p;
+	size_t len;
+	int i, n;
+
+	if (last > lx->wordc)
+		last = lx->wordc;
+	n = last > first ? last - first : 0;
+	for (len = 0, i = 0; i < n; ++i)
+		len += lx->wordv[first + i].len + 1;
+	if ((packv = openpam_malloc((n + 1) * sizeof *packv + len)) == NULL)
+		return (NULL);
+	p = (char *)(packv + n + 1);
+	for (i = 0; i < n; ++i) {
+		len = lx->wordv[first + i].len;
+		memcpy(p, lx->wordv[first + i].str, len);
+		p[len] = '\0';
+		packv[i] = p;
+		p += len + 1;
+	}
+	packv[n] = NULL;
+	return (packv);
+}
+
+/*
+ * OpenPAM internal
+ *
+ * Release the resources held by the lexer.
+ */
+
+void
+openpam_lex_fini(struct openpam_lexer *lx)
+{
+
+	if (lx->mapped)
+		munmap(lx->data, lx->len);
+	else
+		openpam_free(lx->data);
+	openpam_free(lx->scratch);
+	openpam_free(lx->wordv);
+	memset(lx, 0, sizeof *lx);
+}
+
+/*
+ * OpenPAM internal
+ *
+ * Return a NUL-terminated copy of a word.
+ */
+
+char *
+openpam_worddup(const struct openpam_word *word)
+{
+	char *str;
+
+	if ((str = openpam_malloc(word->len + 1)) == NULL)
+		return (NULL);
+	memcpy(str, word->str, word->len);
+	str[word->len] = '\0';
+	return (str);
+}
+
+/*
+ * OpenPAM internal
+ *
+ * Copy a word into a fixed-size buffer and NUL-terminate it.  Returns -1
+ * if the buffer is too small.
+ */
+
+int
+openpam_wordcpy(char *buf, const struct openpam_word *word, size_t size)
+{
+
+	if (word->len >= size)
+		return (-1);
+	memcpy(buf, word->str, word->len);
+	buf[word->len] = '\0';
+	return (0);
+}
+
+/*
+ * NOPARSE
+ */
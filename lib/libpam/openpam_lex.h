@@ -0,0 +1,202 @@
+/*-
+ * Copyright (c) 2026 Dag-Erling Smørgrav
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote
+ *    products derived from this software without specific prior written
+ *    permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $OpenPAM$
+ */
+
+#ifndef OPENPAM_LEX_H_INCLUDED
+#define OPENPAM_LEX_H_INCLUDED
+
+#include "openpam_ctype.h"
+
+/*
+ * Lexer state, shared by the stream and buffer front ends.
+ */
+#define OPENPAM_LEX_BLANK	0	/* between words */
+#define OPENPAM_LEX_COMMENT	1	/* within a comment */
+#define OPENPAM_LEX_WORD	2	/* within a word */
+
+struct openpam_lexstate {
+	int	 state;
+	int	 escape;
+	int	 quote;
+};
+
+/*
+ * Actions returned by openpam_lexch().  The first four consume the
+ * character, the others do not.
+ */
+#define OPENPAM_LEX_SKIP	0	/* discard the character */
+#define OPENPAM_LEX_CHAR	1	/* append the character */
+#define OPENPAM_LEX_ESCAPED	2	/* append backslash and character */
+#define OPENPAM_LEX_OPEN	3	/* opening quote: word, maybe empty */
+#define OPENPAM_LEX_END		4	/* end of word */
+#define OPENPAM_LEX_EOL		5	/* end of line, no word */
+#define OPENPAM_LEX_EOF		6	/* end of file, no word */
+#define OPENPAM_LEX_ERROR	7	/* unterminated quote or escape */
+
+/*
+ * Feed one character (or EOF) to the lexer and return the resulting
+ * action.  See openpam_readword(3) for the quoting rules.
+ */
+static inline int
+openpam_lexch(struct openpam_lexstate *ls, int ch)
+{
+	int action;
+
+	switch (ls->state) {
+	case OPENPAM_LEX_COMMENT:
+		if (ch == EOF)
+			return (OPENPAM_LEX_EOF);
+		if (ch == '\n')
+			return (OPENPAM_LEX_EOL);
+		return (OPENPAM_LEX_SKIP);
+	case OPENPAM_LEX_BLANK:
+		if (ch == EOF)
+			return (OPENPAM_LEX_EOF);
+		if (ch == '\n') {
+			/* either EOL or line continuation */
+			if (!ls->escape)
+				return (OPENPAM_LEX_EOL);
+			ls->escape = 0;
+			return (OPENPAM_LEX_SKIP);
+		}
+		if (!ls->escape) {
+			if (ch == '#') {
+				/* comment: until EOL, no continuation */
+				ls->state = OPENPAM_LEX_COMMENT;
+				return (OPENPAM_LEX_SKIP);
+			}
+			if (ch == '\\') {
+				ls->escape = 1;
+				return (OPENPAM_LEX_SKIP);
+			}
+			if (is_ws(ch))
+				return (OPENPAM_LEX_SKIP);
+		}
+		ls->state = OPENPAM_LEX_WORD;
+		/* fall through */
+	default:
+		if (ch == EOF) {
+			if (ls->escape || ls->quote)
+				return (OPENPAM_LEX_ERROR);
+			return (OPENPAM_LEX_END);
+		}
+		if (is_ws(ch) && !ls->quote && !ls->escape)
+			return (OPENPAM_LEX_END);
+		if (ch == '\\' && !ls->escape && ls->quote != '\'') {
+			/* escape next character */
+			ls->escape = 1;
+			return (OPENPAM_LEX_SKIP);
+		}
+		if ((ch == '\'' || ch == '"') && !ls->quote && !ls->escape) {
+			/* begin quote */
+			ls->quote = ch;
+			return (OPENPAM_LEX_OPEN);
+		}
+		if (ch == ls->quote && !ls->escape) {
+			/* end quote */
+			ls->quote = 0;
+			return (OPENPAM_LEX_SKIP);
+		}
+		if (ch == '\n' && ls->escape) {
+			/* line continuation */
+			ls->escape = 0;
+			return (OPENPAM_LEX_SKIP);
+		}
+		action = OPENPAM_LEX_CHAR;
+		if (ls->escape && ls->quote && ch != '\\' && ch != ls->quote)
+			action = OPENPAM_LEX_ESCAPED;
+		ls->escape = 0;
+		return (action);
+	}
+}
+
+/*
+ * A word returned by the buffer lexer.  The string is not NUL-terminated
+ * and points either into the input buffer or, if quotes or escapes had
+ * to be removed, into the lexer's scratch buffer.  Either way, it is
+ * only valid until the next call to openpam_lex_line().
+ */
+struct openpam_word {
+	const char	*str;
+	size_t		 len;
+};
+
+/*
+ * Buffer lexer
+ */
+struct openpam_lexer {
+	const char		*buf;		/* input */
+	size_t			 len;
+	size_t			 pos;
+	int			 lineno;
+	char			*scratch;	/* rewritten words */
+	size_t			 scratchlen;
+	struct openpam_word	*wordv;		/* words on current line */
+	int			 wordc;
+	int			 wordsize;
+	void			*data;		/* owned input, if any */
+	int			 mapped;
+};
+
+void openpam_lex_init(struct openpam_lexer *, const char *, size_t);
+int openpam_lex_open(struct openpam_lexer *, int);
+int openpam_lex_line(struct openpam_lexer *);
+char **openpam_lex_pack(const struct openpam_lexer *, int, int);
+void openpam_lex_fini(struct openpam_lexer *);
+
+/*
+ * Compare a word with a NUL-terminated string.
+ */
+static inline int
+openpam_wordeq(const struct openpam_word *word, const char *str)
+{
+
+	return (strlen(str) == word->len &&
+	    memcmp(word->str, str, word->len) == 0);
+}
+
+char *openpam_worddup(const struct openpam_word *);
+int openpam_wordcpy(char *, const struct openpam_word *, size_t);
+
+/*
+ * A run of consecutive lines in a buffer, and the number of lines which
+ * precede it.
+ */
+struct openpam_lexrange {
+	size_t		 offset;
+	size_t		 len;
+	int		 lineno;
+};
+
+struct stat;
+int openpam_confidx_lookup(const char *, const struct stat *,
+    const struct openpam_lexer *, const char *, struct openpam_lexrange **);
+
+#endif
@@ -39,7 +39,6 @@
 # include "config.h"
 #endif
 
-#include <dlfcn.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -56,18 +55,20 @@ openpam_load_module(const char *modulename)
 {
 	pam_module_t *module;
 
-	module = openpam_dynamic(modulename);
-	openpam_log(PAM_LOG_DEBUG, "%s dynamic %s",
-	    (module == NULL) ? "no" : "using", modulename);
-
+	module = NULL;
 #ifdef OPENPAM_STATIC_MODULES
-	/* look for a static module */
-	if (module == NULL && strchr(modulename, '/') == NULL) {
+	/* look for a static module first, it costs nothing */
+	if (strchr(modulename, '/') == NULL) {
 		module = openpam_static(modulename);
 		openpam_log(PAM_LOG_DEBUG, "%s static %s",
 		    (module == NULL) ? "no" : "using", modulename);
 	}
 #endif
+	if (module == NULL) {
+		module = openpam_dynamic(modulename);
+		openpam_log(PAM_LOG_DEBUG, "%s dynamic %s",
+		    (module == NULL) ? "no" : "using", modulename);
+	}
 	if (module == NULL) {
 		openpam_log(PAM_LOG_ERROR, "no %s found", modulename);
 		return (NULL);
@@ -76,12 +77,28 @@ openpam_load_module(const char *modulename)
 }
 
 
+/*
+ * Add a reference to a module.
+ */
+
+void
+openpam_retain_module(pam_module_t *module)
+{
+
+	if (module == NULL)
+		return;
+	if (module->dlh == NULL)
+		/* static module */
+		return;
+	openpam_dynamic_retain(module);
+}
+
+
 /*
  * Release a module.
- * XXX highly thread-unsafe
  */
 
-static void
+void
 openpam_release_module(pam_module_t *module)
 {
 
@@ -90,33 +107,218 @@ openpam_release_module(pam_module_t *module)
 	if (module->dlh == NULL)
 		/* static module */
 		return;
-	dlclose(module->dlh);
-	openpam_log(PAM_LOG_DEBUG, "releasing %s", module->path);
-	FREE(module->path);
-	FREE(module);
+	openpam_dynamic_release(module);
+}
+
+
+/*
+ * Keep a module loaded for the lifetime of the process.
+ */
+
+void
+openpam_pin_module(pam_module_t *module)
+{
+
+	if (module == NULL)
+		return;
+	if (module->dlh == NULL)
+		/* static module */
+		return;
+	openpam_dynamic_pin(module);
+}
+
+
+/*
+ * Set up a chain entry for the named module.  Unless OPENPAM_LAZY_MODULES
+ * is in effect, the module is loaded right away; otherwise, only its name
+ * is recorded, and it is loaded by openpam_chain_module() when needed.
+ */
+
+int
+openpam_chain_init(pam_chain_t *this, const char *modulename)
+{
+
+	if (OPENPAM_FEATURE(LAZY_MODULES)) {
+		if ((this->modname = openpam_strdup(modulename)) == NULL) {
+			openpam_log(PAM_LOG_ERROR, "malloc(): %m");
+			return (-1);
+		}
+		return (0);
+	}
+	if ((this->module = openpam_load_module(modulename)) == NULL)
+		return (-1);
+	return (0);
+}
+
+
+/*
+ * Return the module a chain entry refers to, loading it first if that
+ * was deferred.  Returns NULL if the module cannot be loaded.
+ */
+
+pam_module_t *
+openpam_chain_module(pam_chain_t *this)
+{
+
+	if (this->module == NULL && this->modname != NULL) {
+		this->module = openpam_load_module(this->modname);
+		if (this->module != NULL)
+			FREE(this->modname);
+	}
+	return (this->module);
+}
+
+
+/*
+ * Release what a chain entry refers to: its options, and either its
+ * module or the name of the module it has yet to load.
+ */
+
+void
+openpam_chain_fini(pam_chain_t *this)
+{
+
+	FREE(this->guards);
+	FREE(this->guardv);
+	FREE(this->optidx);
+	FREE(this->optv);
+	FREE(this->modname);
+	openpam_release_module(this->module);
+	this->module = NULL;
 }
 
 
 /*
- * Destroy a chain, freeing all its links and releasing the modules
- * they point to.
+ * Count the entries in a chain.
+ */
+
+int
+openpam_chain_length(const pam_chain_t *chain)
+{
+	int n;
+
+	if (chain == NULL)
+		return (0);
+	for (n = 0; !OPENPAM_CHAIN_END(&chain[n]); ++n)
+		/* nothing */ ;
+	return (n);
+}
+
+
+/*
+ * Make room for the given number of entries at the end of a chain, and
+ * return a pointer to the first of them.  The new entries are zeroed, so
+ * the chain is unchanged until they are filled in.  Returns NULL on
+ * failure.
+ */
+
+static pam_chain_t *
+openpam_chain_grow(pam_chain_t **chainp, int n)
+{
+	pam_chain_t *chain;
+	int len;
+
+	len = openpam_chain_length(*chainp);
+	chain = openpam_realloc(*chainp, (len + n + 1) * sizeof *chain);
+	if (chain == NULL) {
+		openpam_log(PAM_LOG_ERROR, "malloc(): %m");
+		return (NULL);
+	}
+	memset(&chain[len], 0, (n + 1) * sizeof *chain);
+	*chainp = chain;
+	return (&chain[len]);
+}
+
+
+/*
+ * Add an entry to the end of a chain, taking over what it refers to, and
+ * fill in its action table unless it came with one.  Returns 0 on success
+ * and -1 on failure, in which case the entry is left to the caller.
+ */
+
+int
+openpam_chain_append(pam_chain_t **chainp, const pam_chain_t *entry)
+{
+	pam_chain_t *this;
+
+	if ((this = openpam_chain_grow(chainp, 1)) == NULL)
+		return (-1);
+	*this = *entry;
+	if (this->flag != PAM_CUSTOM_CONTROL)
+		openpam_chain_actions(this);
+	return (0);
+}
+
+
+/*
+ * Destroy a chain, releasing the modules its entries point to.
  */
 
 static void
 openpam_destroy_chain(pam_chain_t *chain)
 {
+	pam_chain_t *this;
 
 	if (chain == NULL)
 		return;
-	openpam_destroy_chain(chain->next);
-	chain->next = NULL;
-	FREEV(chain->optc, chain->optv);
-	openpam_release_module(chain->module);
-	chain->module = NULL;
+	for (this = chain; !OPENPAM_CHAIN_END(this); ++this)
+		openpam_chain_fini(this);
 	FREE(chain);
 }
 
 
+/*
+ * Append a copy of a chain to another, adding references to the modules
+ * it points to.  Returns 0 on success and -1 on failure, in which case
+ * nothing is copied.
+ */
+
+int
+openpam_copy_chain(pam_chain_t **dst, const pam_chain_t *src)
+{
+	pam_chain_t *copy;
+	int i, n;
+
+	if ((n = openpam_chain_length(src)) == 0)
+		return (0);
+	if ((copy = openpam_chain_grow(dst, n)) == NULL)
+		return (-1);
+	for (i = 0; i < n; ++i) {
+		copy[i].module = src[i].module;
+		openpam_retain_module(copy[i].module);
+		if (src[i].modname != NULL &&
+		    (copy[i].modname = openpam_strdup(src[i].modname)) == NULL)
+			goto fail;
+		copy[i].flag = src[i].flag;
+		memcpy(copy[i].action, src[i].action, sizeof copy[i].action);
+		memcpy(copy[i].skip, src[i].skip, sizeof copy[i].skip);
+		copy[i].optv = openpam_packv(src[i].optc, src[i].optv);
+		if (copy[i].optv == NULL)
+			goto fail;
+		copy[i].optc = src[i].optc;
+		copy[i].optidx = openpam_optidx(copy[i].optc, copy[i].optv);
+		if (src[i].guardc == 0)
+			continue;
+		copy[i].guardv = openpam_packv(src[i].guardc, src[i].guardv);
+		if (copy[i].guardv == NULL)
+			goto fail;
+		copy[i].guardc = src[i].guardc;
+		copy[i].guards = openpam_guards(copy[i].guardc,
+		    copy[i].guardv);
+		if (copy[i].guards == NULL)
+			goto fail;
+	}
+	return (0);
+fail:
+	openpam_log(PAM_LOG_ERROR, "malloc(): %m");
+	/* the last entry may be incomplete, but is not yet the end */
+	for (n = i + 1, i = 0; i < n; ++i)
+		openpam_chain_fini(&copy[i]);
+	memset(copy, 0, n * sizeof *copy);
+	return (-1);
+}
+
+
 /*
  * Clear the chains and release the modules
  */
@@ -125,7 +125,7 @@ _openpam_log(int level, const char *func, const char *fmt, ...)
 	if (asprintf(&format, "in %s(): %s", func, fmt) > 0) {
 		errno = serrno;
 		vsyslog(priority, format, ap);
-		FREE(format);
+		free(format);
 	} else {
 		errno = serrno;
 		vsyslog(priority, fmt, ap);
@@ -0,0 +1,164 @@
+/*-
+ * Copyright (c) 2026 Dag-Erling Smørgrav
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote
+ *    products derived from this software without specific prior written
+ *    permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $OpenPAM$
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <string.h>
+
+#include <security/pam_appl.h>
+
+#include "openpam_impl.h"
+
+/*
+ * Well-known options, in the same order as their OPENPAM_OPT_* bits
+ */
+static const char *openpam_optflag_name[] = {
+	"debug",
+	"echo_pass",
+	"try_first_pass",
+	"use_first_pass",
+	NULL
+};
+
+/*
+ * Compare a name of the given length to an index entry's name.
+ */
+static int
+openpam_optcmp(const char *name, size_t len, const pam_option_t *opt)
+{
+	int r;
+
+	r = memcmp(name, opt->name, len < opt->len ? len : opt->len);
+	if (r == 0 && len != opt->len)
+		r = len < opt->len ? -1 : 1;
+	return (r);
+}
+
+/*
+ * OpenPAM internal
+ *
+ * Build an index of the given options.  Returns NULL if memory is short,
+ * in which case the options will simply be searched the slow way.
+ */
+
+pam_optidx_t *
+openpam_optidx(int optc, char **optv)
+{
+	pam_optidx_t *idx;
+	pam_option_t opt;
+	const char *p;
+	int i, j;
+
+	idx = openpam_malloc(sizeof *idx + optc * sizeof *idx->optv);
+	if (idx == NULL)
+		return (NULL);
+	idx->flags = 0;
+	idx->optc = optc;
+	for (i = 0; i < optc; ++i) {
+		opt.name = optv[i];
+		if ((p = strchr(optv[i], '=')) != NULL) {
+			opt.len = (size_t)(p - optv[i]);
+			opt.value = p + 1;
+		} else {
+			opt.len = strlen(optv[i]);
+			opt.value = optv[i] + opt.len;
+		}
+		for (j = 0; openpam_optflag_name[j] != NULL; ++j)
+			if (openpam_optcmp(openpam_optflag_name[j],
+			    strlen(openpam_optflag_name[j]), &opt) == 0)
+				idx->flags |= 1U << j;
+		/* insertion sort; there are rarely more than a handful */
+		for (j = i; j > 0 &&
+		    openpam_optcmp(opt.name, opt.len, &idx->optv[j - 1]) < 0;
+		    --j)
+			idx->optv[j] = idx->optv[j - 1];
+		idx->optv[j] = opt;
+	}
+	return (idx);
+}
+
+/*
+ * OpenPAM internal
+ *
+ * Look up an option in an index.  Returns its value, which is an empty
+ * string if it has none, or NULL if it is not set.
+ */
+
+const char *
+openpam_optidx_find(const pam_optidx_t *idx, const char *option)
+{
+	size_t len;
+	int lo, hi, mid;
+
+	len = strlen(option);
+	/* find the first entry which is not less than the option */
+	for (lo = 0, hi = idx->optc; lo < hi; ) {
+		mid = lo + (hi - lo) / 2;
+		if (openpam_optcmp(option, len, &idx->optv[mid]) > 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (lo < idx->optc &&
+	    openpam_optcmp(option, len, &idx->optv[lo]) == 0)
+		return (idx->optv[lo].value);
+	return (NULL);
+}
+
+/*
+ * OpenPAM internal
+ *
+ * Check whether any of the given well-known options is set for the
+ * currently executing module.
+ */
+
+int
+openpam_get_option_flag(pam_handle_t *pamh, unsigned int flag)
+{
+	pam_optidx_t *idx;
+	int i;
+
+	if (pamh->current == NULL)
+		return (0);
+	if ((idx = openpam_chain_optidx(pamh, pamh->current)) != NULL)
+		return ((idx->flags & flag) != 0);
+	for (i = 0; openpam_optflag_name[i] != NULL; ++i)
+		if ((flag & 1U << i) && openpam_get_option(pamh,
+		    openpam_optflag_name[i]) != NULL)
+			return (1);
+	return (0);
+}
+
+/*
+ * NOPARSE
+ */
@@ -0,0 +1,139 @@
+/*-
+ * Copyright (c) 2026 Dag-Erling Smørgrav
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote
+ *    products derived from this software without specific prior written
+ *    permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $OpenPAM$
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdlib.h>
+
+#include <security/pam_appl.h>
+#include <security/openpam.h>
+
+#include "openpam_impl.h"
+
+static const struct pam_conv openpam_preload_conv = {
+	openpam_nullconv,
+	NULL
+};
+
+/*
+ * Load the policy for one service and every module it references, and
+ * pin the modules.
+ */
+static int
+openpam_preload_service(const char *service)
+{
+	pam_handle_t *pamh;
+	pam_chain_t *chain;
+	int fclt, r;
+
+	r = pam_start(service, NULL, &openpam_preload_conv, &pamh);
+	if (r != PAM_SUCCESS)
+		return (r);
+	for (fclt = 0; fclt < PAM_NUM_FACILITIES; ++fclt) {
+		for (chain = pamh->chains[fclt];
+		     chain != NULL && !OPENPAM_CHAIN_END(chain); ++chain) {
+			if (openpam_chain_module(chain) == NULL)
+				r = PAM_SYSTEM_ERR;
+			else
+				openpam_pin_module(chain->module);
+		}
+	}
+	pam_end(pamh, r);
+	return (r);
+}
+
+/*
+ * OpenPAM extension
+ *
+ * Load policies and modules ahead of time
+ */
+
+int
+openpam_preload(const char **services, int *status)
+{
+	int i, r, ret;
+
+	ENTER();
+	ret = PAM_SUCCESS;
+	for (i = 0; services[i] != NULL; ++i) {
+		r = openpam_preload_service(services[i]);
+		openpam_log(r == PAM_SUCCESS ? PAM_LOG_DEBUG : PAM_LOG_ERROR,
+		    "preloading %s: %s", services[i], pam_strerror(NULL, r));
+		if (status != NULL)
+			status[i] = r;
+		if (ret == PAM_SUCCESS)
+			ret = r;
+	}
+	RETURNC(ret);
+}
+
+/*
+ * Error codes:
+ *
+ *	=pam_start
+ *	PAM_SYSTEM_ERR
+ */
+
+/**
+ * The =openpam_preload function loads the policies for each of the
+ * services listed in the =services array, which must be terminated by a
+ * null pointer, along with every module they reference, so that the cost
+ * of doing so is not incurred later by the first transaction for each
+ * service.
+ * It is intended for servers which fork a new process for each client,
+ * or otherwise serve many clients over a long period of time, to call at
+ * startup.
+ *
+ * Policies are processed exactly as =pam_start would, including any
+ * policies they include and the "other" policy, and modules are checked
+ * according to the =OPENPAM_VERIFY_MODULE_FILE feature and loaded even
+ * if the =OPENPAM_LAZY_MODULES feature is enabled.
+ * The modules then remain loaded for the lifetime of the process.
+ * The parsed policies are only retained if the =OPENPAM_CACHE_POLICY
+ * feature is enabled.
+ *
+ * If =status is not =NULL, it must point to an array with at least as
+ * many elements as =services, which receives the result of preloading
+ * each service: =PAM_SUCCESS if the service was fully preloaded, or the
+ * error code which =pam_start would have returned for it, or
+ * =PAM_SYSTEM_ERR if one of its modules could not be loaded.
+ * =openpam_preload itself returns =PAM_SUCCESS if every service was fully
+ * preloaded, and the error code for the first one which was not
+ * otherwise.
+ *
+ * >openpam_check_modules
+ * >openpam_set_feature
+ * >pam_start
+ *
+ * AUTHOR DES
+ */
@@ -102,7 +102,7 @@ openpam_readline(FILE *f, int *lineno, size_t *lenp)
 		*lenp = len;
 	return (line);
 fail:
-	FREE(line);
+	free(line);
 	return (NULL);
 }
 
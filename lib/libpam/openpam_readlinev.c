@@ -151,6 +151,7 @@ openpam_readlinev(FILE *f, int *lineno, int *lenp)
  *    a non-zero value.
  *
  * >openpam_readline
+ * >openpam_readlinev_packed
  * >openpam_readword
  *
  * AUTHOR DES
@@ -0,0 +1,177 @@
+/*-
+ * Copyright (c) 2026 Dag-Erling Smørgrav
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote
+ *    products derived from this software without specific prior written
+ *    permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $OpenPAM$
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <security/pam_appl.h>
+
+#include "openpam_impl.h"
+#include "openpam_lex.h"
+
+/*
+ * OpenPAM extension
+ *
+ * Read a line from a file and split it into words, returning the words
+ * and the array that points to them in a single allocation.
+ */
+
+char **
+openpam_readlinev_packed(FILE *f, int *lineno, int *lenp)
+{
+	struct openpam_lexstate ls;
+	char *buf, **wordv, *p;
+	size_t size, len;
+	int action, ch, i, inword, serrno, wordc;
+
+	errno = 0;
+	memset(&ls, 0, sizeof ls);
+	buf = NULL;
+	size = len = 0;
+	inword = wordc = 0;
+	for (;;) {
+		ch = getc(f);
+		if (ch == EOF && ferror(f))
+			goto fail;
+		action = openpam_lexch(&ls, ch);
+		if (!inword && (action == OPENPAM_LEX_CHAR ||
+		    action == OPENPAM_LEX_ESCAPED ||
+		    action == OPENPAM_LEX_OPEN)) {
+			/* start of a new word */
+			inword = 1;
+			++wordc;
+		}
+		switch (action) {
+		case OPENPAM_LEX_SKIP:
+		case OPENPAM_LEX_OPEN:
+			break;
+		case OPENPAM_LEX_ESCAPED:
+			if (openpam_straddch(&buf, &size, &len, '\\') != 0)
+				goto nomem;
+			/* fall through */
+		case OPENPAM_LEX_CHAR:
+			if (openpam_straddch(&buf, &size, &len, ch) != 0)
+				goto nomem;
+			break;
+		case OPENPAM_LEX_END:
+			/* append a placeholder and turn it into a separator */
+			if (openpam_straddch(&buf, &size, &len, ' ') != 0)
+				goto nomem;
+			buf[len - 1] = '\0';
+			memset(&ls, 0, sizeof ls);
+			inword = 0;
+			ungetc(ch, f);
+			continue;
+		case OPENPAM_LEX_EOL:
+		case OPENPAM_LEX_EOF:
+			goto done;
+		default:
+			/* missing escaped character or closing quote */
+			openpam_log(PAM_LOG_DEBUG, "unexpected end of file");
+			errno = EINVAL;
+			goto fail;
+		}
+		if (lineno != NULL && ch == '\n')
+			++*lineno;
+	}
+done:
+	if (ch == EOF && wordc == 0) {
+		free(buf);
+		return (NULL);
+	}
+	if (ch == '\n' && lineno != NULL)
+		++*lineno;
+	if ((wordv = malloc((wordc + 1) * sizeof *wordv + len)) == NULL) {
+		openpam_log(PAM_LOG_ERROR, "malloc(): %m");
+		goto nomem;
+	}
+	p = (char *)(wordv + wordc + 1);
+	if (len > 0)
+		memcpy(p, buf, len);
+	for (i = 0; i < wordc; ++i) {
+		wordv[i] = p;
+		p += strlen(p) + 1;
+	}
+	wordv[wordc] = NULL;
+	free(buf);
+	if (lenp != NULL)
+		*lenp = wordc;
+	return (wordv);
+nomem:
+	errno = ENOMEM;
+fail:
+	serrno = errno;
+	free(buf);
+	errno = serrno;
+	return (NULL);
+}
+
+/**
+ * The =openpam_readlinev_packed function reads a line from a file and
+ * splits it into words exactly like =openpam_readlinev, but returns the
+ * array of pointers and the words themselves in a single dynamically
+ * allocated block.
+ *
+ * The =lineno and =lenp arguments have the same meaning as for
+ * =openpam_readlinev.
+ *
+ * RETURN VALUES
+ *
+ * If successful, the =openpam_readlinev_packed function returns a pointer
+ * to a dynamically allocated array of pointers to NUL-terminated strings,
+ * each containing a single word, in the order in which they were
+ * encountered on the line.
+ * The array is terminated by a =NULL pointer.
+ * The strings are stored in the same allocation, immediately following
+ * the array.
+ *
+ * The caller is responsible for releasing the array by passing it to
+ * =!free.
+ * The individual strings must not be freed.
+ *
+ * If the end of the line was reached before any words were read,
+ * =openpam_readlinev_packed returns a pointer to a dynamically allocated
+ * array containing a single =NULL pointer.
+ *
+ * The =openpam_readlinev_packed function can fail and return =NULL for
+ * the same reasons as =openpam_readlinev.
+ *
+ * >openpam_readlinev
+ * >openpam_readword
+ *
+ * AUTHOR DES
+ */
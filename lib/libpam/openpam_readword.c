@@ -36,13 +36,12 @@
 #include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <security/pam_appl.h>
 
 #include "openpam_impl.h"
-#include "openpam_ctype.h"
-
-#define MIN_WORD_SIZE	32
+#include "openpam_lex.h"
 
 /*
  * OpenPAM extension
@@ -53,96 +52,63 @@
 char *
 openpam_readword(FILE *f, int *lineno, size_t *lenp)
 {
+	struct openpam_lexstate ls;
 	char *word;
 	size_t size, len;
-	int ch, escape, quote;
-	int serrno;
+	int ch, serrno;
 
 	errno = 0;
-
-	/* skip initial whitespace */
-	escape = quote = 0;
-	while ((ch = getc(f)) != EOF) {
-		if (ch == '\n') {
-			/* either EOL or line continuation */
-			if (!escape)
-				break;
-			if (lineno != NULL)
-				++*lineno;
-			escape = 0;
-		} else if (escape) {
-			/* escaped something else */
-			break;
-		} else if (ch == '#') {
-			/* comment: until EOL, no continuation */
-			while ((ch = getc(f)) != EOF)
-				if (ch == '\n')
-					break;
-			break;
-		} else if (ch == '\\') {
-			escape = 1;
-		} else if (!is_ws(ch)) {
-			break;
-		}
-	}
-	if (ch == EOF)
-		return (NULL);
-	ungetc(ch, f);
-	if (ch == '\n')
-		return (NULL);
-
+	memset(&ls, 0, sizeof ls);
 	word = NULL;
 	size = len = 0;
-	while ((ch = fgetc(f)) != EOF && (!is_ws(ch) || quote || escape)) {
-		if (ch == '\\' && !escape && quote != '\'') {
-			/* escape next character */
-			escape = ch;
-		} else if ((ch == '\'' || ch == '"') && !quote && !escape) {
-			/* begin quote */
-			quote = ch;
+	for (;;) {
+		ch = getc(f);
+		if (ch == EOF && ferror(f)) {
+			serrno = errno;
+			free(word);
+			errno = serrno;
+			return (NULL);
+		}
+		switch (openpam_lexch(&ls, ch)) {
+		case OPENPAM_LEX_SKIP:
+			break;
+		case OPENPAM_LEX_OPEN:
 			/* edge case: empty quoted string */
 			if (openpam_straddch(&word, &size, &len, 0) != 0)
-				return (NULL);
-		} else if (ch == quote && !escape) {
-			/* end quote */
-			quote = 0;
-		} else if (ch == '\n' && escape) {
-			/* line continuation */
-			escape = 0;
-		} else {
-			if (escape && quote && ch != '\\' && ch != quote &&
-			    openpam_straddch(&word, &size, &len, '\\') != 0) {
-				free(word);
-				errno = ENOMEM;
-				return (NULL);
-			}
-			if (openpam_straddch(&word, &size, &len, ch) != 0) {
-				free(word);
-				errno = ENOMEM;
-				return (NULL);
-			}
-			escape = 0;
+				goto nomem;
+			break;
+		case OPENPAM_LEX_ESCAPED:
+			if (openpam_straddch(&word, &size, &len, '\\') != 0)
+				goto nomem;
+			/* fall through */
+		case OPENPAM_LEX_CHAR:
+			if (openpam_straddch(&word, &size, &len, ch) != 0)
+				goto nomem;
+			break;
+		case OPENPAM_LEX_END:
+			ungetc(ch, f);
+			if (lenp != NULL)
+				*lenp = len;
+			return (word);
+		case OPENPAM_LEX_EOL:
+			ungetc(ch, f);
+			/* fall through */
+		case OPENPAM_LEX_EOF:
+			return (NULL);
+		default:
+			/* missing escaped character or closing quote */
+			openpam_log(PAM_LOG_DEBUG, "unexpected end of file");
+			free(word);
+			errno = EINVAL;
+			return (NULL);
 		}
 		if (lineno != NULL && ch == '\n')
 			++*lineno;
 	}
-	if (ch == EOF && ferror(f)) {
-		serrno = errno;
-		free(word);
-		errno = serrno;
-		return (NULL);
-	}
-	if (ch == EOF && (escape || quote)) {
-		/* Missing escaped character or closing quote. */
-		openpam_log(PAM_LOG_DEBUG, "unexpected end of file");
-		free(word);
-		errno = EINVAL;
-		return (NULL);
-	}
-	ungetc(ch, f);
-	if (lenp != NULL)
-		*lenp = len;
-	return (word);
+nomem:
+	free(word);
+	errno = ENOMEM;
+	return (NULL);
 }
 
 /**
@@ -0,0 +1,109 @@
+/*-
+ * Copyright (c) 2026 Dag-Erling Smørgrav
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote
+ *    products derived from this software without specific prior written
+ *    permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $OpenPAM$
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdlib.h>
+
+#include <security/pam_appl.h>
+#include <security/openpam.h>
+
+#include "openpam_impl.h"
+
+/*
+ * OpenPAM extension
+ *
+ * Prepare a PAM context for a new transaction
+ */
+
+int
+openpam_reset(pam_handle_t *pamh,
+	const char *user)
+{
+	pam_data_t *dp;
+	int i;
+
+	ENTER();
+	if (pamh == NULL)
+		RETURNC(PAM_BAD_HANDLE);
+
+	/* clear module data */
+	while ((dp = pamh->module_data) != NULL) {
+		if (dp->cleanup)
+			(dp->cleanup)(pamh, dp->data, PAM_SUCCESS);
+		pamh->module_data = dp->next;
+	}
+
+	/* clear environment, but keep the list for the next transaction */
+	pamh->env_count = 0;
+
+	/* clear items, except those which describe the context itself */
+	for (i = 0; i < PAM_NUM_ITEMS; ++i)
+		if (!OPENPAM_PRESET_ITEM(i))
+			pamh->item[i] = NULL;
+
+	/* wipe the memory all of the above lived in, and keep it */
+	openpam_arena_clear(pamh, 1);
+	RETURNC(pam_set_item(pamh, PAM_USER, user));
+}
+
+/*
+ * Error codes:
+ *
+ *	=pam_set_item
+ *	PAM_BAD_HANDLE
+ */
+
+/**
+ * The =openpam_reset function prepares the PAM context =pamh for a new
+ * transaction, as if it had been freshly created by =pam_start with the
+ * same service and conversation function and with =user as the target
+ * user.
+ *
+ * All module data is cleared, invoking cleanup functions as =pam_end
+ * would, with =PAM_SUCCESS as the status.
+ * The environment list is emptied, and every item other than
+ * =PAM_SERVICE, =PAM_HOST and =PAM_CONV is cleared; sensitive items
+ * such as =PAM_AUTHTOK are overwritten before their memory is released.
+ *
+ * The policy is not reloaded, and modules which have already been
+ * loaded remain so.
+ * Applications which run many short transactions for the same service,
+ * such as authentication servers, can thus reuse a single context
+ * instead of calling =pam_start and =pam_end for each one.
+ *
+ * >pam_end
+ * >pam_start
+ *
+ * AUTHOR DES
+ */
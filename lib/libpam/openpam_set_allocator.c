@@ -0,0 +1,271 @@
+/*-
+ * Copyright (c) 2026 Dag-Erling Smørgrav
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote
+ *    products derived from this software without specific prior written
+ *    permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $OpenPAM$
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <security/pam_appl.h>
+#include <security/openpam.h>
+
+#include "openpam_impl.h"
+
+/*
+ * The allocator in use, or NULL for the C library's.  When a custom
+ * allocator is in use, each block is preceded by its size, so that it
+ * can be passed back when the block is freed.
+ */
+static struct openpam_allocator openpam_allocator_store;
+static const struct openpam_allocator *openpam_allocator;
+
+/*
+ * Set once the library has allocated memory.  Any thread may be the
+ * first to do so; the flag is tested before it is set so that its cache
+ * line is not written to on every allocation.
+ */
+static atomic_int openpam_allocated;
+
+static inline void
+openpam_set_allocated(void)
+{
+
+	if (!atomic_load_explicit(&openpam_allocated, memory_order_relaxed))
+		atomic_store_explicit(&openpam_allocated, 1,
+		    memory_order_relaxed);
+}
+
+union openpam_alloc_hdr {
+	size_t		 size;
+	long double	 ld;
+	long long	 ll;
+	void		*p;
+};
+#define OPENPAM_ALLOC_HDR	sizeof(union openpam_alloc_hdr)
+
+/*
+ * OpenPAM internal
+ *
+ * Allocate memory using the selected allocator.
+ */
+
+void *
+openpam_malloc(size_t size)
+{
+	const struct openpam_allocator *oa;
+	union openpam_alloc_hdr *hdr;
+
+	openpam_set_allocated();
+	if ((oa = openpam_allocator) == NULL)
+		return (malloc(size));
+	if (size > SIZE_MAX - OPENPAM_ALLOC_HDR)
+		return (NULL);
+	if ((hdr = oa->alloc_func(OPENPAM_ALLOC_HDR + size, oa->arg)) == NULL)
+		return (NULL);
+	hdr->size = size;
+	return (hdr + 1);
+}
+
+/*
+ * OpenPAM internal
+ *
+ * Allocate zeroed memory for an array using the selected allocator.
+ */
+
+void *
+openpam_calloc(size_t nmemb, size_t size)
+{
+	void *p;
+
+	if (openpam_allocator == NULL) {
+		openpam_set_allocated();
+		return (calloc(nmemb, size));
+	}
+	if (size != 0 && nmemb > SIZE_MAX / size)
+		return (NULL);
+	if ((p = openpam_malloc(nmemb * size)) != NULL)
+		memset(p, 0, nmemb * size);
+	return (p);
+}
+
+/*
+ * OpenPAM internal
+ *
+ * Resize memory allocated using the selected allocator.
+ */
+
+void *
+openpam_realloc(void *p, size_t size)
+{
+	const struct openpam_allocator *oa;
+	union openpam_alloc_hdr *hdr;
+	void *q;
+
+	if ((oa = openpam_allocator) == NULL) {
+		openpam_set_allocated();
+		return (realloc(p, size));
+	}
+	if (p == NULL)
+		return (openpam_malloc(size));
+	hdr = (union openpam_alloc_hdr *)p - 1;
+	if (oa->realloc_func == NULL) {
+		if ((q = openpam_malloc(size)) == NULL)
+			return (NULL);
+		memcpy(q, p, hdr->size < size ? hdr->size : size);
+		openpam_free(p);
+		return (q);
+	}
+	if (size > SIZE_MAX - OPENPAM_ALLOC_HDR)
+		return (NULL);
+	if ((hdr = oa->realloc_func(hdr, OPENPAM_ALLOC_HDR + hdr->size,
+	    OPENPAM_ALLOC_HDR + size, oa->arg)) == NULL)
+		return (NULL);
+	hdr->size = size;
+	return (hdr + 1);
+}
+
+/*
+ * OpenPAM internal
+ *
+ * Duplicate a string using the selected allocator.
+ */
+
+char *
+openpam_strdup(const char *str)
+{
+	size_t len;
+	char *p;
+
+	len = strlen(str) + 1;
+	if ((p = openpam_malloc(len)) != NULL)
+		memcpy(p, str, len);
+	return (p);
+}
+
+/*
+ * OpenPAM internal
+ *
+ * Free memory allocated using the selected allocator.
+ */
+
+void
+openpam_free(void *p)
+{
+	const struct openpam_allocator *oa;
+	union openpam_alloc_hdr *hdr;
+
+	if ((oa = openpam_allocator) == NULL) {
+		free(p);
+		return;
+	}
+	if (p == NULL)
+		return;
+	hdr = (union openpam_alloc_hdr *)p - 1;
+	oa->free_func(hdr, OPENPAM_ALLOC_HDR + hdr->size, oa->arg);
+}
+
+/*
+ * OpenPAM extension
+ *
+ * Select the memory allocator used by the library
+ */
+
+int
+openpam_set_allocator(const struct openpam_allocator *allocator)
+{
+
+	ENTER();
+	if (atomic_load_explicit(&openpam_allocated, memory_order_relaxed))
+		RETURNC(PAM_SYSTEM_ERR);
+	if (allocator == NULL) {
+		openpam_allocator = NULL;
+		RETURNC(PAM_SUCCESS);
+	}
+	if (allocator->alloc_func == NULL || allocator->free_func == NULL)
+		RETURNC(PAM_SYSTEM_ERR);
+	openpam_allocator_store = *allocator;
+	openpam_allocator = &openpam_allocator_store;
+	RETURNC(PAM_SUCCESS);
+}
+
+/*
+ * Error codes:
+ *
+ *	PAM_SYSTEM_ERR
+ */
+
+/**
+ * EXPERIMENTAL
+ *
+ * The =openpam_set_allocator function selects the functions the library
+ * uses to allocate and free the memory it uses internally.
+ * The =allocator argument points to a structure which is copied by the
+ * library, and which has the following members:
+ *
+ *	alloc_func:
+ *		Called with the number of bytes needed and the value of the
+ *		:arg member; returns a pointer to suitably aligned memory,
+ *		or =NULL on failure.
+ *	realloc_func:
+ *		Called with a pointer to a block, its current size, the
+ *		number of bytes needed and the value of the :arg member;
+ *		returns a pointer to the resized block, or =NULL on failure,
+ *		in which case the original block is left untouched.
+ *		This member may be =NULL, in which case blocks are resized
+ *		by allocating a new block and freeing the old.
+ *	free_func:
+ *		Called with a pointer to a block, its size and the value of
+ *		the :arg member.
+ *	arg:
+ *		An opaque pointer which is passed to the above functions.
+ *
+ * If =allocator is =NULL, the C library's allocator is used, which is
+ * also the default.
+ *
+ * The allocator can only be changed before the library allocates any
+ * memory, i.e. before the first call to =pam_start or to any other
+ * function which may allocate memory; in practice, this means it must
+ * be selected right at the start of the program.
+ * The =openpam_set_allocator function is not thread-safe: it must not be
+ * called while another thread may be calling into the library.
+ *
+ * Memory which is returned to the application or to a module and which
+ * the caller is expected to release with =free, such as the results of
+ * =pam_getenvlist or =openpam_readline, and memory the library receives
+ * from the conversation function, is always allocated with the C
+ * library's allocator.
+ *
+ * AUTHOR DES
+ */
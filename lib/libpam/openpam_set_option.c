@@ -62,48 +62,62 @@ openpam_set_option(pam_handle_t *pamh,
 	const char *value)
 {
 	pam_chain_t *cur;
-	char *opt, **optv;
+	char *opt, **curv, **optv, **tmpv;
 	size_t len;
-	int i;
+	int curc, i, optc;
 
 	ENTERS(option);
 	if (pamh == NULL || pamh->current == NULL || option == NULL)
 		RETURNC(PAM_SYSTEM_ERR);
 	cur = pamh->current;
+	curv = openpam_chain_optv(pamh, cur, &curc);
 	for (len = 0; option[len] != '\0'; ++len)
 		if (option[len] == '=')
 			break;
-	for (i = 0; i < cur->optc; ++i) {
-		if (strncmp(cur->optv[i], option, len) == 0 &&
-		    (cur->optv[i][len] == '\0' || cur->optv[i][len] == '='))
+	for (i = 0; i < curc; ++i) {
+		if (strncmp(curv[i], option, len) == 0 &&
+		    (curv[i][len] == '\0' || curv[i][len] == '='))
 			break;
 	}
 	if (value == NULL) {
-		/* remove */
-		if (i == cur->optc)
+		if (i == curc)
 			RETURNC(PAM_SUCCESS);
-		for (free(cur->optv[i]); i < cur->optc; ++i)
-			cur->optv[i] = cur->optv[i + 1];
-		cur->optv[i] = NULL;
-		RETURNC(PAM_SUCCESS);
+		if (pamh->parent == NULL) {
+			/* the strings stay put, only the pointers move */
+			for (--cur->optc; i < cur->optc; ++i)
+				cur->optv[i] = cur->optv[i + 1];
+			cur->optv[i] = NULL;
+			FREE(cur->optidx);
+			cur->optidx = openpam_optidx(cur->optc, cur->optv);
+			RETURNC(PAM_SUCCESS);
+		}
+		/* a clone must not touch the template's copy */
+		opt = NULL;
+	} else if (asprintf(&opt, "%.*s=%s", (int)len, option, value) < 0) {
+		RETURNC(PAM_BUF_ERR);
 	}
-	if (asprintf(&opt, "%.*s=%s", (int)len, option, value) < 0)
+	/* add, replace or remove, then repack */
+	if ((tmpv = openpam_malloc(sizeof(char *) * (curc + 2))) == NULL) {
+		free(opt);
 		RETURNC(PAM_BUF_ERR);
-	if (i == cur->optc) {
-		/* add */
-		optv = realloc(cur->optv, sizeof(char *) * (cur->optc + 2));
-		if (optv == NULL) {
-			FREE(opt);
-			RETURNC(PAM_BUF_ERR);
-		}
-		optv[i] = opt;
-		optv[i + 1] = NULL;
-		cur->optv = optv;
-		++cur->optc;
+	}
+	memcpy(tmpv, curv, sizeof(char *) * curc);
+	if (opt == NULL) {
+		optc = curc - 1;
+		memmove(tmpv + i, tmpv + i + 1, sizeof(char *) * (optc - i));
 	} else {
-		/* replace */
-		FREE(cur->optv[i]);
-		cur->optv[i] = opt;
+		optc = (i == curc) ? curc + 1 : curc;
+		tmpv[i] = opt;
+	}
+	tmpv[optc] = NULL;
+	optv = openpam_packv(optc, tmpv);
+	FREE(tmpv);
+	free(opt);
+	if (optv == NULL)
+		RETURNC(PAM_BUF_ERR);
+	if (openpam_chain_set_optv(pamh, cur, optc, optv) != 0) {
+		FREE(optv);
+		RETURNC(PAM_BUF_ERR);
 	}
 	RETURNC(PAM_SUCCESS);
 }
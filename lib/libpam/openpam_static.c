@@ -47,21 +47,40 @@
 
 #ifdef OPENPAM_STATIC_MODULES
 
+#if defined(__linux__)
+/*
+ * PAM_MODULE_ENTRY() places a pointer to each module in a section of
+ * its own, which the linker brackets with these two symbols.  They are
+ * weak so that libpam still links if no modules were linked in.
+ */
+extern pam_module_t *__start_openpam_static_modules[]
+	__attribute__((__weak__));
+extern pam_module_t *__stop_openpam_static_modules[]
+	__attribute__((__weak__));
+#define SET_FOREACH(pvar, set)						\
+	for (pvar = __start_ ## set; pvar < __stop_ ## set; ++pvar)
+#else
 SET_DECLARE(openpam_static_modules, pam_module_t);
+#endif
 
 /*
  * OpenPAM internal
  *
- * Locate a statically linked module
+ * Locate a statically linked module, either by its full name or by its
+ * name minus the shared object suffix.
  */
 
 pam_module_t *
 openpam_static(const char *path)
 {
 	pam_module_t **module;
+	size_t len;
 
+	len = strlen(path);
 	SET_FOREACH(module, openpam_static_modules) {
-		if (strcmp((*module)->path, path) == 0)
+		if (strncmp((*module)->path, path, len) == 0 &&
+		    ((*module)->path[len] == '\0' ||
+		    strcmp((*module)->path + len, PAM_SOEXT) == 0))
 			return (*module);
 	}
 	return (NULL);
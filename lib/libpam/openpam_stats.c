@@ -0,0 +1,280 @@
+/*-
+ * Copyright (c) 2026 Dag-Erling Smørgrav
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote
+ *    products derived from this software without specific prior written
+ *    permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $OpenPAM$
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <security/pam_appl.h>
+
+#include "openpam_impl.h"
+
+/*
+ * Records are never freed.  The counters are spread over a handful of
+ * shards, each thread updating only its own, so that concurrent
+ * transactions rarely contend for the same cache line.
+ */
+#define OPENPAM_STATS_SHARDS	8
+
+typedef struct pam_stats_shard pam_stats_shard_t;
+struct pam_stats_shard {
+	atomic_ulong	 calls;
+	atomic_ulong	 result[PAM_NUM_ERRORS + 1];
+	atomic_ulong	 latency[OPENPAM_STATS_BUCKETS];
+	atomic_ullong	 nsec;
+};
+
+struct pam_stats {
+	pam_stats_t	*next;
+	const char	*service;
+	const char	*module;
+	int		 facility;
+	int		 primitive;
+	pam_stats_shard_t shard[OPENPAM_STATS_SHARDS];
+};
+
+/*
+ * Statistics records, most recent first.  Records are only ever added
+ * to the head of the list, under the mutex, and never removed, so the
+ * list can be walked without holding it.
+ */
+static _Atomic(pam_stats_t *) openpam_stats_list;
+static pthread_mutex_t openpam_stats_mtx = PTHREAD_MUTEX_INITIALIZER;
+
+/* shard assigned to the current thread, plus one */
+static _Thread_local unsigned int openpam_stats_shard;
+static atomic_uint openpam_stats_nextshard;
+
+/*
+ * Look for a record in the part of the list which starts at first and
+ * ends just before last.
+ */
+static pam_stats_t *
+openpam_stats_find(pam_stats_t *first, const pam_stats_t *last,
+    int facility, int primitive, const char *service, const char *module)
+{
+	pam_stats_t *st;
+
+	for (st = first; st != last; st = st->next)
+		if (st->facility == facility && st->primitive == primitive &&
+		    strcmp(st->service, service) == 0 &&
+		    strcmp(st->module, module) == 0)
+			return (st);
+	return (NULL);
+}
+
+/*
+ * OpenPAM internal
+ *
+ * Look up the statistics record for a call to the given primitive in
+ * the given chain entry, creating it if it does not already exist.
+ * Returns NULL if statistics are disabled or memory is short.
+ */
+
+pam_stats_t *
+openpam_stats_get(pam_handle_t *pamh, pam_chain_t *chain, int facility,
+    int primitive)
+{
+	pam_stats_t *head, *st;
+	const char *module, *service;
+	size_t slen, mlen;
+
+	if (!OPENPAM_FEATURE(MODULE_STATS) ||
+	    (service = pamh->item[PAM_SERVICE]) == NULL)
+		return (NULL);
+	/*
+	 * Chains may be shared between threads, see openpam_clone(), so
+	 * there is nowhere to remember the record in.  Look it up in the
+	 * list instead, which only needs the lock if it is not there.
+	 */
+	module = chain->module->path;
+	head = atomic_load_explicit(&openpam_stats_list, memory_order_acquire);
+	st = openpam_stats_find(head, NULL, facility, primitive, service,
+	    module);
+	if (st != NULL)
+		return (st);
+	pthread_mutex_lock(&openpam_stats_mtx);
+	/* only the records added since we looked need to be checked */
+	st = openpam_stats_find(atomic_load_explicit(&openpam_stats_list,
+	    memory_order_relaxed), head, facility, primitive, service, module);
+	if (st == NULL) {
+		slen = strlen(service) + 1;
+		mlen = strlen(module) + 1;
+		st = openpam_calloc(1, sizeof *st + slen + mlen);
+		if (st == NULL) {
+			pthread_mutex_unlock(&openpam_stats_mtx);
+			return (NULL);
+		}
+		st->service = memcpy(st + 1, service, slen);
+		st->module = memcpy((char *)(st + 1) + slen, module, mlen);
+		st->facility = facility;
+		st->primitive = primitive;
+		st->next = atomic_load_explicit(&openpam_stats_list,
+		    memory_order_relaxed);
+		atomic_store_explicit(&openpam_stats_list, st,
+		    memory_order_release);
+	}
+	pthread_mutex_unlock(&openpam_stats_mtx);
+	return (st);
+}
+
+/*
+ * OpenPAM internal
+ *
+ * Record the outcome of a module call which started at the given time.
+ */
+
+void
+openpam_stats_update(pam_stats_t *st, int r, const struct timespec *start)
+{
+	pam_stats_shard_t *sh;
+	struct timespec now;
+	unsigned long long nsec, usec;
+	int b;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	nsec = (unsigned long long)(now.tv_sec - start->tv_sec) *
+	    1000000000ULL + now.tv_nsec - start->tv_nsec;
+	/* bucket 0 is under a microsecond, bucket b is [2^(b-1), 2^b) */
+	usec = nsec / 1000;
+	for (b = 0; usec > 0 && b < OPENPAM_STATS_BUCKETS - 1; usec >>= 1)
+		++b;
+	if (openpam_stats_shard == 0)
+		openpam_stats_shard = atomic_fetch_add_explicit(
+		    &openpam_stats_nextshard, 1, memory_order_relaxed) %
+		    OPENPAM_STATS_SHARDS + 1;
+	sh = &st->shard[openpam_stats_shard - 1];
+	if (r < 0 || r >= PAM_NUM_ERRORS)
+		r = PAM_NUM_ERRORS;
+	atomic_fetch_add_explicit(&sh->calls, 1, memory_order_relaxed);
+	atomic_fetch_add_explicit(&sh->result[r], 1, memory_order_relaxed);
+	atomic_fetch_add_explicit(&sh->latency[b], 1, memory_order_relaxed);
+	atomic_fetch_add_explicit(&sh->nsec, nsec, memory_order_relaxed);
+}
+
+/*
+ * OpenPAM internal
+ *
+ * Sum up the shards of every record into an array which the caller
+ * must free.  Records added while this is in progress are left out.
+ */
+
+int
+openpam_stats_export(struct openpam_stats **stats, size_t *nstats)
+{
+	struct openpam_stats *os;
+	pam_stats_shard_t *sh;
+	pam_stats_t *head, *st;
+	size_t len, n;
+	char *p;
+	int i, j;
+
+	*stats = NULL;
+	*nstats = 0;
+	head = atomic_load_explicit(&openpam_stats_list,
+	    memory_order_acquire);
+	for (len = n = 0, st = head; st != NULL; st = st->next, ++n)
+		len += strlen(st->service) + strlen(st->module) + 2;
+	if (n == 0)
+		return (PAM_SUCCESS);
+	if ((os = calloc(1, n * sizeof *os + len)) == NULL) {
+		openpam_log(PAM_LOG_ERROR, "malloc(): %m");
+		return (PAM_BUF_ERR);
+	}
+	p = (char *)(os + n);
+	for (n = 0, st = head; st != NULL; st = st->next, ++n) {
+		len = strlen(st->service) + 1;
+		os[n].service = memcpy(p, st->service, len);
+		p += len;
+		len = strlen(st->module) + 1;
+		os[n].module = memcpy(p, st->module, len);
+		p += len;
+		os[n].facility = pam_facility_name[st->facility];
+		os[n].primitive = st->primitive;
+		for (i = 0; i < OPENPAM_STATS_SHARDS; ++i) {
+			sh = &st->shard[i];
+			os[n].calls += atomic_load_explicit(&sh->calls,
+			    memory_order_relaxed);
+			for (j = 0; j <= PAM_NUM_ERRORS; ++j)
+				os[n].result[j] += atomic_load_explicit(
+				    &sh->result[j], memory_order_relaxed);
+			for (j = 0; j < OPENPAM_STATS_BUCKETS; ++j)
+				os[n].latency[j] += atomic_load_explicit(
+				    &sh->latency[j], memory_order_relaxed);
+			os[n].nsec += atomic_load_explicit(&sh->nsec,
+			    memory_order_relaxed);
+		}
+	}
+	*stats = os;
+	*nstats = n;
+	return (PAM_SUCCESS);
+}
+
+/*
+ * OpenPAM internal
+ *
+ * Clear the counters of every record.
+ */
+
+void
+openpam_stats_clear(void)
+{
+	pam_stats_shard_t *sh;
+	pam_stats_t *st;
+	int i, j;
+
+	st = atomic_load_explicit(&openpam_stats_list, memory_order_acquire);
+	for (; st != NULL; st = st->next) {
+		for (i = 0; i < OPENPAM_STATS_SHARDS; ++i) {
+			sh = &st->shard[i];
+			atomic_store_explicit(&sh->calls, 0,
+			    memory_order_relaxed);
+			for (j = 0; j <= PAM_NUM_ERRORS; ++j)
+				atomic_store_explicit(&sh->result[j], 0,
+				    memory_order_relaxed);
+			for (j = 0; j < OPENPAM_STATS_BUCKETS; ++j)
+				atomic_store_explicit(&sh->latency[j], 0,
+				    memory_order_relaxed);
+			atomic_store_explicit(&sh->nsec, 0,
+			    memory_order_relaxed);
+		}
+	}
+}
+
+/*
+ * NOPARSE
+ */
@@ -368,11 +368,11 @@ fail:
 	for (i = 0; i < n; ++i) {
 		if (aresp[i].resp != NULL) {
 			strlset(aresp[i].resp, 0, PAM_MAX_RESP_SIZE);
-			FREE(aresp[i].resp);
+			free(aresp[i].resp);
 		}
 	}
 	memset(aresp, 0, n * sizeof *aresp);
-	FREE(aresp);
+	free(aresp);
 	*resp = NULL;
 	memset(respbuf, 0, sizeof respbuf);
 	RETURNC(PAM_CONV_ERR);
@@ -0,0 +1,357 @@
+/*-
+ * Copyright (c) 2026 Dag-Erling Smørgrav
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote
+ *    products derived from this software without specific prior written
+ *    permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $OpenPAM$
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <sys/types.h>
+#ifdef HAVE_SYS_INOTIFY_H
+#include <sys/inotify.h>
+#endif
+
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <security/pam_appl.h>
+#include <security/openpam.h>
+
+#include "openpam_impl.h"
+#include "openpam_strlcpy.h"
+
+#ifdef HAVE_SYS_INOTIFY_H
+
+#define OPENPAM_WATCH_FILE \
+	(IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_MOVE_SELF | \
+	IN_DELETE_SELF)
+#define OPENPAM_WATCH_DIR \
+	(OPENPAM_WATCH_FILE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | \
+	IN_MOVED_TO | IN_ONLYDIR)
+
+/*
+ * Policy watcher.  Every file which fed a cached policy is watched, as
+ * is the directory it was found in or searched for in; if that directory
+ * does not exist, its nearest existing ancestor is watched instead.  The
+ * path under which each watch was added is recorded so that events can
+ * be matched with the cache entries they affect.
+ *
+ * The generation number changes every time the watcher is started, so
+ * that cache entries which were validated under a previous watcher are
+ * not mistaken for watched ones.
+ */
+struct openpam_watch {
+	int		 wd;
+	char		*path;
+};
+
+static pthread_mutex_t openpam_watch_mtx = PTHREAD_MUTEX_INITIALIZER;
+static int openpam_watch_fd = -1;
+static pid_t openpam_watch_pid;
+static unsigned int openpam_watch_gen;
+static struct openpam_watch *openpam_watchv;
+static int openpam_watchc;
+static int openpam_watchsize;
+
+/*
+ * Forget all watches.  Must be called with the lock held.
+ */
+static void
+openpam_watch_clear(void)
+{
+
+	while (openpam_watchc > 0) {
+		--openpam_watchc;
+		FREE(openpam_watchv[openpam_watchc].path);
+	}
+	FREE(openpam_watchv);
+	openpam_watchsize = 0;
+}
+
+/*
+ * Check whether the watcher is running in this process.  The descriptor
+ * is inherited across fork(), but the parent and child would steal each
+ * other's events, so the child must not use it.
+ */
+static int
+openpam_watch_active(void)
+{
+
+	return (openpam_watch_fd >= 0 && openpam_watch_pid == getpid());
+}
+
+/*
+ * Add a watch on a path, unless we already have one.  Must be called
+ * with the lock held.
+ */
+static int
+openpam_watch_add(const char *path, uint32_t mask)
+{
+	struct openpam_watch *w;
+	int size, wd;
+
+	for (w = openpam_watchv; w < openpam_watchv + openpam_watchc; ++w)
+		if (strcmp(w->path, path) == 0)
+			return (0);
+	if ((wd = inotify_add_watch(openpam_watch_fd, path, mask)) < 0)
+		return (-1);
+	if (openpam_watchc == openpam_watchsize) {
+		size = openpam_watchsize ? openpam_watchsize * 2 : 16;
+		w = openpam_realloc(openpam_watchv, size * sizeof *w);
+		if (w == NULL)
+			return (-1);
+		openpam_watchv = w;
+		openpam_watchsize = size;
+	}
+	w = &openpam_watchv[openpam_watchc];
+	if ((w->path = openpam_strdup(path)) == NULL)
+		return (-1);
+	w->wd = wd;
+	++openpam_watchc;
+	return (0);
+}
+
+/*
+ * Watch the directory a file is in or would be in, or if it does not
+ * exist, its nearest existing ancestor.  Must be called with the lock
+ * held.
+ */
+static int
+openpam_watch_dir(const char *path)
+{
+	char dirname[PATH_MAX];
+	char *p;
+
+	if (strlcpy(dirname, path, sizeof dirname) >= sizeof dirname) {
+		errno = ENAMETOOLONG;
+		return (-1);
+	}
+	for (;;) {
+		if ((p = strrchr(dirname, '/')) == NULL)
+			return (openpam_watch_add(".", OPENPAM_WATCH_DIR));
+		if (p == dirname)
+			return (openpam_watch_add("/", OPENPAM_WATCH_DIR));
+		*p = '\0';
+		if (openpam_watch_add(dirname, OPENPAM_WATCH_DIR) == 0)
+			return (0);
+		if (errno != ENOENT && errno != ENOTDIR)
+			return (-1);
+	}
+}
+
+/*
+ * OpenPAM internal
+ *
+ * Make sure that any change to the specified files will be noticed.
+ * Returns 0 if they are all being watched, and -1 otherwise.
+ */
+
+int
+openpam_watch_arm(const pam_file_stamp_t *stamps, int nstamps)
+{
+	int i, ret;
+
+	pthread_mutex_lock(&openpam_watch_mtx);
+	ret = openpam_watch_active() ? 0 : -1;
+	for (i = 0; i < nstamps && ret == 0; ++i) {
+		if (stamps[i].found &&
+		    openpam_watch_add(stamps[i].path, OPENPAM_WATCH_FILE) != 0)
+			ret = -1;
+		else if (openpam_watch_dir(stamps[i].path) != 0)
+			ret = -1;
+	}
+	pthread_mutex_unlock(&openpam_watch_mtx);
+	if (ret != 0)
+		openpam_log(PAM_LOG_DEBUG, "failed to watch policy: %m");
+	return (ret);
+}
+
+/*
+ * OpenPAM internal
+ *
+ * Process pending events, calling the specified function with the path
+ * to every file or directory which changed, or with NULL if events were
+ * lost.  Returns the watcher's generation number, or 0 if it is not
+ * running.
+ */
+
+unsigned int
+openpam_watch_drain(void (*changed)(const char *))
+{
+	uint32_t evbuf[1024];
+	char path[PATH_MAX];
+	const struct inotify_event *ev;
+	unsigned int gen;
+	ssize_t len;
+	char *buf, *p;
+	int i;
+
+	buf = (char *)evbuf;
+	pthread_mutex_lock(&openpam_watch_mtx);
+	if (!openpam_watch_active()) {
+		pthread_mutex_unlock(&openpam_watch_mtx);
+		return (0);
+	}
+	while ((len = read(openpam_watch_fd, buf, sizeof evbuf)) > 0) {
+		for (p = buf; p < buf + len; p += sizeof *ev + ev->len) {
+			ev = (const struct inotify_event *)(void *)p;
+			if (ev->mask & IN_Q_OVERFLOW)
+				changed(NULL);
+			for (i = 0; i < openpam_watchc; ++i) {
+				if (openpam_watchv[i].wd != ev->wd)
+					continue;
+				if (ev->len == 0)
+					changed(openpam_watchv[i].path);
+				else if (snprintf(path, sizeof path, "%s/%s",
+				    strcmp(openpam_watchv[i].path, "/") == 0 ?
+				    "" : openpam_watchv[i].path, ev->name) <
+				    (int)sizeof path)
+					changed(path);
+				else
+					changed(NULL);
+			}
+			if (ev->mask & IN_IGNORED) {
+				/* the watch is gone */
+				for (i = 0; i < openpam_watchc; ++i) {
+					if (openpam_watchv[i].wd != ev->wd)
+						continue;
+					FREE(openpam_watchv[i].path);
+					openpam_watchv[i--] =
+					    openpam_watchv[--openpam_watchc];
+				}
+			}
+		}
+	}
+	gen = openpam_watch_gen;
+	pthread_mutex_unlock(&openpam_watch_mtx);
+	return (gen);
+}
+
+#else /* !HAVE_SYS_INOTIFY_H */
+
+int
+openpam_watch_arm(const pam_file_stamp_t *stamps, int nstamps)
+{
+
+	(void)stamps;
+	(void)nstamps;
+	return (-1);
+}
+
+unsigned int
+openpam_watch_drain(void (*changed)(const char *))
+{
+
+	(void)changed;
+	return (0);
+}
+
+#endif /* HAVE_SYS_INOTIFY_H */
+
+/*
+ * OpenPAM extension
+ *
+ * Start or stop watching policy files for changes
+ */
+
+int
+openpam_watch_policy(int onoff)
+{
+
+	ENTERI(onoff);
+#ifdef HAVE_SYS_INOTIFY_H
+	pthread_mutex_lock(&openpam_watch_mtx);
+	if (onoff && !openpam_watch_active()) {
+		if (openpam_watch_fd >= 0) {
+			/* inherited from our parent */
+			close(openpam_watch_fd);
+			openpam_watch_clear();
+		}
+		openpam_watch_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+		if (openpam_watch_fd < 0) {
+			openpam_log(PAM_LOG_ERROR, "inotify_init1(): %m");
+			pthread_mutex_unlock(&openpam_watch_mtx);
+			RETURNC(PAM_SYSTEM_ERR);
+		}
+		openpam_watch_pid = getpid();
+		if (++openpam_watch_gen == 0)
+			++openpam_watch_gen;
+	} else if (!onoff && openpam_watch_fd >= 0) {
+		close(openpam_watch_fd);
+		openpam_watch_fd = -1;
+		openpam_watch_clear();
+	}
+	pthread_mutex_unlock(&openpam_watch_mtx);
+	RETURNC(PAM_SUCCESS);
+#else
+	if (onoff) {
+		openpam_log(PAM_LOG_ERROR, "policy watcher not supported");
+		RETURNC(PAM_SYSTEM_ERR);
+	}
+	RETURNC(PAM_SUCCESS);
+#endif
+}
+
+/*
+ * Error codes:
+ *
+ *	PAM_SYSTEM_ERR
+ */
+
+/**
+ * The =openpam_watch_policy function starts or stops a watcher which
+ * notices changes to policy files, as specified by the =onoff argument.
+ *
+ * The watcher only has an effect if the =OPENPAM_CACHE_POLICY feature
+ * is enabled.
+ * Without it, every time a cached policy is used, each of the files it
+ * was assembled from is checked to see whether it has changed since.
+ * With it, the files which fed a cached policy and the directories they
+ * were found or searched for in are watched, and a cached policy is only
+ * checked after one of them has actually changed.
+ *
+ * The watcher belongs to the process which started it.
+ * A child process which wishes to use it must start its own.
+ *
+ * The watcher is only available on systems which support
+ * {Xr inotify 7};
+ * elsewhere, =openpam_watch_policy fails if =onoff is non-zero.
+ *
+ * >openpam_get_feature
+ * >openpam_set_feature
+ *
+ * AUTHOR DES
+ */
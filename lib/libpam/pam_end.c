@@ -45,6 +45,42 @@
 
 #include "openpam_impl.h"
 
+/*
+ * Release whatever the handle may share with its clones or its template,
+ * and the handle itself, unless clones are still using them.
+ */
+static void
+openpam_destroy_handle(pam_handle_t *pamh)
+{
+	pam_handle_t *parent;
+	pam_overlay_t *ov;
+	int i;
+
+	if (openpam_unref_handle(pamh) > 0)
+		return;
+	parent = pamh->parent;
+
+	/* clear chains, unless they belong to the template */
+	if (parent == NULL) {
+		openpam_clear_chains(pamh->chains);
+		openpam_image_release(pamh);
+	}
+	while ((ov = pamh->overlay) != NULL) {
+		pamh->overlay = ov->next;
+		FREE(ov->optidx);
+		FREE(ov->optv);
+		FREE(ov);
+	}
+
+	/* clear remaining items */
+	for (i = 0; i < PAM_NUM_ITEMS; ++i)
+		pam_set_item(pamh, i, NULL);
+
+	FREE(pamh);
+	if (parent != NULL)
+		openpam_destroy_handle(parent);
+}
+
 /*
  * XSSO 4.2.1
  * XSSO 6 page 42
@@ -68,25 +104,22 @@ pam_end(pam_handle_t *pamh,
 		if (dp->cleanup)
 			(dp->cleanup)(pamh, dp->data, status);
 		pamh->module_data = dp->next;
-		FREE(dp->name);
-		FREE(dp);
 	}
 
 	/* clear environment */
-	while (pamh->env_count) {
-		--pamh->env_count;
-		FREE(pamh->env[pamh->env_count]);
-	}
+	pamh->env_count = 0;
 	FREE(pamh->env);
 
-	/* clear chains */
-	openpam_clear_chains(pamh->chains);
-
-	/* clear items */
+	/* clear items, except those which clones may be borrowing */
 	for (i = 0; i < PAM_NUM_ITEMS; ++i)
-		pam_set_item(pamh, i, NULL);
+		if (!OPENPAM_PRESET_ITEM(i))
+			pamh->item[i] = NULL;
 
-	FREE(pamh);
+	/* wipe and release the memory all of the above lived in */
+	openpam_arena_clear(pamh, 0);
+
+	/* clear chains and what is left, once no clone needs them */
+	openpam_destroy_handle(pamh);
 
 	RETURNC(PAM_SUCCESS);
 }
@@ -66,7 +66,7 @@ pam_error(const pam_handle_t *pamh,
 	va_start(ap, fmt);
 	r = pam_vprompt(pamh, PAM_ERROR_MSG, &rsp, fmt, ap);
 	va_end(ap);
-	FREE(rsp); /* ignore response */
+	free(rsp); /* ignore response */
 	return (r);
 }
 
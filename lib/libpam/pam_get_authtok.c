@@ -106,13 +106,14 @@ pam_get_authtok(pam_handle_t *pamh,
 	default:
 		RETURNC(PAM_BAD_CONSTANT);
 	}
-	if (openpam_get_option(pamh, "try_first_pass") ||
-	    openpam_get_option(pamh, "use_first_pass")) {
+	if (openpam_get_option_flag(pamh,
+	    OPENPAM_OPT_TRY_FIRST_PASS | OPENPAM_OPT_USE_FIRST_PASS)) {
 		r = pam_get_item(pamh, item, &prevauthtok);
 		if (r == PAM_SUCCESS && prevauthtok != NULL) {
 			*authtok = prevauthtok;
 			RETURNC(PAM_SUCCESS);
-		} else if (openpam_get_option(pamh, "use_first_pass")) {
+		} else if (openpam_get_option_flag(pamh,
+		    OPENPAM_OPT_USE_FIRST_PASS)) {
 			RETURNC(r == PAM_SUCCESS ? PAM_AUTH_ERR : r);
 		}
 	}
@@ -133,7 +134,7 @@ pam_get_authtok(pam_handle_t *pamh,
 	r = openpam_subst(pamh, prompt_buf, &prompt_size, prompt);
 	if (r == PAM_SUCCESS && prompt_size <= sizeof prompt_buf)
 		prompt = prompt_buf;
-	style = openpam_get_option(pamh, "echo_pass") ?
+	style = openpam_get_option_flag(pamh, OPENPAM_OPT_ECHO_PASS) ?
 	    PAM_PROMPT_ECHO_ON : PAM_PROMPT_ECHO_OFF;
 	r = pam_prompt(pamh, style, &resp, "%s", prompt);
 	if (r != PAM_SUCCESS)
@@ -142,21 +143,22 @@ pam_get_authtok(pam_handle_t *pamh,
 		r = pam_prompt(pamh, style, &resp2, "Retype %s", prompt);
 		if (r != PAM_SUCCESS) {
 			strlset(resp, 0, PAM_MAX_RESP_SIZE);
-			FREE(resp);
+			free(resp);
 			RETURNC(r);
 		}
 		if (strcmp(resp, resp2) != 0) {
 			strlset(resp, 0, PAM_MAX_RESP_SIZE);
-			FREE(resp);
+			free(resp);
+			resp = NULL;
 		}
 		strlset(resp2, 0, PAM_MAX_RESP_SIZE);
-		FREE(resp2);
+		free(resp2);
 	}
 	if (resp == NULL)
 		RETURNC(PAM_TRY_AGAIN);
 	r = pam_set_item(pamh, item, resp);
 	strlset(resp, 0, PAM_MAX_RESP_SIZE);
-	FREE(resp);
+	free(resp);
 	if (r != PAM_SUCCESS)
 		RETURNC(r);
 	r = pam_get_item(pamh, item, (const void **)authtok);
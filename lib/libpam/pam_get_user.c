@@ -93,7 +93,7 @@ pam_get_user(pam_handle_t *pamh,
 	if (r != PAM_SUCCESS)
 		RETURNC(r);
 	r = pam_set_item(pamh, PAM_USER, resp);
-	FREE(resp);
+	free(resp);
 	if (r != PAM_SUCCESS)
 		RETURNC(r);
 	r = pam_get_item(pamh, PAM_USER, (const void **)user);
@@ -70,9 +70,9 @@ pam_getenvlist(pam_handle_t *pamh)
 		if ((envlist[i] = strdup(pamh->env[i])) == NULL) {
 			while (i) {
 				--i;
-				FREE(envlist[i]);
+				free(envlist[i]);
 			}
-			FREE(envlist);
+			free(envlist);
 			openpam_log(PAM_LOG_ERROR, "%s",
 			    pam_err_text[PAM_BUF_ERR]);
 			RETURNP(NULL);
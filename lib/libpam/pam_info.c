@@ -66,7 +66,7 @@ pam_info(const pam_handle_t *pamh,
 	va_start(ap, fmt);
 	r = pam_vprompt(pamh, PAM_TEXT_INFO, &rsp, fmt, ap);
 	va_end(ap);
-	FREE(rsp); /* ignore response */
+	free(rsp); /* ignore response */
 	return (r);
 }
 
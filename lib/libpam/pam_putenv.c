@@ -48,52 +48,72 @@
 #include "openpam_impl.h"
 
 /*
- * XSSO 4.2.1
- * XSSO 6 page 56
+ * OpenPAM internal
  *
- * Set the value of an environment variable
+ * Add a variable to the environment, replacing any previous value.  The
+ * string must have been allocated from the handle's arena, and now
+ * belongs to the environment list unless an error is returned.
  */
 
 int
-pam_putenv(pam_handle_t *pamh,
-	const char *namevalue)
+openpam_putenv(pam_handle_t *pamh, char *namevalue)
 {
-	char **env, *p;
+	char **env;
 	size_t env_size;
 	int i;
 
-	ENTER();
-
-	/* sanity checks */
-	if ((p = strchr(namevalue, '=')) == NULL) {
-		errno = EINVAL;
-		RETURNC(PAM_SYSTEM_ERR);
-	}
-
 	/* see if the variable is already in the environment */
-	if ((i = openpam_findenv(pamh, namevalue, p - namevalue)) >= 0) {
-		if ((p = strdup(namevalue)) == NULL)
-			RETURNC(PAM_BUF_ERR);
-		FREE(pamh->env[i]);
-		pamh->env[i] = p;
-		RETURNC(PAM_SUCCESS);
+	i = openpam_findenv(pamh, namevalue,
+	    strchr(namevalue, '=') - namevalue);
+	if (i >= 0) {
+		openpam_arena_free(pamh, pamh->env[i]);
+		pamh->env[i] = namevalue;
+		return (PAM_SUCCESS);
 	}
 
 	/* grow the environment list if necessary */
 	if (pamh->env_count == pamh->env_size) {
 		env_size = pamh->env_size * 2 + 1;
-		env = realloc(pamh->env, sizeof(char *) * env_size);
+		env = openpam_realloc(pamh->env, sizeof(char *) * env_size);
 		if (env == NULL)
-			RETURNC(PAM_BUF_ERR);
+			return (PAM_BUF_ERR);
 		pamh->env = env;
 		pamh->env_size = env_size;
 	}
 
 	/* add the variable at the end */
-	if ((pamh->env[pamh->env_count] = strdup(namevalue)) == NULL)
+	pamh->env[pamh->env_count++] = namevalue;
+	return (PAM_SUCCESS);
+}
+
+/*
+ * XSSO 4.2.1
+ * XSSO 6 page 56
+ *
+ * Set the value of an environment variable
+ */
+
+int
+pam_putenv(pam_handle_t *pamh,
+	const char *namevalue)
+{
+	char *p;
+	int r;
+
+	ENTER();
+
+	/* sanity checks */
+	if (strchr(namevalue, '=') == NULL) {
+		errno = EINVAL;
+		RETURNC(PAM_SYSTEM_ERR);
+	}
+
+	/* set it */
+	if ((p = openpam_arena_strdup(pamh, namevalue)) == NULL)
 		RETURNC(PAM_BUF_ERR);
-	++pamh->env_count;
-	RETURNC(PAM_SUCCESS);
+	if ((r = openpam_putenv(pamh, p)) != PAM_SUCCESS)
+		openpam_arena_free(pamh, p);
+	RETURNC(r);
 }
 
 /*
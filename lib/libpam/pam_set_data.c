@@ -62,6 +62,7 @@ pam_set_data(pam_handle_t *pamh,
 		int pam_end_status))
 {
 	pam_data_t *dp;
+	size_t len;
 
 	ENTERS(module_data_name);
 	for (dp = pamh->module_data; dp != NULL; dp = dp->next) {
@@ -73,12 +74,11 @@ pam_set_data(pam_handle_t *pamh,
 			RETURNC(PAM_SUCCESS);
 		}
 	}
-	if ((dp = malloc(sizeof *dp)) == NULL)
+	/* the name goes right after the node */
+	len = strlen(module_data_name) + 1;
+	if ((dp = openpam_arena_alloc(pamh, sizeof *dp + len)) == NULL)
 		RETURNC(PAM_BUF_ERR);
-	if ((dp->name = strdup(module_data_name)) == NULL) {
-		FREE(dp);
-		RETURNC(PAM_BUF_ERR);
-	}
+	dp->name = memcpy(dp + 1, module_data_name, len);
 	dp->data = data;
 	dp->cleanup = cleanup;
 	dp->next = pamh->module_data;
@@ -96,12 +96,24 @@ pam_set_item(pam_handle_t *pamh,
 	default:
 		RETURNC(PAM_BAD_ITEM);
 	}
-	if (*slot != NULL) {
+	if (*slot != NULL && (pamh->borrowed & (1U << item_type)) != 0) {
+		/* belongs to the template this handle was cloned from */
+		pamh->borrowed &= ~(1U << item_type);
+		*slot = NULL;
+	} else if (*slot != NULL && OPENPAM_PRESET_ITEM(item_type)) {
 		memset(*slot, 0xd0, osize);
 		FREE(*slot);
+	} else if (*slot != NULL) {
+		/* wiped by openpam_arena_free() */
+		openpam_arena_free(pamh, *slot);
+		*slot = NULL;
 	}
 	if (item != NULL) {
-		if ((*slot = malloc(nsize)) == NULL)
+		if (OPENPAM_PRESET_ITEM(item_type))
+			*slot = openpam_malloc(nsize);
+		else
+			*slot = openpam_arena_alloc(pamh, nsize);
+		if (*slot == NULL)
 			RETURNC(PAM_BUF_ERR);
 		memcpy(*slot, item, nsize);
 	} else {
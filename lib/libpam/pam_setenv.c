@@ -47,7 +47,6 @@
 #include <security/pam_appl.h>
 
 #include "openpam_impl.h"
-#include "openpam_asprintf.h"
 
 /*
  * OpenPAM extension
@@ -62,6 +61,7 @@ pam_setenv(pam_handle_t *pamh,
 	const char *value,
 	int overwrite)
 {
+	size_t namelen, valuelen;
 	char *env;
 	int r;
 
@@ -77,11 +77,16 @@ pam_setenv(pam_handle_t *pamh,
 	if (!overwrite && openpam_findenv(pamh, name, strlen(name)) >= 0)
 		RETURNC(PAM_SUCCESS);
 
-	/* set it... */
-	if (asprintf(&env, "%s=%s", name, value) < 0)
+	/* set it, building the string in place */
+	namelen = strlen(name);
+	valuelen = strlen(value);
+	if ((env = openpam_arena_alloc(pamh, namelen + valuelen + 2)) == NULL)
 		RETURNC(PAM_BUF_ERR);
-	r = pam_putenv(pamh, env);
-	FREE(env);
+	memcpy(env, name, namelen);
+	env[namelen] = '=';
+	memcpy(env + namelen + 1, value, valuelen + 1);
+	if ((r = openpam_putenv(pamh, env)) != PAM_SUCCESS)
+		openpam_arena_free(pamh, env);
 	RETURNC(r);
 }
 
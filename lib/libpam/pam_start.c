@@ -72,8 +72,9 @@ pam_start(const char *service,
 	int r;
 
 	ENTER();
-	if ((ph = calloc(1, sizeof *ph)) == NULL)
+	if ((ph = openpam_calloc(1, sizeof *ph)) == NULL)
 		RETURNC(PAM_BUF_ERR);
+	ph->refcount = 1;
 	if ((r = pam_set_item(ph, PAM_SERVICE, service)) != PAM_SUCCESS)
 		goto fail;
 	if (gethostname(hostname, sizeof hostname) != 0)
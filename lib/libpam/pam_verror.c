@@ -62,7 +62,7 @@ pam_verror(const pam_handle_t *pamh,
 	int r;
 
 	r = pam_vprompt(pamh, PAM_ERROR_MSG, &rsp, fmt, ap);
-	FREE(rsp); /* ignore response */
+	free(rsp); /* ignore response */
 	return (r);
 }
 
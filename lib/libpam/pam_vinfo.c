@@ -62,7 +62,7 @@ pam_vinfo(const pam_handle_t *pamh,
 	int r;
 
 	r = pam_vprompt(pamh, PAM_TEXT_INFO, &rsp, fmt, ap);
-	FREE(rsp); /* ignore response */
+	free(rsp); /* ignore response */
 	return (r);
 }
 
@@ -84,7 +84,7 @@ pam_vprompt(const pam_handle_t *pamh,
 	rsp = NULL;
 	r = (conv->conv)(1, &msgp, &rsp, conv->appdata_ptr);
 	*resp = rsp == NULL ? NULL : rsp->resp;
-	FREE(rsp);
+	free(rsp);
 	RETURNC(r);
 }
 
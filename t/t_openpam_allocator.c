@@ -0,0 +1,227 @@
+/*-
+ * Copyright (c) 2026 Dag-Erling Smørgrav
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote
+ *    products derived from this software without specific prior written
+ *    permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $OpenPAM$
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <cryb/test.h>
+
+#include <security/pam_appl.h>
+#include <security/openpam.h>
+
+#include "openpam_impl.h"
+#include "t_pam_conv.h"
+
+#define T_FUNC(n, d)							\
+	static const char *t_ ## n ## _desc = d;			\
+	static int t_ ## n ## _func(OPENPAM_UNUSED(char **desc),	\
+	    OPENPAM_UNUSED(void *arg))
+
+#define T(n)								\
+	t_add_test(&t_ ## n ## _func, NULL, "%s", t_ ## n ## _desc)
+
+const char *pam_return_so;
+
+/*
+ * A counting allocator which records the size of each block so it can
+ * check that the library passes the right size back when freeing it.
+ */
+union t_block {
+	size_t		 size;
+	long double	 ld;
+	void		*p;
+};
+
+static struct t_count {
+	unsigned long	 allocs;
+	unsigned long	 frees;
+	unsigned long	 mismatch;
+} t_count;
+
+static void *
+t_alloc(size_t size, void *arg)
+{
+	struct t_count *tc = arg;
+	union t_block *b;
+
+	if ((b = malloc(sizeof *b + size)) == NULL)
+		return (NULL);
+	b->size = size;
+	tc->allocs++;
+	return (b + 1);
+}
+
+static void *
+t_realloc(void *p, size_t oldsize, size_t size, void *arg)
+{
+	struct t_count *tc = arg;
+	union t_block *b;
+
+	b = (union t_block *)p - 1;
+	if (b->size != oldsize)
+		tc->mismatch++;
+	if ((b = realloc(b, sizeof *b + size)) == NULL)
+		return (NULL);
+	b->size = size;
+	return (b + 1);
+}
+
+static void
+t_free(void *p, size_t size, void *arg)
+{
+	struct t_count *tc = arg;
+	union t_block *b;
+
+	b = (union t_block *)p - 1;
+	if (b->size != size)
+		tc->mismatch++;
+	tc->frees++;
+	free(b);
+}
+
+static const struct openpam_allocator t_allocator = {
+	.alloc_func = t_alloc,
+	.realloc_func = t_realloc,
+	.free_func = t_free,
+	.arg = &t_count,
+};
+
+/*
+ * Run a complete transaction against a policy consisting of a single
+ * pam_return module.
+ */
+static int
+t_cycle(const char *service)
+{
+	struct t_pam_conv_script script;
+	struct pam_conv pamc;
+	pam_handle_t *pamh;
+	int pam_err;
+
+	memset(&script, 0, sizeof script);
+	pamc.conv = &t_pam_conv;
+	pamc.appdata_ptr = &script;
+	pam_err = pam_start(service, "test", &pamc, &pamh);
+	if (pam_err != PAM_SUCCESS) {
+		t_printv("pam_start() returned %d\n", pam_err);
+		return (0);
+	}
+	pam_err = pam_authenticate(pamh, 0);
+	t_printv("pam_authenticate() returned %d\n", pam_err);
+	pam_end(pamh, pam_err);
+	return (pam_err == PAM_SUCCESS);
+}
+
+
+/***************************************************************************
+ * Tests
+ */
+
+T_FUNC(cycle, "allocations per transaction")
+{
+	struct t_count before;
+	struct t_file *tf;
+	int i, ret;
+
+	tf = t_fopen(NULL);
+	t_fprintf(tf, "auth required %s error=PAM_SUCCESS\n", pam_return_so);
+	/* the first transaction populates the caches */
+	ret = t_cycle(tf->name);
+	t_printv("warm-up: %lu allocations, %lu frees\n",
+	    t_count.allocs, t_count.frees);
+	for (i = 0; ret && i < 3; ++i) {
+		before = t_count;
+		ret = t_cycle(tf->name);
+		t_printv("cycle %d: %lu allocations, %lu frees\n", i,
+		    t_count.allocs - before.allocs,
+		    t_count.frees - before.frees);
+		ret = ret && t_count.allocs > before.allocs &&
+		    t_count.allocs - before.allocs ==
+		    t_count.frees - before.frees;
+	}
+	t_fclose(tf);
+	t_printv("%lu size mismatches\n", t_count.mismatch);
+	return (ret && t_count.mismatch == 0);
+}
+
+T_FUNC(too_late, "allocator cannot be changed once in use")
+{
+
+	return (openpam_set_allocator(NULL) == PAM_SYSTEM_ERR &&
+	    openpam_set_allocator(&t_allocator) == PAM_SYSTEM_ERR);
+}
+
+
+/***************************************************************************
+ * Boilerplate
+ */
+
+static int
+t_prepare(int argc, char *argv[])
+{
+
+	(void)argc;
+	(void)argv;
+
+	if (openpam_set_allocator(&t_allocator) != PAM_SUCCESS) {
+		t_printv("openpam_set_allocator() failed\n");
+		return (-1);
+	}
+
+	if ((pam_return_so = getenv("PAM_RETURN_SO")) == NULL) {
+		t_printv("define PAM_RETURN_SO before running these tests\n");
+		return (0);
+	}
+
+	openpam_set_feature(OPENPAM_RESTRICT_MODULE_NAME, 0);
+	openpam_set_feature(OPENPAM_VERIFY_MODULE_FILE, 0);
+	openpam_set_feature(OPENPAM_RESTRICT_SERVICE_NAME, 0);
+	openpam_set_feature(OPENPAM_VERIFY_POLICY_FILE, 0);
+	openpam_set_feature(OPENPAM_FALLBACK_TO_OTHER, 0);
+
+	T(cycle);
+	T(too_late);
+
+	return (0);
+}
+
+int
+main(int argc, char *argv[])
+{
+
+	t_main(t_prepare, NULL, argc, argv);
+}
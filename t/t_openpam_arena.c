@@ -0,0 +1,181 @@
+/*-
+ * Copyright (c) 2026 Dag-Erling Smørgrav
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote
+ *    products derived from this software without specific prior written
+ *    permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $OpenPAM$
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <cryb/test.h>
+
+#include <security/pam_appl.h>
+#include <security/openpam.h>
+
+#include "openpam_impl.h"
+
+#define T_FUNC(n, d)							\
+	static const char *t_ ## n ## _desc = d;			\
+	static int t_ ## n ## _func(OPENPAM_UNUSED(char **desc),	\
+	    OPENPAM_UNUSED(void *arg))
+
+#define T(n)								\
+	t_add_test(&t_ ## n ## _func, NULL, "%s", t_ ## n ## _desc)
+
+struct pam_conv t_null_pamc;
+
+/*
+ * Count the chunks in a handle's arena.
+ */
+static int
+t_chunks(pam_handle_t *pamh)
+{
+	pam_arena_chunk_t *chunk;
+	int n;
+
+	n = 0;
+	for (chunk = pamh->arena.chunks; chunk != NULL; chunk = chunk->next)
+		++n;
+	t_printv("%d chunks\n", n);
+	return (n);
+}
+
+
+/***************************************************************************
+ * Tests
+ */
+
+T_FUNC(reclaim, "replaced items reuse their space")
+{
+	pam_handle_t *pamh;
+	char authtok[64];
+	int i, pam_err, ret;
+
+	pam_err = pam_start("t_openpam_arena", "test", &t_null_pamc, &pamh);
+	if (pam_err != PAM_SUCCESS)
+		return (0);
+	for (ret = 1, i = 0; ret && i < 1000; ++i) {
+		snprintf(authtok, sizeof authtok, "%*d", i % 40 + 1, i);
+		ret = pam_set_item(pamh, PAM_AUTHTOK, authtok) ==
+		    PAM_SUCCESS &&
+		    pam_setenv(pamh, "T_ARENA", authtok, 1) == PAM_SUCCESS;
+	}
+	ret = ret && t_chunks(pamh) == 1 &&
+	    strcmp(pam_getenv(pamh, "T_ARENA"), authtok) == 0;
+	pam_end(pamh, pam_err);
+	return (ret);
+}
+
+T_FUNC(wiped, "transaction memory wiped on reset")
+{
+	pam_handle_t *pamh;
+	const void *item;
+	const char *env;
+	size_t i;
+	int pam_err, ret;
+
+	pam_err = pam_start("t_openpam_arena", "test", &t_null_pamc, &pamh);
+	if (pam_err != PAM_SUCCESS)
+		return (0);
+	ret = pam_set_item(pamh, PAM_AUTHTOK, "squeamish") == PAM_SUCCESS &&
+	    pam_putenv(pamh, "T_ARENA=ossifrage") == PAM_SUCCESS &&
+	    pam_get_item(pamh, PAM_AUTHTOK, &item) == PAM_SUCCESS &&
+	    (env = pam_getenv(pamh, "T_ARENA")) != NULL &&
+	    openpam_reset(pamh, "test") == PAM_SUCCESS;
+	/* the memory is still there, but must be blank */
+	for (i = 0; ret && i < sizeof "squeamish"; ++i)
+		ret = ((const char *)item)[i] == '\0';
+	for (i = 0; ret && i < sizeof "ossifrage"; ++i)
+		ret = env[i] == '\0';
+	ret = ret && t_chunks(pamh) == 1;
+	pam_end(pamh, pam_err);
+	return (ret);
+}
+
+T_FUNC(large, "allocation larger than a chunk")
+{
+	pam_handle_t *pamh;
+	const void *item;
+	char *user;
+	int pam_err, ret;
+
+	pam_err = pam_start("t_openpam_arena", "test", &t_null_pamc, &pamh);
+	if (pam_err != PAM_SUCCESS)
+		return (0);
+	if ((user = malloc(16384)) == NULL) {
+		pam_end(pamh, pam_err);
+		return (0);
+	}
+	memset(user, 'x', 16383);
+	user[16383] = '\0';
+	ret = pam_set_item(pamh, PAM_USER, user) == PAM_SUCCESS &&
+	    pam_set_item(pamh, PAM_TTY, "tty0") == PAM_SUCCESS &&
+	    pam_get_item(pamh, PAM_USER, &item) == PAM_SUCCESS &&
+	    strcmp(item, user) == 0 &&
+	    pam_get_item(pamh, PAM_TTY, &item) == PAM_SUCCESS &&
+	    strcmp(item, "tty0") == 0 &&
+	    t_chunks(pamh) == 2;
+	free(user);
+	pam_end(pamh, pam_err);
+	return (ret);
+}
+
+
+/***************************************************************************
+ * Boilerplate
+ */
+
+static int
+t_prepare(int argc, char *argv[])
+{
+
+	(void)argc;
+	(void)argv;
+
+	openpam_set_feature(OPENPAM_FALLBACK_TO_OTHER, 0);
+
+	T(reclaim);
+	T(wiped);
+	T(large);
+
+	return (0);
+}
+
+int
+main(int argc, char *argv[])
+{
+
+	t_main(t_prepare, NULL, argc, argv);
+}
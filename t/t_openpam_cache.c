@@ -0,0 +1,216 @@
+/*-
+ * Copyright (c) 2026 Dag-Erling Smørgrav
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote
+ *    products derived from this software without specific prior written
+ *    permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $OpenPAM$
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <err.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <cryb/test.h>
+
+#include <security/pam_appl.h>
+#include <security/openpam.h>
+
+#include "openpam_impl.h"
+#include "t_pam_conv.h"
+#include "t_pam_policy.h"
+
+#define T_FUNC(n, d)							\
+	static const char *t_ ## n ## _desc = d;			\
+	static int t_ ## n ## _func(OPENPAM_UNUSED(char **desc),	\
+	    OPENPAM_UNUSED(void *arg))
+
+#define T(n)								\
+	t_add_test(&t_ ## n ## _func, NULL, "%s", t_ ## n ## _desc)
+
+const char *pam_return_so;
+
+static struct t_pam_conv_script t_script;
+static struct pam_conv t_pamc = { &t_pam_conv, &t_script };
+
+
+/*
+ * Run a transaction using a policy which refers to pam_return through a
+ * symlink, then remove the link.  The policy can then no longer be
+ * loaded from scratch, so later transactions only succeed if they use
+ * the cached chains, which still hold on to the module.  If a feature
+ * is given, it is toggled before the next transaction.
+ */
+static int
+t_cached(int feature)
+{
+	char dir[] = "/tmp/t_openpam_cache.XXXXXX";
+	char modpath[sizeof dir + sizeof "/pam_return.so"];
+	const char *real_so;
+	struct t_file *tf;
+	int onoff, ret;
+
+	if (mkdtemp(dir) == NULL) {
+		t_printv("mkdtemp(): %s\n", strerror(errno));
+		return (0);
+	}
+	snprintf(modpath, sizeof modpath, "%s/pam_return.so", dir);
+	if (symlink(pam_return_so, modpath) != 0) {
+		t_printv("symlink(): %s\n", strerror(errno));
+		rmdir(dir);
+		return (0);
+	}
+	real_so = pam_return_so;
+	pam_return_so = modpath;
+	tf = t_fopen(NULL);
+	t_write_policy(tf, PAM_SUCCESS);
+	pam_return_so = real_so;
+	ret = t_authenticate(tf->name, PAM_SUCCESS);
+	unlink(modpath);
+	rmdir(dir);
+	if (feature >= 0) {
+		openpam_get_feature(feature, &onoff);
+		openpam_set_feature(feature, !onoff);
+	}
+	ret &= t_authenticate(tf->name, PAM_SUCCESS);
+	ret &= t_authenticate(tf->name, PAM_SUCCESS);
+	if (feature >= 0)
+		openpam_set_feature(feature, onoff);
+	t_fclose(tf);
+	return (ret);
+}
+
+
+/***************************************************************************
+ * Tests
+ */
+
+T_FUNC(hit, "repeated transactions")
+{
+
+	return (t_cached(-1));
+}
+
+T_FUNC(stats, "statistics toggled between transactions")
+{
+
+	return (t_cached(OPENPAM_MODULE_STATS));
+}
+
+T_FUNC(stale, "policy modified between transactions")
+{
+	struct t_file *tf;
+	int ret;
+
+	tf = t_fopen(NULL);
+	t_write_policy(tf, PAM_SUCCESS);
+	ret = t_authenticate(tf->name, PAM_SUCCESS);
+	t_write_policy(tf, PAM_AUTH_ERR);
+	ret &= t_authenticate(tf->name, PAM_AUTH_ERR);
+	ret &= t_authenticate(tf->name, PAM_AUTH_ERR);
+	t_fclose(tf);
+	return (ret);
+}
+
+T_FUNC(overlap, "overlapping transactions")
+{
+	pam_handle_t *pamh1, *pamh2;
+	struct t_file *tf;
+	int pam_err, ret;
+
+	tf = t_fopen(NULL);
+	t_write_policy(tf, PAM_SUCCESS);
+	pam_err = pam_start(tf->name, "test", &t_pamc, &pamh1);
+	if (pam_err != PAM_SUCCESS) {
+		t_printv("pam_start() returned %d\n", pam_err);
+		t_fclose(tf);
+		return (0);
+	}
+	pam_err = pam_start(tf->name, "test", &t_pamc, &pamh2);
+	if (pam_err != PAM_SUCCESS) {
+		t_printv("pam_start() returned %d\n", pam_err);
+		pam_end(pamh1, pam_err);
+		t_fclose(tf);
+		return (0);
+	}
+	/* replace the cached policy while both handles are still live */
+	t_write_policy(tf, PAM_AUTH_ERR);
+	ret = t_authenticate(tf->name, PAM_AUTH_ERR);
+	pam_err = pam_authenticate(pamh1, 0);
+	ret &= (pam_err == PAM_SUCCESS);
+	pam_end(pamh1, pam_err);
+	pam_err = pam_authenticate(pamh2, 0);
+	ret &= (pam_err == PAM_SUCCESS);
+	pam_end(pamh2, pam_err);
+	t_fclose(tf);
+	return (ret);
+}
+
+
+/***************************************************************************
+ * Boilerplate
+ */
+
+static int
+t_prepare(int argc, char *argv[])
+{
+
+	(void)argc;
+	(void)argv;
+
+	if ((pam_return_so = getenv("PAM_RETURN_SO")) == NULL) {
+		t_printv("define PAM_RETURN_SO before running these tests\n");
+		return (0);
+	}
+
+	openpam_set_feature(OPENPAM_RESTRICT_MODULE_NAME, 0);
+	openpam_set_feature(OPENPAM_VERIFY_MODULE_FILE, 0);
+	openpam_set_feature(OPENPAM_RESTRICT_SERVICE_NAME, 0);
+	openpam_set_feature(OPENPAM_VERIFY_POLICY_FILE, 0);
+	openpam_set_feature(OPENPAM_FALLBACK_TO_OTHER, 0);
+	openpam_set_feature(OPENPAM_CACHE_POLICY, 1);
+
+	T(hit);
+	T(stats);
+	T(stale);
+	T(overlap);
+
+	return (0);
+}
+
+int
+main(int argc, char *argv[])
+{
+
+	t_main(t_prepare, NULL, argc, argv);
+}
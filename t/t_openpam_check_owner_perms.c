@@ -0,0 +1,175 @@
+/*-
+ * Copyright (c) 2026 Dag-Erling Smørgrav
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote
+ *    products derived from this software without specific prior written
+ *    permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $OpenPAM$
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <cryb/test.h>
+
+#include <security/pam_appl.h>
+#include <security/openpam.h>
+
+#include "openpam_impl.h"
+
+#define T_FUNC(n, d)							\
+	static const char *t_ ## n ## _desc = d;			\
+	static int t_ ## n ## _func(OPENPAM_UNUSED(char **desc),	\
+	    OPENPAM_UNUSED(void *arg))
+
+#define T(n)								\
+	t_add_test(&t_ ## n ## _func, NULL, "%s", t_ ## n ## _desc)
+
+/*
+ * Verify a path and check the outcome.  If the path is expected to pass,
+ * also check that it was resolved to the same place as realpath(3) would
+ * have.
+ */
+static int
+t_check(const char *path, int expected)
+{
+	char resolved[PATH_MAX], real[PATH_MAX];
+	int ret;
+
+	ret = openpam_check_path_owner_perms(path, resolved);
+	t_printv("%s: returned %d (%s)\n", path, ret,
+	    ret == 0 ? resolved : strerror(errno));
+	if (expected != 0)
+		return (ret == -1 && errno == expected);
+	if (ret != 0)
+		return (0);
+	if (realpath(path, real) == NULL) {
+		t_printv("realpath(%s): %s\n", path, strerror(errno));
+		return (0);
+	}
+	if (strcmp(resolved, real) != 0) {
+		t_printv("expected %s\n", real);
+		return (0);
+	}
+	return (1);
+}
+
+
+/***************************************************************************
+ * Tests
+ */
+
+T_FUNC(system_file, "file in a system directory")
+{
+
+	/* the second time around, the directory is cached */
+	return (t_check("/bin/sh", 0) &&
+	    t_check("/bin/sh", 0));
+}
+
+T_FUNC(dotdot, "path containing dot-dot")
+{
+
+	return (t_check("/etc/../bin/sh", 0) &&
+	    t_check("/etc/../bin/sh", 0));
+}
+
+T_FUNC(missing, "file or directory does not exist")
+{
+
+	return (t_check("/etc/t_openpam_nonexistent", ENOENT) &&
+	    t_check("/t_openpam_nonexistent/file", ENOENT));
+}
+
+T_FUNC(not_regular, "not a regular file")
+{
+
+	return (t_check("/etc", EINVAL) &&
+	    t_check("/etc/", EINVAL));
+}
+
+T_FUNC(insecure_dir, "file in a world-writable directory")
+{
+	char dir[PATH_MAX], file[PATH_MAX];
+	int fd, ret;
+
+	strcpy(dir, "/tmp/t_openpam_check_owner_perms.XXXXXX");
+	if (mkdtemp(dir) == NULL) {
+		t_printv("mkdtemp(): %s\n", strerror(errno));
+		return (0);
+	}
+	snprintf(file, sizeof file, "%s/file", dir);
+	if ((fd = open(file, O_RDWR|O_CREAT|O_EXCL, 0644)) < 0) {
+		t_printv("%s: %s\n", file, strerror(errno));
+		rmdir(dir);
+		return (0);
+	}
+	close(fd);
+	/* /tmp is world-writable, so the directory itself is irrelevant */
+	ret = chmod(dir, 0755) == 0 &&
+	    t_check(file, EPERM) &&
+	    chmod(dir, 0777) == 0 &&
+	    t_check(file, EPERM);
+	unlink(file);
+	rmdir(dir);
+	return (ret);
+}
+
+
+/***************************************************************************
+ * Boilerplate
+ */
+
+static int
+t_prepare(int argc, char *argv[])
+{
+
+	(void)argc;
+	(void)argv;
+
+	T(system_file);
+	T(dotdot);
+	T(missing);
+	T(not_regular);
+	T(insecure_dir);
+
+	return (0);
+}
+
+int
+main(int argc, char *argv[])
+{
+
+	t_main(t_prepare, NULL, argc, argv);
+}
@@ -0,0 +1,281 @@
+/*-
+ * Copyright (c) 2026 Dag-Erling Smørgrav
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote
+ *    products derived from this software without specific prior written
+ *    permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $OpenPAM$
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <err.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <cryb/test.h>
+
+#include <security/pam_appl.h>
+#include <security/openpam.h>
+
+#include "openpam_impl.h"
+#include "t_pam_conv.h"
+
+#define T_FUNC(n, d)							\
+	static const char *t_ ## n ## _desc = d;			\
+	static int t_ ## n ## _func(OPENPAM_UNUSED(char **desc),	\
+	    OPENPAM_UNUSED(void *arg))
+
+#define T(n)								\
+	t_add_test(&t_ ## n ## _func, NULL, "%s", t_ ## n ## _desc)
+
+const char *pam_return_so;
+
+static struct t_pam_conv_script t_script;
+static struct pam_conv t_pamc = { &t_pam_conv, &t_script };
+
+/*
+ * Create a template for a policy which consists of a single entry.
+ */
+static pam_handle_t *
+t_template(struct t_file *tf, const char *entry)
+{
+	pam_handle_t *pamh;
+	int pam_err;
+
+	t_fprintf(tf, "%s\n", entry);
+	fflush(tf->file);
+	pam_err = pam_start(tf->name, "test", &t_pamc, &pamh);
+	t_printv("pam_start() returned %d\n", pam_err);
+	return (pam_err == PAM_SUCCESS ? pamh : NULL);
+}
+
+/*
+ * Run the auth chain and check the result.
+ */
+static int
+t_authenticate_handle(pam_handle_t *pamh, int expected)
+{
+	int pam_err;
+
+	pam_err = pam_authenticate(pamh, 0);
+	t_printv("pam_authenticate() returned %d\n", pam_err);
+	return (pam_err == expected);
+}
+
+
+/***************************************************************************
+ * Tests
+ */
+
+T_FUNC(shared, "chains and preset items shared")
+{
+	struct t_file *tf;
+	pam_handle_t *tmpl, *pamh;
+	const void *host;
+	char entry[1024];
+	int pam_err, ret;
+
+	tf = t_fopen(NULL);
+	snprintf(entry, sizeof entry, "auth required %s error=PAM_SUCCESS",
+	    pam_return_so);
+	if ((tmpl = t_template(tf, entry)) == NULL) {
+		t_fclose(tf);
+		return (0);
+	}
+	pam_err = openpam_clone(tmpl, &pamh);
+	t_printv("openpam_clone() returned %d\n", pam_err);
+	if (pam_err != PAM_SUCCESS) {
+		pam_end(tmpl, pam_err);
+		t_fclose(tf);
+		return (0);
+	}
+	ret = pamh->chains[PAM_AUTH] == tmpl->chains[PAM_AUTH] &&
+	    pamh->item[PAM_SERVICE] == tmpl->item[PAM_SERVICE] &&
+	    pamh->item[PAM_HOST] == tmpl->item[PAM_HOST] &&
+	    pamh->item[PAM_CONV] == tmpl->item[PAM_CONV] &&
+	    t_authenticate_handle(pamh, PAM_SUCCESS);
+	/* changing an item in the clone leaves the template alone */
+	host = tmpl->item[PAM_HOST];
+	ret = ret &&
+	    pam_set_item(pamh, PAM_HOST, "t_openpam_clone") == PAM_SUCCESS &&
+	    tmpl->item[PAM_HOST] == host &&
+	    strcmp(pamh->item[PAM_HOST], "t_openpam_clone") == 0 &&
+	    pam_set_item(pamh, PAM_SERVICE, "other") == PAM_BAD_ITEM;
+	pam_end(pamh, PAM_SUCCESS);
+	ret = ret && t_authenticate_handle(tmpl, PAM_SUCCESS);
+	pam_end(tmpl, PAM_SUCCESS);
+	t_fclose(tf);
+	return (ret);
+}
+
+T_FUNC(outlived, "template ended before its clones")
+{
+	struct t_file *tf;
+	pam_handle_t *tmpl, *pamh1, *pamh2;
+	char entry[1024];
+	int ret;
+
+	tf = t_fopen(NULL);
+	snprintf(entry, sizeof entry, "auth required %s error=PAM_SUCCESS",
+	    pam_return_so);
+	if ((tmpl = t_template(tf, entry)) == NULL) {
+		t_fclose(tf);
+		return (0);
+	}
+	if (openpam_clone(tmpl, &pamh1) != PAM_SUCCESS) {
+		pam_end(tmpl, PAM_SUCCESS);
+		t_fclose(tf);
+		return (0);
+	}
+	/* a clone of a clone is a clone of the template */
+	if (openpam_clone(pamh1, &pamh2) != PAM_SUCCESS) {
+		pam_end(pamh1, PAM_SUCCESS);
+		pam_end(tmpl, PAM_SUCCESS);
+		t_fclose(tf);
+		return (0);
+	}
+	ret = pamh2->parent == tmpl;
+	pam_end(tmpl, PAM_SUCCESS);
+	ret = t_authenticate_handle(pamh1, PAM_SUCCESS) && ret;
+	pam_end(pamh1, PAM_SUCCESS);
+	ret = t_authenticate_handle(pamh2, PAM_SUCCESS) && ret;
+	pam_end(pamh2, PAM_SUCCESS);
+	t_fclose(tf);
+	return (ret);
+}
+
+T_FUNC(options, "options set in a clone are private")
+{
+	struct t_file *tf;
+	pam_handle_t *tmpl, *pamh1, *pamh2;
+	char entry[1024];
+	int ret;
+
+	tf = t_fopen(NULL);
+	snprintf(entry, sizeof entry, "auth required %s error=PAM_SUCCESS",
+	    pam_return_so);
+	if ((tmpl = t_template(tf, entry)) == NULL) {
+		t_fclose(tf);
+		return (0);
+	}
+	if (openpam_clone(tmpl, &pamh1) != PAM_SUCCESS) {
+		pam_end(tmpl, PAM_SUCCESS);
+		t_fclose(tf);
+		return (0);
+	}
+	if (openpam_clone(tmpl, &pamh2) != PAM_SUCCESS) {
+		pam_end(pamh1, PAM_SUCCESS);
+		pam_end(tmpl, PAM_SUCCESS);
+		t_fclose(tf);
+		return (0);
+	}
+	/* pretend to be the module */
+	pamh1->current = pamh2->current = tmpl->chains[PAM_AUTH];
+	ret = openpam_set_option(pamh1, "error", "PAM_AUTH_ERR") ==
+	    PAM_SUCCESS &&
+	    openpam_set_option(pamh2, "error", NULL) == PAM_SUCCESS &&
+	    openpam_get_option(pamh2, "error") == NULL &&
+	    strcmp(openpam_get_option(pamh1, "error"), "PAM_AUTH_ERR") == 0;
+	pamh1->current = pamh2->current = NULL;
+	ret = ret &&
+	    strcmp(tmpl->chains[PAM_AUTH]->optv[0],
+	    "error=PAM_SUCCESS") == 0 &&
+	    t_authenticate_handle(pamh1, PAM_AUTH_ERR) &&
+	    t_authenticate_handle(pamh2, PAM_SYSTEM_ERR) &&
+	    t_authenticate_handle(tmpl, PAM_SUCCESS);
+	pam_end(pamh1, PAM_SUCCESS);
+	pam_end(pamh2, PAM_SUCCESS);
+	pam_end(tmpl, PAM_SUCCESS);
+	t_fclose(tf);
+	return (ret);
+}
+
+T_FUNC(lazy_missing, "deferred module missing")
+{
+	struct t_file *tf;
+	pam_handle_t *tmpl, *pamh;
+	int pam_err;
+
+	tf = t_fopen(NULL);
+	openpam_set_feature(OPENPAM_LAZY_MODULES, 1);
+	tmpl = t_template(tf,
+	    "auth required /nonexistent/pam_t_missing.so");
+	openpam_set_feature(OPENPAM_LAZY_MODULES, 0);
+	if (tmpl == NULL) {
+		t_fclose(tf);
+		return (0);
+	}
+	pam_err = openpam_clone(tmpl, &pamh);
+	t_printv("openpam_clone() returned %d\n", pam_err);
+	if (pam_err == PAM_SUCCESS)
+		pam_end(pamh, PAM_SUCCESS);
+	pam_end(tmpl, PAM_SUCCESS);
+	t_fclose(tf);
+	return (pam_err == PAM_SYSTEM_ERR);
+}
+
+
+/***************************************************************************
+ * Boilerplate
+ */
+
+static int
+t_prepare(int argc, char *argv[])
+{
+
+	(void)argc;
+	(void)argv;
+
+	if ((pam_return_so = getenv("PAM_RETURN_SO")) == NULL) {
+		t_printv("define PAM_RETURN_SO before running these tests\n");
+		return (0);
+	}
+
+	openpam_set_feature(OPENPAM_RESTRICT_MODULE_NAME, 0);
+	openpam_set_feature(OPENPAM_VERIFY_MODULE_FILE, 0);
+	openpam_set_feature(OPENPAM_RESTRICT_SERVICE_NAME, 0);
+	openpam_set_feature(OPENPAM_VERIFY_POLICY_FILE, 0);
+	openpam_set_feature(OPENPAM_FALLBACK_TO_OTHER, 0);
+
+	T(shared);
+	T(outlived);
+	T(options);
+	T(lazy_missing);
+
+	return (0);
+}
+
+int
+main(int argc, char *argv[])
+{
+
+	t_main(t_prepare, NULL, argc, argv);
+}
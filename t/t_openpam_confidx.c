@@ -0,0 +1,226 @@
+/*-
+ * Copyright (c) 2026 Dag-Erling Smørgrav
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote
+ *    products derived from this software without specific prior written
+ *    permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $OpenPAM$
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <err.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <cryb/test.h>
+
+#include <security/pam_appl.h>
+#include <security/openpam.h>
+
+#include "openpam_impl.h"
+#include "t_pam_conv.h"
+#include "t_pam_policy.h"
+
+#define T_FUNC(n, d)							\
+	static const char *t_ ## n ## _desc = d;			\
+	static int t_ ## n ## _func(OPENPAM_UNUSED(char **desc),	\
+	    OPENPAM_UNUSED(void *arg))
+
+#define T(n)								\
+	t_add_test(&t_ ## n ## _func, NULL, "%s", t_ ## n ## _desc)
+
+const char *pam_return_so;
+
+static struct t_pam_conv_script t_script;
+static struct pam_conv t_pamc = { &t_pam_conv, &t_script };
+
+/*
+ * Search path consisting of a single pam.conf-style file.
+ */
+static char t_conf[64];
+
+static struct t_file *
+t_open_conf(void)
+{
+	struct t_file *tf;
+
+	snprintf(t_conf, sizeof t_conf, "/tmp/t_openpam_confidx.%ld.conf",
+	    (long)getpid());
+	if ((tf = t_fopen(t_conf)) == NULL)
+		return (NULL);
+	openpam_policy_path[0] = t_conf;
+	openpam_policy_path[1] = NULL;
+	return (tf);
+}
+
+/*
+ * Count the entries in each of a service's chains.
+ */
+static int
+t_count(const char *service, int n[PAM_NUM_FACILITIES])
+{
+	pam_handle_t *pamh;
+	int fclt, pam_err;
+
+	pam_err = pam_start(service, "test", &t_pamc, &pamh);
+	if (pam_err != PAM_SUCCESS) {
+		t_printv("pam_start() returned %d\n", pam_err);
+		return (0);
+	}
+	for (fclt = 0; fclt < PAM_NUM_FACILITIES; ++fclt) {
+		n[fclt] = openpam_chain_length(pamh->chains[fclt]);
+		t_printv("%s %s: %d entries\n", service,
+		    pam_facility_name[fclt], n[fclt]);
+	}
+	pam_end(pamh, PAM_SUCCESS);
+	return (1);
+}
+
+
+/***************************************************************************
+ * Tests
+ */
+
+T_FUNC(interleaved, "services interleaved in pam.conf")
+{
+	struct t_file *tf;
+	int n[PAM_NUM_FACILITIES];
+	int ret;
+
+	if ((tf = t_open_conf()) == NULL)
+		return (0);
+	t_fprintf(tf, "# interleaved services\n");
+	t_fprintf(tf, "alpha auth required %s error=PAM_SUCCESS\n",
+	    pam_return_so);
+	t_fprintf(tf, "beta auth required %s error=PAM_AUTH_ERR\n",
+	    pam_return_so);
+	t_fprintf(tf, "\n");
+	t_fprintf(tf, "alpha auth required %s \\\n  error=PAM_SUCCESS\n",
+	    pam_return_so);
+	t_fprintf(tf, "# comment\n");
+	t_fprintf(tf, "alpha account required %s error=PAM_SUCCESS\n",
+	    pam_return_so);
+	t_fprintf(tf, "beta account required %s error=PAM_SUCCESS\n",
+	    pam_return_so);
+	fflush(tf->file);
+	ret = t_count("alpha", n) &&
+	    n[PAM_AUTH] == 2 && n[PAM_ACCOUNT] == 1 &&
+	    n[PAM_SESSION] == 0 && n[PAM_PASSWORD] == 0;
+	ret &= t_count("beta", n) &&
+	    n[PAM_AUTH] == 1 && n[PAM_ACCOUNT] == 1 &&
+	    n[PAM_SESSION] == 0 && n[PAM_PASSWORD] == 0;
+	ret &= t_count("gamma", n) &&
+	    n[PAM_AUTH] == 0 && n[PAM_ACCOUNT] == 0 &&
+	    n[PAM_SESSION] == 0 && n[PAM_PASSWORD] == 0;
+	ret &= t_authenticate("alpha", PAM_SUCCESS);
+	ret &= t_authenticate("beta", PAM_AUTH_ERR);
+	t_fclose(tf);
+	return (ret);
+}
+
+T_FUNC(changed, "pam.conf changed between transactions")
+{
+	struct t_file *tf;
+	int ret;
+
+	if ((tf = t_open_conf()) == NULL)
+		return (0);
+	t_fprintf(tf, "alpha auth required %s error=PAM_SUCCESS\n",
+	    pam_return_so);
+	t_fprintf(tf, "beta auth required %s error=PAM_SUCCESS\n",
+	    pam_return_so);
+	fflush(tf->file);
+	ret = t_authenticate("alpha", PAM_SUCCESS);
+	ret &= t_authenticate("beta", PAM_SUCCESS);
+	t_frewind(tf);
+	t_fprintf(tf, "beta auth required %s error=PAM_AUTH_ERR\n",
+	    pam_return_so);
+	t_fprintf(tf, "alpha auth required %s error=PAM_PERM_DENIED\n",
+	    pam_return_so);
+	fflush(tf->file);
+	ret &= t_authenticate("alpha", PAM_PERM_DENIED);
+	ret &= t_authenticate("beta", PAM_AUTH_ERR);
+	t_fclose(tf);
+	return (ret);
+}
+
+T_FUNC(syntax_error, "syntax error in another service")
+{
+	struct t_file *tf;
+	int ret;
+
+	if ((tf = t_open_conf()) == NULL)
+		return (0);
+	t_fprintf(tf, "alpha auth required %s error=PAM_SUCCESS\n",
+	    pam_return_so);
+	t_fprintf(tf, "beta auth bogus %s\n", pam_return_so);
+	fflush(tf->file);
+	ret = t_authenticate("alpha", PAM_SUCCESS);
+	t_fclose(tf);
+	return (ret);
+}
+
+
+/***************************************************************************
+ * Boilerplate
+ */
+
+static int
+t_prepare(int argc, char *argv[])
+{
+
+	(void)argc;
+	(void)argv;
+
+	if ((pam_return_so = getenv("PAM_RETURN_SO")) == NULL) {
+		t_printv("define PAM_RETURN_SO before running these tests\n");
+		return (0);
+	}
+
+	openpam_set_feature(OPENPAM_RESTRICT_MODULE_NAME, 0);
+	openpam_set_feature(OPENPAM_VERIFY_MODULE_FILE, 0);
+	openpam_set_feature(OPENPAM_RESTRICT_SERVICE_NAME, 0);
+	openpam_set_feature(OPENPAM_VERIFY_POLICY_FILE, 0);
+	openpam_set_feature(OPENPAM_FALLBACK_TO_OTHER, 0);
+
+	T(interleaved);
+	T(changed);
+	T(syntax_error);
+
+	return (0);
+}
+
+int
+main(int argc, char *argv[])
+{
+
+	t_main(t_prepare, NULL, argc, argv);
+}
@@ -0,0 +1,241 @@
+/*-
+ * Copyright (c) 2026 Dag-Erling Smørgrav
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote
+ *    products derived from this software without specific prior written
+ *    permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $OpenPAM$
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <sys/stat.h>
+
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <cryb/test.h>
+
+#include <security/pam_appl.h>
+#include <security/openpam.h>
+
+#include "openpam_impl.h"
+#include "t_pam_conv.h"
+#include "t_pam_policy.h"
+
+#define T_FUNC(n, d)							\
+	static const char *t_ ## n ## _desc = d;			\
+	static int t_ ## n ## _func(OPENPAM_UNUSED(char **desc),	\
+	    OPENPAM_UNUSED(void *arg))
+
+#define T(n)								\
+	t_add_test(&t_ ## n ## _func, NULL, "%s", t_ ## n ## _desc)
+
+const char *pam_return_so;
+
+#define T_SERVICE	"t_service"
+#define T_TOPDIR	"/tmp/t_openpam_dircache.XXXXXX"
+
+/*
+ * Scratch directory which serves as the policy search path.  The
+ * buffers are sized for the longest names they can hold.
+ */
+static char t_topdir[sizeof T_TOPDIR];
+static char t_policydir[sizeof t_topdir + sizeof "/pam.d/"];
+static char t_policyfile[sizeof t_policydir + sizeof T_SERVICE];
+static time_t t_old;
+
+/*
+ * Create a fresh search path directory.  If nested is set, the directory
+ * on the search path is a subdirectory of the scratch directory which
+ * does not exist yet.
+ */
+static int
+t_setup(int nested)
+{
+
+	strcpy(t_topdir, T_TOPDIR);
+	if (mkdtemp(t_topdir) == NULL) {
+		t_printv("mkdtemp(): %s\n", strerror(errno));
+		return (0);
+	}
+	snprintf(t_policydir, sizeof t_policydir, "%s/%s", t_topdir,
+	    nested ? "pam.d/" : "");
+	snprintf(t_policyfile, sizeof t_policyfile, "%s%s", t_policydir,
+	    T_SERVICE);
+	openpam_policy_path[0] = t_policydir;
+	openpam_policy_path[1] = NULL;
+	t_old = time(NULL) - 3600;
+	return (1);
+}
+
+static void
+t_cleanup(void)
+{
+	char path[sizeof t_topdir + sizeof "/pam.d"];
+
+	unlink(t_policyfile);
+	snprintf(path, sizeof path, "%s/pam.d", t_topdir);
+	rmdir(path);
+	rmdir(t_topdir);
+}
+
+/*
+ * Set the modification time of a directory well into the past, or to
+ * the present if old is not set.
+ */
+static int
+t_set_mtime(const char *path, int old)
+{
+	struct timespec ts[2];
+
+	ts[0].tv_sec = ts[1].tv_sec = old ? t_old : time(NULL);
+	ts[0].tv_nsec = ts[1].tv_nsec = 0;
+	if (utimensat(AT_FDCWD, path, ts, 0) != 0) {
+		t_printv("utimensat(%s): %s\n", path, strerror(errno));
+		return (0);
+	}
+	return (1);
+}
+
+/*
+ * Create the policy file.
+ */
+static int
+t_create_policy(void)
+{
+	FILE *f;
+
+	mkdir(t_policydir, 0700);
+	if ((f = fopen(t_policyfile, "w")) == NULL) {
+		t_printv("%s: %s\n", t_policyfile, strerror(errno));
+		return (0);
+	}
+	fprintf(f, "auth required %s error=PAM_SUCCESS\n", pam_return_so);
+	fclose(f);
+	return (1);
+}
+
+
+/***************************************************************************
+ * Tests
+ */
+
+T_FUNC(miss_then_hit, "policy file created after a miss")
+{
+	int ret;
+
+	if (!t_setup(0))
+		return (0);
+	ret = t_set_mtime(t_topdir, 1) &&
+	    t_authenticate(T_SERVICE, PAM_SYSTEM_ERR) &&
+	    t_create_policy() &&
+	    t_authenticate(T_SERVICE, PAM_SUCCESS);
+	t_cleanup();
+	return (ret);
+}
+
+T_FUNC(cached_miss, "miss answered from the cache")
+{
+	int ret;
+
+	if (!t_setup(0))
+		return (0);
+	/* sneak the file in without changing the directory's mtime */
+	ret = t_set_mtime(t_topdir, 1) &&
+	    t_authenticate(T_SERVICE, PAM_SYSTEM_ERR) &&
+	    t_create_policy() &&
+	    t_set_mtime(t_topdir, 1) &&
+	    t_authenticate(T_SERVICE, PAM_SYSTEM_ERR) &&
+	    t_set_mtime(t_topdir, 0) &&
+	    t_authenticate(T_SERVICE, PAM_SUCCESS);
+	t_cleanup();
+	return (ret);
+}
+
+T_FUNC(missing_dir, "directory missing from the search path")
+{
+	int ret;
+
+	if (!t_setup(1))
+		return (0);
+	/* sneak the directory in without changing its parent's mtime */
+	ret = t_set_mtime(t_topdir, 1) &&
+	    t_authenticate(T_SERVICE, PAM_SYSTEM_ERR) &&
+	    t_create_policy() &&
+	    t_set_mtime(t_topdir, 1) &&
+	    t_authenticate(T_SERVICE, PAM_SYSTEM_ERR) &&
+	    t_set_mtime(t_topdir, 0) &&
+	    t_authenticate(T_SERVICE, PAM_SUCCESS);
+	t_cleanup();
+	return (ret);
+}
+
+
+/***************************************************************************
+ * Boilerplate
+ */
+
+static int
+t_prepare(int argc, char *argv[])
+{
+
+	(void)argc;
+	(void)argv;
+
+	if ((pam_return_so = getenv("PAM_RETURN_SO")) == NULL) {
+		t_printv("define PAM_RETURN_SO before running these tests\n");
+		return (0);
+	}
+
+	openpam_set_feature(OPENPAM_RESTRICT_MODULE_NAME, 0);
+	openpam_set_feature(OPENPAM_VERIFY_MODULE_FILE, 0);
+	openpam_set_feature(OPENPAM_RESTRICT_SERVICE_NAME, 0);
+	openpam_set_feature(OPENPAM_VERIFY_POLICY_FILE, 0);
+	openpam_set_feature(OPENPAM_FALLBACK_TO_OTHER, 0);
+	openpam_set_feature(OPENPAM_CACHE_POLICY_PATH, 1);
+
+	T(miss_then_hit);
+	T(cached_miss);
+	T(missing_dir);
+
+	return (0);
+}
+
+int
+main(int argc, char *argv[])
+{
+
+	t_main(t_prepare, NULL, argc, argv);
+}
@@ -183,6 +183,447 @@ T_FUNC(mod_return, "module return value")
 	return (1);
 }
 
+/*
+ * Linux-PAM style controls.  Each policy line gives the control and the
+ * value the module should return; the module name is filled in.
+ */
+static struct t_pam_control_case {
+	const char	*desc;
+	const char	*line[4];
+	int		 result;
+} t_pam_control_cases[] = {
+	{
+		"jump over a module on success",
+		{
+			"[success=1 default=ignore] PAM_SUCCESS",
+			"requisite PAM_AUTH_ERR",
+			"required PAM_SUCCESS",
+		},
+		PAM_SUCCESS,
+	},
+	{
+		"no jump on failure",
+		{
+			"[success=1 default=ignore] PAM_USER_UNKNOWN",
+			"requisite PAM_AUTH_ERR",
+			"required PAM_SUCCESS",
+		},
+		PAM_AUTH_ERR,
+	},
+	{
+		"jump on a specific return code",
+		{
+			"[success=ok user_unknown=2 default=bad] "
+			    "PAM_USER_UNKNOWN",
+			"required PAM_AUTH_ERR",
+			"required PAM_AUTH_ERR",
+			"required PAM_SUCCESS",
+		},
+		PAM_SUCCESS,
+	},
+	{
+		"jump past the end of the chain",
+		{
+			"required PAM_SUCCESS",
+			"[success=5 default=bad] PAM_SUCCESS",
+			"required PAM_AUTH_ERR",
+		},
+		PAM_SUCCESS,
+	},
+	{
+		"bad by default",
+		{
+			"[success=ok] PAM_AUTHINFO_UNAVAIL",
+			"required PAM_SUCCESS",
+		},
+		PAM_AUTHINFO_UNAVAIL,
+	},
+	{
+		"bad on PAM_IGNORE",
+		{
+			"[success=ok default=bad] PAM_IGNORE",
+			"required PAM_SUCCESS",
+		},
+		PAM_PERM_DENIED,
+	},
+	{
+		"die",
+		{
+			"[success=ok default=die] PAM_USER_UNKNOWN",
+			"required PAM_AUTH_ERR",
+		},
+		PAM_USER_UNKNOWN,
+	},
+	{
+		"done",
+		{
+			"[success=done default=ignore] PAM_SUCCESS",
+			"required PAM_AUTH_ERR",
+		},
+		PAM_SUCCESS,
+	},
+	{
+		"done does not override an earlier failure",
+		{
+			"required PAM_AUTH_ERR",
+			"[success=done default=ignore] PAM_SUCCESS",
+			"required PAM_SUCCESS",
+		},
+		PAM_AUTH_ERR,
+	},
+	{
+		"reset",
+		{
+			"required PAM_AUTH_ERR",
+			"[default=reset] PAM_IGNORE",
+			"required PAM_SUCCESS",
+		},
+		PAM_SUCCESS,
+	},
+	{
+		"spread over several words",
+		{
+			"[ success=1  default=ignore ] PAM_SUCCESS",
+			"requisite PAM_AUTH_ERR",
+			"required PAM_SUCCESS",
+		},
+		PAM_SUCCESS,
+	},
+	{
+		"invalid action",
+		{
+			"[success=maybe] PAM_SUCCESS",
+		},
+		-1,
+	},
+	{
+		"invalid return code",
+		{
+			"[bogus=ok] PAM_SUCCESS",
+		},
+		-1,
+	},
+	{
+		"unterminated",
+		{
+			"[success=ok default=bad PAM_SUCCESS",
+		},
+		-1,
+	},
+};
+
+T_FUNC(linux_control, "Linux-PAM style controls")
+{
+	struct t_pam_control_case *tc;
+	struct t_pam_conv_script script;
+	struct pam_conv pamc;
+	struct t_file *tf;
+	pam_handle_t *pamh;
+	const char *modret;
+	unsigned int i, j, n;
+	int pam_err, ret;
+
+	memset(&script, 0, sizeof script);
+	pamc.conv = &t_pam_conv;
+	pamc.appdata_ptr = &script;
+	ret = 1;
+	n = sizeof t_pam_control_cases / sizeof t_pam_control_cases[0];
+	for (i = 0; i < n; ++i) {
+		tc = &t_pam_control_cases[i];
+		tf = t_fopen(NULL);
+		for (j = 0; j < 4 && tc->line[j] != NULL; ++j) {
+			modret = strrchr(tc->line[j], ' ');
+			t_fprintf(tf, "auth %.*s %s error=%s\n",
+			    (int)(modret - tc->line[j]), tc->line[j],
+			    pam_return_so, modret + 1);
+		}
+		pam_err = pam_start(tf->name, "test", &pamc, &pamh);
+		if (pam_err == PAM_SUCCESS) {
+			pam_err = pam_authenticate(pamh, 0);
+			pam_end(pamh, pam_err);
+		} else if (tc->result < 0) {
+			pam_err = -1;
+		}
+		t_printv("%s: %d\n", tc->desc, pam_err);
+		if (pam_err != tc->result) {
+			t_printv("%s: expected %d\n", tc->desc, tc->result);
+			ret = 0;
+		}
+		t_fclose(tf);
+	}
+	return (ret);
+}
+
+static struct t_pam_guard_case {
+	const char	*guard;
+	const char	*user;
+	const char	*rhost;
+	int		 result;
+} t_pam_guard_cases[] = {
+	{ "?user=root",			"test",	NULL,		PAM_SUCCESS },
+	{ "?user=root",			"root",	NULL,		PAM_AUTH_ERR },
+	{ "?user!=root",		"test",	NULL,		PAM_AUTH_ERR },
+	{ "?user=te*",			"test",	NULL,		PAM_AUTH_ERR },
+	{ "?user=te*",			"root",	NULL,		PAM_SUCCESS },
+	{ "?rhost=*.example.com",	"test",	"a.example.com",
+	    PAM_AUTH_ERR },
+	{ "?rhost=*.example.com",	"test",	"example.com",
+	    PAM_SUCCESS },
+	{ "?rhost=",			"test",	NULL,		PAM_AUTH_ERR },
+	{ "?rhost!=",			"test",	NULL,		PAM_SUCCESS },
+	{ "?user=[rt]oo?",		"root",	NULL,		PAM_AUTH_ERR },
+	{ "?user=[rt]oo?",		"test",	NULL,		PAM_SUCCESS },
+	{ "?user!=root ?rhost=*.com",	"test",	"example.com",
+	    PAM_AUTH_ERR },
+	{ "?user!=root ?rhost=*.com",	"root",	"example.com",
+	    PAM_SUCCESS },
+	{ "?shell=/bin/sh",		"test",	NULL,		-1 },
+	{ "?user",			"test",	NULL,		-1 },
+};
+
+T_FUNC(guards, "guards")
+{
+	struct t_pam_guard_case *tc;
+	struct t_pam_conv_script script;
+	struct pam_conv pamc;
+	struct t_file *tf;
+	pam_handle_t *pamh;
+	unsigned int i, n;
+	int pam_err, ret;
+
+	memset(&script, 0, sizeof script);
+	pamc.conv = &t_pam_conv;
+	pamc.appdata_ptr = &script;
+	ret = 1;
+	n = sizeof t_pam_guard_cases / sizeof t_pam_guard_cases[0];
+	for (i = 0; i < n; ++i) {
+		tc = &t_pam_guard_cases[i];
+		tf = t_fopen(NULL);
+		t_fprintf(tf, "auth required %s error=PAM_SUCCESS\n",
+		    pam_return_so);
+		t_fprintf(tf, "auth required %s %s error=PAM_AUTH_ERR\n",
+		    tc->guard, pam_return_so);
+		pam_err = pam_start(tf->name, tc->user, &pamc, &pamh);
+		if (pam_err == PAM_SUCCESS) {
+			if (tc->rhost != NULL)
+				pam_set_item(pamh, PAM_RHOST, tc->rhost);
+			pam_err = pam_authenticate(pamh, 0);
+			pam_end(pamh, pam_err);
+		} else if (tc->result < 0) {
+			pam_err = -1;
+		}
+		t_printv("%s user=%s rhost=%s: %d\n", tc->guard, tc->user,
+		    tc->rhost ? tc->rhost : "(null)", pam_err);
+		if (pam_err != tc->result) {
+			t_printv("expected %d\n", tc->result);
+			ret = 0;
+		}
+		t_fclose(tf);
+	}
+	return (ret);
+}
+
+T_FUNC(guards_lazy, "guards with deferred module loading")
+{
+	struct t_pam_conv_script script;
+	struct pam_conv pamc;
+	struct t_file *tf;
+	pam_handle_t *pamh;
+	int pam_err, ret;
+
+	memset(&script, 0, sizeof script);
+	pamc.conv = &t_pam_conv;
+	pamc.appdata_ptr = &script;
+	tf = t_fopen(NULL);
+	t_fprintf(tf, "auth required %s error=PAM_SUCCESS\n",
+	    pam_return_so);
+	t_fprintf(tf, "auth required ?user=root "
+	    "/nonexistent/pam_t_missing.so\n");
+	openpam_set_feature(OPENPAM_LAZY_MODULES, 1);
+	pam_err = pam_start(tf->name, "test", &pamc, &pamh);
+	openpam_set_feature(OPENPAM_LAZY_MODULES, 0);
+	t_printv("pam_start() returned %d\n", pam_err);
+	if (pam_err != PAM_SUCCESS) {
+		t_fclose(tf);
+		return (0);
+	}
+	/* the missing module is never needed, so never loaded */
+	pam_err = pam_authenticate(pamh, 0);
+	t_printv("pam_authenticate() returned %d\n", pam_err);
+	ret = (pam_err == PAM_SUCCESS);
+	pam_end(pamh, pam_err);
+	t_fclose(tf);
+	return (ret);
+}
+
+T_FUNC(include_twice, "service included for several facilities")
+{
+	struct t_pam_conv_script script;
+	struct pam_conv pamc;
+	struct t_file *tf, *tfi;
+	pam_handle_t *pamh;
+	int n[PAM_NUM_FACILITIES];
+	int fclt, pam_err, ret;
+
+	memset(&script, 0, sizeof script);
+	pamc.conv = &t_pam_conv;
+	pamc.appdata_ptr = &script;
+	tfi = t_fopen(NULL);
+	t_fprintf(tfi, "auth required %s error=PAM_SUCCESS\n",
+	    pam_return_so);
+	t_fprintf(tfi, "account required %s error=PAM_PERM_DENIED\n",
+	    pam_return_so);
+	t_fprintf(tfi, "session required %s error=PAM_SUCCESS\n",
+	    pam_return_so);
+	tf = t_fopen(NULL);
+	t_fprintf(tf, "auth include %s\n", tfi->name);
+	t_fprintf(tf, "auth required %s error=PAM_AUTH_ERR\n",
+	    pam_return_so);
+	t_fprintf(tf, "account include %s\n", tfi->name);
+	pam_err = pam_start(tf->name, "test", &pamc, &pamh);
+	if (pam_err != PAM_SUCCESS) {
+		t_printv("pam_start() returned %d\n", pam_err);
+		t_fclose(tf);
+		t_fclose(tfi);
+		return (0);
+	}
+	for (fclt = 0; fclt < PAM_NUM_FACILITIES; ++fclt) {
+		n[fclt] = openpam_chain_length(pamh->chains[fclt]);
+		t_printv("%s: %d entries\n", pam_facility_name[fclt],
+		    n[fclt]);
+	}
+	ret = (n[PAM_AUTH] == 2 && n[PAM_ACCOUNT] == 1 &&
+	    n[PAM_SESSION] == 0 && n[PAM_PASSWORD] == 0);
+	pam_err = pam_authenticate(pamh, 0);
+	t_printv("pam_authenticate() returned %d\n", pam_err);
+	ret &= (pam_err == PAM_AUTH_ERR);
+	pam_err = pam_acct_mgmt(pamh, 0);
+	t_printv("pam_acct_mgmt() returned %d\n", pam_err);
+	ret &= (pam_err == PAM_PERM_DENIED);
+	pam_end(pamh, pam_err);
+	t_fclose(tf);
+	t_fclose(tfi);
+	return (ret);
+}
+
+T_FUNC(include_diamond, "service included along several paths")
+{
+	struct t_pam_conv_script script;
+	struct pam_conv pamc;
+	struct t_file *tf, *tfl, *tfr, *tfb;
+	pam_handle_t *pamh;
+	int n, pam_err, ret;
+
+	memset(&script, 0, sizeof script);
+	pamc.conv = &t_pam_conv;
+	pamc.appdata_ptr = &script;
+	tfb = t_fopen(NULL);
+	t_fprintf(tfb, "auth required %s error=PAM_SUCCESS\n",
+	    pam_return_so);
+	tfl = t_fopen(NULL);
+	t_fprintf(tfl, "auth include %s\n", tfb->name);
+	tfr = t_fopen(NULL);
+	t_fprintf(tfr, "auth include %s\n", tfb->name);
+	t_fprintf(tfr, "auth required %s error=PAM_SUCCESS\n",
+	    pam_return_so);
+	tf = t_fopen(NULL);
+	t_fprintf(tf, "auth include %s\n", tfl->name);
+	t_fprintf(tf, "auth include %s\n", tfr->name);
+	t_fprintf(tf, "auth include %s\n", tfb->name);
+	pam_err = pam_start(tf->name, "test", &pamc, &pamh);
+	if (pam_err != PAM_SUCCESS) {
+		t_printv("pam_start() returned %d\n", pam_err);
+		ret = 0;
+	} else {
+		n = openpam_chain_length(pamh->chains[PAM_AUTH]);
+		t_printv("auth: %d entries\n", n);
+		ret = (n == 4);
+		pam_err = pam_authenticate(pamh, 0);
+		t_printv("pam_authenticate() returned %d\n", pam_err);
+		ret &= (pam_err == PAM_SUCCESS);
+		pam_end(pamh, pam_err);
+	}
+	t_fclose(tf);
+	t_fclose(tfr);
+	t_fclose(tfl);
+	t_fclose(tfb);
+	return (ret);
+}
+
+T_FUNC(include_loop, "include loop")
+{
+	struct t_pam_conv_script script;
+	struct pam_conv pamc;
+	struct t_file *tf, *tfi;
+	pam_handle_t *pamh;
+	int pam_err;
+
+	memset(&script, 0, sizeof script);
+	pamc.conv = &t_pam_conv;
+	pamc.appdata_ptr = &script;
+	tf = t_fopen(NULL);
+	tfi = t_fopen(NULL);
+	t_fprintf(tf, "auth include %s\n", tfi->name);
+	t_fprintf(tfi, "auth required %s error=PAM_SUCCESS\n",
+	    pam_return_so);
+	t_fprintf(tfi, "auth include %s\n", tf->name);
+	pam_err = pam_start(tf->name, "test", &pamc, &pamh);
+	t_printv("pam_start() returned %d\n", pam_err);
+	if (pam_err == PAM_SUCCESS)
+		pam_end(pamh, pam_err);
+	t_fclose(tf);
+	t_fclose(tfi);
+	return (pam_err == PAM_SYSTEM_ERR);
+}
+
+T_FUNC(lazy_modules, "deferred module loading")
+{
+	struct t_pam_conv_script script;
+	struct pam_conv pamc;
+	struct t_file *tf;
+	pam_handle_t *pamh;
+	int pam_err, ret;
+
+	memset(&script, 0, sizeof script);
+	pamc.conv = &t_pam_conv;
+	pamc.appdata_ptr = &script;
+	tf = t_fopen(NULL);
+	t_fprintf(tf, "auth required %s error=PAM_SUCCESS\n",
+	    pam_return_so);
+	t_fprintf(tf, "session required /nonexistent/pam_t_missing.so\n");
+	/* without deferred loading, the missing module is fatal */
+	pam_err = pam_start(tf->name, "test", &pamc, &pamh);
+	t_printv("pam_start() returned %d\n", pam_err);
+	if (pam_err == PAM_SUCCESS)
+		pam_end(pamh, pam_err);
+	ret = (pam_err == PAM_SYSTEM_ERR);
+	/* with deferred loading, it is only fatal when needed */
+	openpam_set_feature(OPENPAM_LAZY_MODULES, 1);
+	pam_err = pam_start(tf->name, "test", &pamc, &pamh);
+	openpam_set_feature(OPENPAM_LAZY_MODULES, 0);
+	t_printv("pam_start() returned %d\n", pam_err);
+	if (pam_err != PAM_SUCCESS) {
+		t_fclose(tf);
+		return (0);
+	}
+	ret &= (pamh->chains[PAM_AUTH]->module == NULL &&
+	    pamh->chains[PAM_SESSION]->module == NULL);
+	pam_err = pam_authenticate(pamh, 0);
+	t_printv("pam_authenticate() returned %d\n", pam_err);
+	ret &= (pam_err == PAM_SUCCESS &&
+	    pamh->chains[PAM_AUTH]->module != NULL &&
+	    pamh->chains[PAM_SESSION]->module == NULL);
+	pam_err = pam_open_session(pamh, 0);
+	t_printv("pam_open_session() returned %d\n", pam_err);
+	ret &= (pam_err == PAM_SYSTEM_ERR);
+	pam_err = openpam_check_modules(pamh);
+	t_printv("openpam_check_modules() returned %d\n", pam_err);
+	ret &= (pam_err == PAM_SYSTEM_ERR);
+	pam_end(pamh, pam_err);
+	t_fclose(tf);
+	return (ret);
+}
+
 
 /***************************************************************************
  * Boilerplate
@@ -208,6 +649,13 @@ t_prepare(int argc, char *argv[])
 
 	T(empty_policy);
 	T(mod_return);
+	T(linux_control);
+	T(guards);
+	T(guards_lazy);
+	T(include_twice);
+	T(include_diamond);
+	T(include_loop);
+	T(lazy_modules);
 
 	return (0);
 }
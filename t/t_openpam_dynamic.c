@@ -0,0 +1,345 @@
+/*-
+ * Copyright (c) 2026 Dag-Erling Smørgrav
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote
+ *    products derived from this software without specific prior written
+ *    permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $OpenPAM$
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <sys/stat.h>
+
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <cryb/test.h>
+
+#include <security/pam_appl.h>
+#include <security/openpam.h>
+
+#include "openpam_impl.h"
+#include "t_pam_conv.h"
+
+#define T_FUNC(n, d)							\
+	static const char *t_ ## n ## _desc = d;			\
+	static int t_ ## n ## _func(OPENPAM_UNUSED(char **desc),	\
+	    OPENPAM_UNUSED(void *arg))
+
+#define T(n)								\
+	t_add_test(&t_ ## n ## _func, NULL, "%s", t_ ## n ## _desc)
+
+const char *pam_return_so;
+
+static struct t_pam_conv_script t_script;
+static struct pam_conv t_pamc = { &t_pam_conv, &t_script };
+
+/*
+ * Scratch directory which serves as the module path.
+ */
+static char t_moddir[PATH_MAX];
+static char t_modfile[PATH_MAX];
+static time_t t_old;
+
+static int
+t_setup(const char *modname)
+{
+
+	strcpy(t_moddir, "/tmp/t_openpam_dynamic.XXXXXX");
+	if (mkdtemp(t_moddir) == NULL) {
+		t_printv("mkdtemp(): %s\n", strerror(errno));
+		return (0);
+	}
+	snprintf(t_modfile, sizeof t_modfile, "%s/%s%s", t_moddir,
+	    modname, PAM_SOEXT);
+	openpam_module_path[0] = t_moddir;
+	openpam_module_path[1] = NULL;
+	t_old = time(NULL) - 3600;
+	return (1);
+}
+
+static void
+t_cleanup(void)
+{
+
+	unlink(t_modfile);
+	rmdir(t_moddir);
+}
+
+/*
+ * Set the modification time of the module directory well into the past,
+ * or to the present if old is not set.
+ */
+static int
+t_set_mtime(int old)
+{
+	struct timespec ts[2];
+
+	ts[0].tv_sec = ts[1].tv_sec = old ? t_old : time(NULL);
+	ts[0].tv_nsec = ts[1].tv_nsec = 0;
+	if (utimensat(AT_FDCWD, t_moddir, ts, 0) != 0) {
+		t_printv("utimensat(%s): %s\n", t_moddir, strerror(errno));
+		return (0);
+	}
+	return (1);
+}
+
+/*
+ * Install the module under the name we will be looking for.
+ */
+static int
+t_install(void)
+{
+
+	if (symlink(pam_return_so, t_modfile) != 0) {
+		t_printv("symlink(%s): %s\n", t_modfile, strerror(errno));
+		return (0);
+	}
+	return (1);
+}
+
+/*
+ * Start a transaction with a policy which uses the specified module, and
+ * verify that the module was or was not found, as expected.
+ */
+static int
+t_start(const char *modname, int expected)
+{
+	struct t_file *tf;
+	pam_handle_t *pamh;
+	int pam_err;
+
+	tf = t_fopen(NULL);
+	t_fprintf(tf, "auth required %s error=PAM_SUCCESS\n", modname);
+	fflush(tf->file);
+	pam_err = pam_start(tf->name, "test", &t_pamc, &pamh);
+	t_printv("pam_start() returned %d\n", pam_err);
+	if (pam_err == PAM_SUCCESS) {
+		pam_err = pam_authenticate(pamh, 0);
+		t_printv("pam_authenticate() returned %d\n", pam_err);
+		pam_end(pamh, pam_err);
+	}
+	t_fclose(tf);
+	return (pam_err == expected);
+}
+
+/*
+ * Start a transaction with the given policy, and return the module the
+ * first entry in its auth chain points to.
+ */
+static pam_module_t *
+t_module(const char *service, pam_handle_t **pamhp)
+{
+	pam_chain_t *chain;
+	int pam_err;
+
+	pam_err = pam_start(service, "test", &t_pamc, pamhp);
+	t_printv("pam_start() returned %d\n", pam_err);
+	if (pam_err != PAM_SUCCESS) {
+		*pamhp = NULL;
+		return (NULL);
+	}
+	chain = (*pamhp)->chains[PAM_AUTH];
+	if (chain == NULL || OPENPAM_CHAIN_END(chain)) {
+		t_printv("empty auth chain\n");
+		return (NULL);
+	}
+	return (chain->module);
+}
+
+
+/***************************************************************************
+ * Tests
+ */
+
+T_FUNC(found, "module found on the module path")
+{
+	int ret;
+
+	if (!t_setup("pam_t_found"))
+		return (0);
+	ret = t_install() &&
+	    t_set_mtime(1) &&
+	    t_start("pam_t_found", PAM_SUCCESS) &&
+	    t_start("pam_t_found", PAM_SUCCESS);
+	t_cleanup();
+	return (ret);
+}
+
+T_FUNC(cached_miss, "missing module remembered")
+{
+	int ret;
+
+	if (!t_setup("pam_t_missing"))
+		return (0);
+	/* sneak the module in without changing the directory's mtime */
+	ret = t_set_mtime(1) &&
+	    t_start("pam_t_missing", PAM_SYSTEM_ERR) &&
+	    t_install() &&
+	    t_set_mtime(1) &&
+	    t_start("pam_t_missing", PAM_SYSTEM_ERR) &&
+	    t_set_mtime(0) &&
+	    t_start("pam_t_missing", PAM_SUCCESS);
+	t_cleanup();
+	return (ret);
+}
+
+T_FUNC(removed, "module removed")
+{
+	int ret;
+
+	if (!t_setup("pam_t_removed"))
+		return (0);
+	ret = t_install() &&
+	    t_set_mtime(1) &&
+	    t_start("pam_t_removed", PAM_SUCCESS);
+	unlink(t_modfile);
+	ret = ret && t_start("pam_t_removed", PAM_SYSTEM_ERR);
+	t_cleanup();
+	return (ret);
+}
+
+T_FUNC(shared, "module shared between entries and handles")
+{
+	struct t_file *tf;
+	pam_handle_t *pamh[2];
+	pam_module_t *module[2];
+	pam_chain_t *chain;
+	int i, ret;
+
+	if (!t_setup("pam_t_shared"))
+		return (0);
+	tf = t_fopen(NULL);
+	t_fprintf(tf, "auth required %s error=PAM_SUCCESS\n", t_modfile);
+	t_fprintf(tf, "auth required %s error=PAM_SUCCESS\n", t_modfile);
+	fflush(tf->file);
+	pamh[0] = pamh[1] = NULL;
+	ret = t_install();
+	for (i = 0; i < 2; ++i) {
+		module[i] = ret ? t_module(tf->name, &pamh[i]) : NULL;
+		ret = ret && module[i] != NULL;
+	}
+	ret = ret && module[0] == module[1];
+	for (i = 0; i < 2 && ret; ++i) {
+		for (chain = pamh[i]->chains[PAM_AUTH];
+		     !OPENPAM_CHAIN_END(chain); ++chain) {
+			if (chain->module != module[0]) {
+				t_printv("handle %d: %p != %p\n", i,
+				    (void *)chain->module, (void *)module[0]);
+				ret = 0;
+			}
+		}
+	}
+	for (i = 0; i < 2; ++i)
+		if (pamh[i] != NULL)
+			pam_end(pamh[i], PAM_SUCCESS);
+	t_fclose(tf);
+	t_cleanup();
+	return (ret);
+}
+
+T_FUNC(resident, "resident module kept after the last handle")
+{
+	struct t_file *tf;
+	pam_handle_t *pamh;
+	pam_module_t *module;
+	void *dlh;
+	int ret;
+
+	if (!t_setup("pam_t_resident"))
+		return (0);
+	openpam_set_feature(OPENPAM_RESIDENT_MODULES, 1);
+	tf = t_fopen(NULL);
+	t_fprintf(tf, "auth required %s error=PAM_SUCCESS\n", t_modfile);
+	fflush(tf->file);
+	pamh = NULL;
+	module = NULL;
+	ret = t_install() && (module = t_module(tf->name, &pamh)) != NULL;
+	dlh = ret ? module->dlh : NULL;
+	if (pamh != NULL)
+		pam_end(pamh, PAM_SUCCESS);
+	/* if the module was unloaded, it can no longer be found */
+	unlink(t_modfile);
+	if (ret) {
+		ret = t_module(tf->name, &pamh) == module &&
+		    module->dlh == dlh;
+		if (pamh != NULL)
+			pam_end(pamh, PAM_SUCCESS);
+	}
+	openpam_set_feature(OPENPAM_RESIDENT_MODULES, 0);
+	t_fclose(tf);
+	t_cleanup();
+	return (ret);
+}
+
+
+/***************************************************************************
+ * Boilerplate
+ */
+
+static int
+t_prepare(int argc, char *argv[])
+{
+
+	(void)argc;
+	(void)argv;
+
+	if ((pam_return_so = getenv("PAM_RETURN_SO")) == NULL) {
+		t_printv("define PAM_RETURN_SO before running these tests\n");
+		return (0);
+	}
+
+	openpam_set_feature(OPENPAM_RESTRICT_MODULE_NAME, 0);
+	openpam_set_feature(OPENPAM_VERIFY_MODULE_FILE, 0);
+	openpam_set_feature(OPENPAM_RESTRICT_SERVICE_NAME, 0);
+	openpam_set_feature(OPENPAM_VERIFY_POLICY_FILE, 0);
+	openpam_set_feature(OPENPAM_FALLBACK_TO_OTHER, 0);
+
+	T(found);
+	T(cached_miss);
+	T(removed);
+	T(shared);
+	T(resident);
+
+	return (0);
+}
+
+int
+main(int argc, char *argv[])
+{
+
+	t_main(t_prepare, NULL, argc, argv);
+}
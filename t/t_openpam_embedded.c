@@ -0,0 +1,194 @@
+/*-
+ * Copyright (c) 2026 Dag-Erling Smørgrav
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote
+ *    products derived from this software without specific prior written
+ *    permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $OpenPAM$
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <err.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <cryb/test.h>
+
+#include <security/pam_appl.h>
+#include <security/openpam.h>
+
+#include "openpam_impl.h"
+#include "t_pam_conv.h"
+
+#define T_FUNC(n, d)							\
+	static const char *t_ ## n ## _desc = d;			\
+	static int t_ ## n ## _func(OPENPAM_UNUSED(char **desc),	\
+	    OPENPAM_UNUSED(void *arg))
+
+#define T(n)								\
+	t_add_test(&t_ ## n ## _func, NULL, "%s", t_ ## n ## _desc)
+
+const char *pam_return_so;
+
+static struct t_pam_conv_script t_script;
+static struct pam_conv t_pamc = { &t_pam_conv, &t_script };
+
+static int
+t_count(const pam_chain_t *chain)
+{
+	int n;
+
+	n = openpam_chain_length(chain);
+	return (n);
+}
+
+
+/***************************************************************************
+ * Tests
+ */
+
+T_FUNC(embedded_only, "every embedded policy without policy files")
+{
+	pam_policy_t **policy;
+	pam_handle_t *pamh;
+	int fclt, n, pam_err, ret;
+
+	openpam_policy_path[0] = "/nonexistent/";
+	openpam_policy_path[1] = NULL;
+	ret = 1;
+	for (policy = pam_embedded_policies; *policy != NULL; ++policy) {
+		pam_err = pam_start((*policy)->service, "test", &t_pamc,
+		    &pamh);
+		t_printv("pam_start(%s) returned %d\n", (*policy)->service,
+		    pam_err);
+		if (pam_err != PAM_SUCCESS) {
+			ret = 0;
+			continue;
+		}
+		for (fclt = 0; fclt < PAM_NUM_FACILITIES; ++fclt) {
+			n = t_count(pamh->chains[fclt]);
+			t_printv("%s: %d entries\n", pam_facility_name[fclt],
+			    n);
+			ret &= (n == t_count((*policy)->chains[fclt]));
+		}
+		pam_end(pamh, pam_err);
+	}
+	return (ret);
+}
+
+T_FUNC(precedence, "embedded policies and policy files")
+{
+	char dir[PATH_MAX], path[PATH_MAX];
+	const char *service;
+	struct t_file *tf;
+	pam_handle_t *pamh;
+	int pam_err, prefer, ret;
+
+	/* shadow the first embedded policy with a file of our own */
+	service = pam_embedded_policies[0]->service;
+	strcpy(dir, "/tmp/t_openpam_embedded.XXXXXX");
+	if (mkdtemp(dir) == NULL) {
+		t_printv("mkdtemp(): %s\n", strerror(errno));
+		return (0);
+	}
+	snprintf(path, sizeof path, "%s/%s", dir, service);
+	tf = t_fopen(path);
+	t_fprintf(tf, "auth required %s error=PAM_SUCCESS\n", pam_return_so);
+	fflush(tf->file);
+	strcat(dir, "/");
+	openpam_policy_path[0] = dir;
+	openpam_policy_path[1] = NULL;
+	ret = 1;
+	for (prefer = 0; prefer <= 1; ++prefer) {
+		openpam_set_feature(OPENPAM_PREFER_EMBEDDED, prefer);
+		pam_err = pam_start(service, "test", &t_pamc, &pamh);
+		t_printv("pam_start(%s) returned %d\n", service, pam_err);
+		if (pam_err != PAM_SUCCESS) {
+			ret = 0;
+			continue;
+		}
+		/* only the file refers to pam_return by full path */
+		ret &= (pamh->chains[PAM_AUTH] != NULL &&
+		    strcmp(pamh->chains[PAM_AUTH]->modname,
+		    pam_return_so) == 0) == !prefer;
+		pam_end(pamh, pam_err);
+	}
+	openpam_set_feature(OPENPAM_PREFER_EMBEDDED, 1);
+	t_fclose(tf);
+	dir[strlen(dir) - 1] = '\0';
+	rmdir(dir);
+	return (ret);
+}
+
+
+/***************************************************************************
+ * Boilerplate
+ */
+
+static int
+t_prepare(int argc, char *argv[])
+{
+
+	(void)argc;
+	(void)argv;
+
+	if ((pam_return_so = getenv("PAM_RETURN_SO")) == NULL) {
+		t_printv("define PAM_RETURN_SO before running these tests\n");
+		return (0);
+	}
+	if (pam_embedded_policies == NULL ||
+	    pam_embedded_policies[0] == NULL) {
+		t_printv("no embedded policies\n");
+		return (0);
+	}
+
+	/* names will do, the modules may not be anywhere we can find */
+	openpam_set_feature(OPENPAM_LAZY_MODULES, 1);
+	openpam_set_feature(OPENPAM_RESTRICT_MODULE_NAME, 0);
+	openpam_set_feature(OPENPAM_VERIFY_MODULE_FILE, 0);
+	openpam_set_feature(OPENPAM_RESTRICT_SERVICE_NAME, 0);
+	openpam_set_feature(OPENPAM_VERIFY_POLICY_FILE, 0);
+	openpam_set_feature(OPENPAM_FALLBACK_TO_OTHER, 0);
+
+	T(embedded_only);
+	T(precedence);
+
+	return (0);
+}
+
+int
+main(int argc, char *argv[])
+{
+
+	t_main(t_prepare, NULL, argc, argv);
+}
@@ -0,0 +1,211 @@
+/*-
+ * Copyright (c) 2026 Dag-Erling Smørgrav
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote
+ *    products derived from this software without specific prior written
+ *    permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $OpenPAM$
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <err.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <cryb/test.h>
+
+#include <security/pam_appl.h>
+#include <security/openpam.h>
+
+#include "openpam_impl.h"
+#include "t_pam_conv.h"
+#include "t_pam_policy.h"
+
+#define T_FUNC(n, d)							\
+	static const char *t_ ## n ## _desc = d;			\
+	static int t_ ## n ## _func(OPENPAM_UNUSED(char **desc),	\
+	    OPENPAM_UNUSED(void *arg))
+
+#define T(n)								\
+	t_add_test(&t_ ## n ## _func, NULL, "%s", t_ ## n ## _desc)
+
+const char *pam_return_so;
+
+/*
+ * Compile the given policy into the given image.
+ */
+static int
+t_write_image(struct t_file *img, struct t_file *tf)
+{
+	const char *service;
+	int pam_err;
+
+	service = tf->name;
+	openpam_policy_image = img->name;
+	pam_err = openpam_image_write(img->name, 1, &service);
+	if (pam_err != PAM_SUCCESS) {
+		t_printv("openpam_image_write() returned %d\n", pam_err);
+		return (0);
+	}
+	return (1);
+}
+
+
+/***************************************************************************
+ * Tests
+ */
+
+T_FUNC(hit, "compiled policy")
+{
+	struct t_file *img, *tf;
+	int ret;
+
+	img = t_fopen(NULL);
+	tf = t_fopen(NULL);
+	t_write_policy(tf, PAM_SUCCESS);
+	ret = t_write_image(img, tf);
+	ret &= t_authenticate(tf->name, PAM_SUCCESS);
+	ret &= t_authenticate(tf->name, PAM_SUCCESS);
+	t_fclose(tf);
+	t_fclose(img);
+	return (ret);
+}
+
+T_FUNC(guards, "compiled policy with guards")
+{
+	struct t_file *img, *tf;
+	int ret;
+
+	img = t_fopen(NULL);
+	tf = t_fopen(NULL);
+	t_fprintf(tf, "auth required %s error=PAM_SUCCESS\n",
+	    pam_return_so);
+	t_fprintf(tf, "auth required ?user=root %s error=PAM_AUTH_ERR\n",
+	    pam_return_so);
+	fflush(tf->file);
+	ret = t_write_image(img, tf);
+	ret &= t_authenticate(tf->name, PAM_SUCCESS);
+	t_fclose(tf);
+	t_fclose(img);
+	return (ret);
+}
+
+T_FUNC(stale, "policy modified after compilation")
+{
+	struct t_file *img, *tf;
+	int ret;
+
+	img = t_fopen(NULL);
+	tf = t_fopen(NULL);
+	t_write_policy(tf, PAM_SUCCESS);
+	ret = t_write_image(img, tf);
+	ret &= t_authenticate(tf->name, PAM_SUCCESS);
+	t_write_policy(tf, PAM_AUTH_ERR);
+	ret &= t_authenticate(tf->name, PAM_AUTH_ERR);
+	t_fclose(tf);
+	t_fclose(img);
+	return (ret);
+}
+
+T_FUNC(missing, "policy not in image")
+{
+	struct t_file *img, *tf, *other;
+	int ret;
+
+	img = t_fopen(NULL);
+	tf = t_fopen(NULL);
+	other = t_fopen(NULL);
+	t_write_policy(tf, PAM_SUCCESS);
+	t_write_policy(other, PAM_AUTH_ERR);
+	ret = t_write_image(img, tf);
+	ret &= t_authenticate(other->name, PAM_AUTH_ERR);
+	t_fclose(other);
+	t_fclose(tf);
+	t_fclose(img);
+	return (ret);
+}
+
+T_FUNC(corrupt, "corrupt image")
+{
+	struct t_file *img, *tf;
+	int ret;
+
+	img = t_fopen(NULL);
+	tf = t_fopen(NULL);
+	t_write_policy(tf, PAM_AUTH_ERR);
+	openpam_policy_image = img->name;
+	t_fprintf(img, "this is not a policy image\n");
+	fflush(img->file);
+	ret = t_authenticate(tf->name, PAM_AUTH_ERR);
+	t_fclose(tf);
+	t_fclose(img);
+	return (ret);
+}
+
+
+/***************************************************************************
+ * Boilerplate
+ */
+
+static int
+t_prepare(int argc, char *argv[])
+{
+
+	(void)argc;
+	(void)argv;
+
+	if ((pam_return_so = getenv("PAM_RETURN_SO")) == NULL) {
+		t_printv("define PAM_RETURN_SO before running these tests\n");
+		return (0);
+	}
+
+	openpam_set_feature(OPENPAM_RESTRICT_MODULE_NAME, 0);
+	openpam_set_feature(OPENPAM_VERIFY_MODULE_FILE, 0);
+	openpam_set_feature(OPENPAM_RESTRICT_SERVICE_NAME, 0);
+	openpam_set_feature(OPENPAM_VERIFY_POLICY_FILE, 0);
+	openpam_set_feature(OPENPAM_FALLBACK_TO_OTHER, 0);
+	openpam_set_feature(OPENPAM_POLICY_IMAGE, 1);
+
+	T(hit);
+	T(guards);
+	T(stale);
+	T(missing);
+	T(corrupt);
+
+	return (0);
+}
+
+int
+main(int argc, char *argv[])
+{
+
+	t_main(t_prepare, NULL, argc, argv);
+}
@@ -0,0 +1,198 @@
+/*-
+ * Copyright (c) 2026 Dag-Erling Smørgrav
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote
+ *    products derived from this software without specific prior written
+ *    permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $OpenPAM$
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <cryb/test.h>
+
+#include <security/pam_appl.h>
+#include <security/openpam.h>
+
+#include "openpam_impl.h"
+
+#define T_FUNC(n, d)							\
+	static const char *t_ ## n ## _desc = d;			\
+	static int t_ ## n ## _func(OPENPAM_UNUSED(char **desc),	\
+	    OPENPAM_UNUSED(void *arg))
+
+#define T(n)								\
+	t_add_test(&t_ ## n ## _func, NULL, "%s", t_ ## n ## _desc)
+
+const char *pam_return_so;
+struct pam_conv t_null_pamc;
+
+/*
+ * Look up an option and compare the result to what we expected.
+ */
+static int
+t_find(const pam_optidx_t *idx, const char *option, const char *expected)
+{
+	const char *value;
+
+	value = openpam_optidx_find(idx, option);
+	if (value == NULL && expected == NULL)
+		return (1);
+	if (value != NULL && expected != NULL && strcmp(value, expected) == 0)
+		return (1);
+	t_printv("%s: expected %s%s%s, got %s%s%s\n", option,
+	    expected ? "\"" : "", expected ? expected : "NULL",
+	    expected ? "\"" : "",
+	    value ? "\"" : "", value ? value : "NULL", value ? "\"" : "");
+	return (0);
+}
+
+
+/***************************************************************************
+ * Tests
+ */
+
+T_FUNC(lookup, "option lookup")
+{
+	static char *optv[] = {
+		"zeta",
+		"debug",
+		"alpha=1",
+		"mid=x=y",
+		"alpha=2",
+		"debugx",
+		"empty=",
+		NULL
+	};
+	pam_optidx_t *idx;
+	int ret;
+
+	if ((idx = openpam_optidx(7, optv)) == NULL)
+		return (0);
+	ret = t_find(idx, "alpha", "1") &
+	    t_find(idx, "debug", "") &
+	    t_find(idx, "debugx", "") &
+	    t_find(idx, "deb", NULL) &
+	    t_find(idx, "debugxx", NULL) &
+	    t_find(idx, "empty", "") &
+	    t_find(idx, "mid", "x=y") &
+	    t_find(idx, "zeta", "") &
+	    t_find(idx, "beta", NULL) &
+	    t_find(idx, "", NULL);
+	ret &= idx->flags == OPENPAM_OPT_DEBUG;
+	free(idx);
+	return (ret);
+}
+
+T_FUNC(empty, "empty option list")
+{
+	static char *optv[] = { NULL };
+	pam_optidx_t *idx;
+	int ret;
+
+	if ((idx = openpam_optidx(0, optv)) == NULL)
+		return (0);
+	ret = t_find(idx, "debug", NULL) && idx->flags == 0;
+	free(idx);
+	return (ret);
+}
+
+T_FUNC(set_option, "index follows openpam_set_option()")
+{
+	struct t_file *tf;
+	pam_handle_t *pamh;
+	const char *value;
+	int ret;
+
+	tf = t_fopen(NULL);
+	t_fprintf(tf, "auth required %s error=PAM_SUCCESS debug\n",
+	    pam_return_so);
+	if (pam_start(tf->name, "test", &t_null_pamc, &pamh) != PAM_SUCCESS) {
+		t_fclose(tf);
+		return (0);
+	}
+	/* pretend to be the module */
+	pamh->current = pamh->chains[PAM_AUTH];
+	ret = openpam_get_option_flag(pamh, OPENPAM_OPT_DEBUG) &&
+	    !openpam_get_option_flag(pamh, OPENPAM_OPT_ECHO_PASS) &&
+	    openpam_set_option(pamh, "echo_pass", "") == PAM_SUCCESS &&
+	    openpam_get_option_flag(pamh, OPENPAM_OPT_ECHO_PASS) &&
+	    openpam_set_option(pamh, "debug", NULL) == PAM_SUCCESS &&
+	    !openpam_get_option_flag(pamh, OPENPAM_OPT_DEBUG) &&
+	    openpam_get_option(pamh, "debug") == NULL &&
+	    openpam_set_option(pamh, "error", "PAM_AUTH_ERR") ==
+	    PAM_SUCCESS &&
+	    (value = openpam_get_option(pamh, "error")) != NULL &&
+	    strcmp(value, "PAM_AUTH_ERR") == 0;
+	pamh->current = NULL;
+	pam_end(pamh, PAM_SUCCESS);
+	t_fclose(tf);
+	return (ret);
+}
+
+
+/***************************************************************************
+ * Boilerplate
+ */
+
+static int
+t_prepare(int argc, char *argv[])
+{
+
+	(void)argc;
+	(void)argv;
+
+	T(lookup);
+	T(empty);
+
+	if ((pam_return_so = getenv("PAM_RETURN_SO")) == NULL) {
+		t_printv("define PAM_RETURN_SO before running these tests\n");
+		return (0);
+	}
+
+	openpam_set_feature(OPENPAM_RESTRICT_MODULE_NAME, 0);
+	openpam_set_feature(OPENPAM_VERIFY_MODULE_FILE, 0);
+	openpam_set_feature(OPENPAM_RESTRICT_SERVICE_NAME, 0);
+	openpam_set_feature(OPENPAM_VERIFY_POLICY_FILE, 0);
+	openpam_set_feature(OPENPAM_FALLBACK_TO_OTHER, 0);
+
+	T(set_option);
+
+	return (0);
+}
+
+int
+main(int argc, char *argv[])
+{
+
+	t_main(t_prepare, NULL, argc, argv);
+}
@@ -0,0 +1,177 @@
+/*-
+ * Copyright (c) 2026 Dag-Erling Smørgrav
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote
+ *    products derived from this software without specific prior written
+ *    permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $OpenPAM$
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <dlfcn.h>
+#include <err.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <cryb/test.h>
+
+#include <security/pam_appl.h>
+#include <security/openpam.h>
+
+#include "openpam_impl.h"
+#include "t_pam_conv.h"
+
+#define T_FUNC(n, d)							\
+	static const char *t_ ## n ## _desc = d;			\
+	static int t_ ## n ## _func(OPENPAM_UNUSED(char **desc),	\
+	    OPENPAM_UNUSED(void *arg))
+
+#define T(n)								\
+	t_add_test(&t_ ## n ## _func, NULL, "%s", t_ ## n ## _desc)
+
+const char *pam_return_so;
+
+static struct t_pam_conv_script t_script;
+static struct pam_conv t_pamc = { &t_pam_conv, &t_script };
+
+
+/***************************************************************************
+ * Tests
+ */
+
+T_FUNC(status, "per-service status")
+{
+	struct t_file *tfg, *tfb, *tfs;
+	const char *services[4];
+	int status[3];
+	int pam_err;
+
+	tfg = t_fopen(NULL);
+	t_fprintf(tfg, "auth required %s error=PAM_SUCCESS\n",
+	    pam_return_so);
+	tfb = t_fopen(NULL);
+	t_fprintf(tfb, "auth required %s error=PAM_SUCCESS\n",
+	    pam_return_so);
+	t_fprintf(tfb, "session required /nonexistent/pam_t_missing.so\n");
+	services[0] = tfg->name;
+	services[1] = tfb->name;
+	tfs = t_fopen(NULL);
+	t_fprintf(tfs, "auth bogus %s\n", pam_return_so);
+	services[2] = tfs->name;
+	services[3] = NULL;
+	memset(status, 0xff, sizeof status);
+	pam_err = openpam_preload(services, status);
+	t_printv("openpam_preload() returned %d (%d, %d, %d)\n",
+	    pam_err, status[0], status[1], status[2]);
+	t_fclose(tfg);
+	t_fclose(tfb);
+	t_fclose(tfs);
+	return (pam_err == PAM_SYSTEM_ERR &&
+	    status[0] == PAM_SUCCESS &&
+	    status[1] == PAM_SYSTEM_ERR &&
+	    status[2] == PAM_SYSTEM_ERR);
+}
+
+T_FUNC(lazy_pinned, "modules loaded and pinned")
+{
+	struct t_file *tf;
+	const char *services[2];
+	pam_handle_t *pamh;
+	pam_module_t *module;
+	int pam_err, ret;
+
+	tf = t_fopen(NULL);
+	t_fprintf(tf, "session required %s error=PAM_SUCCESS\n",
+	    pam_return_so);
+	services[0] = tf->name;
+	services[1] = NULL;
+	openpam_set_feature(OPENPAM_LAZY_MODULES, 1);
+	pam_err = openpam_preload(services, NULL);
+	t_printv("openpam_preload() returned %d\n", pam_err);
+	ret = (pam_err == PAM_SUCCESS);
+#ifdef RTLD_NOLOAD
+	/* no transaction is in progress, yet the module is loaded */
+	ret &= (dlopen(pam_return_so, RTLD_NOW | RTLD_NOLOAD) != NULL);
+#endif
+	/* the policy comes from the cache, the module from the registry */
+	pam_err = pam_start(tf->name, "test", &t_pamc, &pamh);
+	t_printv("pam_start() returned %d\n", pam_err);
+	if (pam_err == PAM_SUCCESS) {
+		module = openpam_chain_module(pamh->chains[PAM_SESSION]);
+		ret &= (module != NULL && module->dlh != NULL);
+		pam_err = pam_open_session(pamh, 0);
+		t_printv("pam_open_session() returned %d\n", pam_err);
+		ret &= (pam_err == PAM_SUCCESS);
+		pam_end(pamh, pam_err);
+	} else {
+		ret = 0;
+	}
+	openpam_set_feature(OPENPAM_LAZY_MODULES, 0);
+	t_fclose(tf);
+	return (ret);
+}
+
+
+/***************************************************************************
+ * Boilerplate
+ */
+
+static int
+t_prepare(int argc, char *argv[])
+{
+
+	(void)argc;
+	(void)argv;
+
+	if ((pam_return_so = getenv("PAM_RETURN_SO")) == NULL) {
+		t_printv("define PAM_RETURN_SO before running these tests\n");
+		return (0);
+	}
+
+	openpam_set_feature(OPENPAM_RESTRICT_MODULE_NAME, 0);
+	openpam_set_feature(OPENPAM_VERIFY_MODULE_FILE, 0);
+	openpam_set_feature(OPENPAM_RESTRICT_SERVICE_NAME, 0);
+	openpam_set_feature(OPENPAM_VERIFY_POLICY_FILE, 0);
+	openpam_set_feature(OPENPAM_FALLBACK_TO_OTHER, 0);
+	openpam_set_feature(OPENPAM_CACHE_POLICY, 1);
+
+	T(status);
+	T(lazy_pinned);
+
+	return (0);
+}
+
+int
+main(int argc, char *argv[])
+{
+
+	t_main(t_prepare, NULL, argc, argv);
+}
@@ -0,0 +1,296 @@
+/*-
+ * Copyright (c) 2026 Dag-Erling Smørgrav
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote
+ *    products derived from this software without specific prior written
+ *    permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $OpenPAM$
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <err.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <cryb/test.h>
+
+#include <security/pam_appl.h>
+#include <security/openpam.h>
+
+#include "openpam_impl.h"
+
+#define T_FUNC(n, d)							\
+	static const char *t_ ## n ## _desc = d;			\
+	static int t_ ## n ## _func(OPENPAM_UNUSED(char **desc),	\
+	    OPENPAM_UNUSED(void *arg))
+
+#define T(n)								\
+	t_add_test(&t_ ## n ## _func, NULL, "%s", t_ ## n ## _desc)
+
+/*
+ * Read a line from the temp file and verify that the result matches our
+ * expectations, as in t_openpam_readlinev, and that the words are laid
+ * out back to back immediately after the array.
+ */
+static int
+orlvp_expect(struct t_file *tf, const char **expectedv, int lines, int eof)
+{
+	int expectedc, gotc, i, lineno = 0;
+	char **gotv, *p;
+	int ret;
+
+	ret = 1;
+	expectedc = 0;
+	if (expectedv != NULL)
+		while (expectedv[expectedc] != NULL)
+			++expectedc;
+	gotv = openpam_readlinev_packed(tf->file, &lineno, &gotc);
+	if (t_ferror(tf))
+		err(1, "%s(): %s", __func__, tf->name);
+	if (expectedv != NULL && gotv == NULL) {
+		t_printv("expected %d words, got nothing\n", expectedc);
+		ret = 0;
+	} else if (expectedv == NULL && gotv != NULL) {
+		t_printv("expected nothing, got %d words\n", gotc);
+		ret = 0;
+	} else if (expectedv != NULL && gotv != NULL) {
+		if (expectedc != gotc) {
+			t_printv("expected %d words, got %d\n",
+			    expectedc, gotc);
+			ret = 0;
+		}
+		if (gotv[gotc] != NULL) {
+			t_printv("array is not NULL-terminated\n");
+			ret = 0;
+		}
+		p = (char *)(gotv + gotc + 1);
+		for (i = 0; i < gotc; ++i) {
+			if (strcmp(expectedv[i], gotv[i]) != 0) {
+				t_printv("word %d: expected <<%s>>, "
+				    "got <<%s>>\n", i, expectedv[i], gotv[i]);
+				ret = 0;
+			}
+			if (gotv[i] != p) {
+				t_printv("word %d is not packed\n", i);
+				ret = 0;
+			}
+			p = gotv[i] + strlen(gotv[i]) + 1;
+		}
+	}
+	free(gotv);
+	if (lineno != lines) {
+		t_printv("expected to advance %d lines, advanced %d lines\n",
+		    lines, lineno);
+		ret = 0;
+	}
+	if (eof && !t_feof(tf)) {
+		t_printv("expected EOF, but didn't get it\n");
+		ret = 0;
+	} else if (!eof && t_feof(tf)) {
+		t_printv("didn't expect EOF, but got it anyway\n");
+		ret = 0;
+	}
+	return (ret);
+}
+
+
+/***************************************************************************
+ * Commonly-used lines
+ */
+
+static const char *empty[] = {
+	NULL
+};
+
+static const char *hello_world[] = {
+	"hello",
+	"world",
+	NULL
+};
+
+static const char *quoted[] = {
+	"hello world",
+	"",
+	"a\"b",
+	"c d",
+	NULL
+};
+
+static const char *numbers[] = {
+	"zero", "one", "two", "three", "four", "five", "six", "seven",
+	"eight", "nine", "ten", "eleven", "twelve", "thirteen", "fourteen",
+	"fifteen", "sixteen", "seventeen", "nineteen", "twenty",
+	"twenty-one", "twenty-two", "twenty-three", "twenty-four",
+	"twenty-five", "twenty-six", "twenty-seven", "twenty-eight",
+	"twenty-nine", "thirty", "thirty-one", "thirty-two", "thirty-three",
+	"thirty-four", "thirty-five", "thirty-six", "thirty-seven",
+	"thirty-eight", "thirty-nine", "fourty", "fourty-one", "fourty-two",
+	"fourty-three", "fourty-four", "fourty-five", "fourty-six",
+	"fourty-seven", "fourty-eight", "fourty-nine", "fifty", "fifty-one",
+	"fifty-two", "fifty-three", "fifty-four", "fifty-five", "fifty-six",
+	"fifty-seven", "fifty-eight", "fifty-nine", "sixty", "sixty-one",
+	"sixty-two", "sixty-three", "sixty-four", "sixty-five", "sixty-six",
+	"sixty-seven", "sixty-eight", "sixty-nine", "seventy", "seventy-one",
+	"seventy-two", "seventy-three", "seventy-four", "seventy-five",
+	"seventy-six", "seventy-seven", "seventy-eight", "seventy-nine",
+	"eighty", "eighty-one", "eighty-two", "eighty-three", "eighty-four",
+	"eighty-five", "eighty-six", "eighty-seven", "eighty-eight",
+	"eighty-nine", "ninety", "ninety-one", "ninety-two", "ninety-three",
+	"ninety-four", "ninety-five", "ninety-six", "ninety-seven",
+	"ninety-eight", "ninety-nine", "one hundred", NULL
+};
+
+
+/***************************************************************************
+ * Test cases
+ */
+
+T_FUNC(empty_input, "empty input")
+{
+	struct t_file *tf;
+	int ret;
+
+	tf = t_fopen(NULL);
+	ret = orlvp_expect(tf, NULL, 0 /*lines*/, 1 /*eof*/);
+	t_fclose(tf);
+	return (ret);
+}
+
+T_FUNC(comment, "comment")
+{
+	struct t_file *tf;
+	int ret;
+
+	tf = t_fopen(NULL);
+	t_fprintf(tf, "# comment\n");
+	t_frewind(tf);
+	ret = orlvp_expect(tf, empty, 1 /*lines*/, 0 /*eof*/);
+	t_fclose(tf);
+	return (ret);
+}
+
+T_FUNC(two_words, "two words")
+{
+	struct t_file *tf;
+	int ret;
+
+	tf = t_fopen(NULL);
+	t_fprintf(tf, "hello world\n");
+	t_frewind(tf);
+	ret = orlvp_expect(tf, hello_world, 1 /*lines*/, 0 /*eof*/);
+	t_fclose(tf);
+	return (ret);
+}
+
+T_FUNC(many_words, "many words")
+{
+	struct t_file *tf;
+	const char **word;
+	int ret;
+
+	tf = t_fopen(NULL);
+	for (word = numbers; *word; ++word)
+		t_fprintf(tf, " \"%s\"", *word);
+	t_fprintf(tf, "\n");
+	t_frewind(tf);
+	ret = orlvp_expect(tf, numbers, 1 /*lines*/, 0 /*eof*/);
+	t_fclose(tf);
+	return (ret);
+}
+
+T_FUNC(quoted_words, "quoted and escaped words")
+{
+	struct t_file *tf;
+	int ret;
+
+	tf = t_fopen(NULL);
+	t_fprintf(tf, "'hello world' \"\" a\\\"b c\\ d\n");
+	t_frewind(tf);
+	ret = orlvp_expect(tf, quoted, 1 /*lines*/, 0 /*eof*/);
+	t_fclose(tf);
+	return (ret);
+}
+
+T_FUNC(line_continuation, "line continuation")
+{
+	struct t_file *tf;
+	int ret;
+
+	tf = t_fopen(NULL);
+	t_fprintf(tf, "hello \\\n world\n");
+	t_frewind(tf);
+	ret = orlvp_expect(tf, hello_world, 2 /*lines*/, 0 /*eof*/) &&
+	    orlvp_expect(tf, NULL, 0 /*lines*/, 1 /*eof*/);
+	t_fclose(tf);
+	return (ret);
+}
+
+T_FUNC(unterminated_line, "unterminated line")
+{
+	struct t_file *tf;
+	int ret;
+
+	tf = t_fopen(NULL);
+	t_fprintf(tf, "hello world");
+	t_frewind(tf);
+	ret = orlvp_expect(tf, hello_world, 0 /*lines*/, 1 /*eof*/);
+	t_fclose(tf);
+	return (ret);
+}
+
+
+/***************************************************************************
+ * Boilerplate
+ */
+
+static int
+t_prepare(int argc, char *argv[])
+{
+
+	(void)argc;
+	(void)argv;
+
+	T(empty_input);
+	T(comment);
+	T(two_words);
+	T(many_words);
+	T(quoted_words);
+	T(line_continuation);
+	T(unterminated_line);
+
+	return (0);
+}
+
+int
+main(int argc, char *argv[])
+{
+
+	t_main(t_prepare, NULL, argc, argv);
+}
@@ -0,0 +1,204 @@
+/*-
+ * Copyright (c) 2026 Dag-Erling Smørgrav
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote
+ *    products derived from this software without specific prior written
+ *    permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $OpenPAM$
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <err.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <cryb/test.h>
+
+#include <security/pam_appl.h>
+#include <security/openpam.h>
+
+#include "openpam_impl.h"
+#include "t_pam_conv.h"
+
+#define T_FUNC(n, d)							\
+	static const char *t_ ## n ## _desc = d;			\
+	static int t_ ## n ## _func(OPENPAM_UNUSED(char **desc),	\
+	    OPENPAM_UNUSED(void *arg))
+
+#define T(n)								\
+	t_add_test(&t_ ## n ## _func, NULL, "%s", t_ ## n ## _desc)
+
+const char *pam_return_so;
+
+static struct t_pam_conv_script t_script;
+static struct pam_conv t_pamc = { &t_pam_conv, &t_script };
+
+static struct t_file *t_policy;
+
+static int t_cleanups;
+
+static void
+t_cleanup(pam_handle_t *pamh, void *data, int status)
+{
+
+	(void)pamh;
+	(void)data;
+	t_printv("cleanup called with status %d\n", status);
+	if (status == PAM_SUCCESS)
+		++t_cleanups;
+}
+
+/*
+ * Check that a string item has the expected value, which may be NULL.
+ */
+static int
+t_check_item(pam_handle_t *pamh, int item, const char *expected)
+{
+	const void *value;
+
+	if (pam_get_item(pamh, item, &value) != PAM_SUCCESS)
+		return (0);
+	t_printv("%s = %s\n", pam_item_name[item],
+	    value ? (const char *)value : "(null)");
+	if (value == NULL || expected == NULL)
+		return (value == expected);
+	return (strcmp(value, expected) == 0);
+}
+
+
+/***************************************************************************
+ * Tests
+ */
+
+T_FUNC(cleared, "transaction state cleared")
+{
+	pam_handle_t *pamh;
+	pam_chain_t *chain;
+	const void *host, *conv;
+	int pam_err, ret;
+
+	pam_err = pam_start(t_policy->name, "alice", &t_pamc, &pamh);
+	t_printv("pam_start() returned %d\n", pam_err);
+	if (pam_err != PAM_SUCCESS)
+		return (0);
+	chain = pamh->chains[PAM_AUTH];
+	pam_get_item(pamh, PAM_HOST, &host);
+	pam_get_item(pamh, PAM_CONV, &conv);
+	t_cleanups = 0;
+	ret = pam_set_item(pamh, PAM_TTY, "tty0") == PAM_SUCCESS &&
+	    pam_set_item(pamh, PAM_AUTHTOK, "secret") == PAM_SUCCESS &&
+	    pam_putenv(pamh, "T_RESET=1") == PAM_SUCCESS &&
+	    pam_set_data(pamh, "t_reset", &t_cleanups, t_cleanup) ==
+	    PAM_SUCCESS;
+	pam_err = openpam_reset(pamh, "bob");
+	t_printv("openpam_reset() returned %d\n", pam_err);
+	ret = ret && pam_err == PAM_SUCCESS &&
+	    t_cleanups == 1 &&
+	    pamh->module_data == NULL &&
+	    pam_getenv(pamh, "T_RESET") == NULL &&
+	    t_check_item(pamh, PAM_SERVICE, t_policy->name) &&
+	    t_check_item(pamh, PAM_USER, "bob") &&
+	    t_check_item(pamh, PAM_TTY, NULL) &&
+	    t_check_item(pamh, PAM_AUTHTOK, NULL) &&
+	    t_check_item(pamh, PAM_HOST, host) &&
+	    pamh->item[PAM_CONV] == conv &&
+	    pamh->chains[PAM_AUTH] == chain;
+	pam_end(pamh, pam_err);
+	return (ret);
+}
+
+T_FUNC(reused, "consecutive transactions")
+{
+	pam_handle_t *pamh;
+	int i, pam_err, ret;
+
+	pam_err = pam_start(t_policy->name, "alice", &t_pamc, &pamh);
+	t_printv("pam_start() returned %d\n", pam_err);
+	if (pam_err != PAM_SUCCESS)
+		return (0);
+	for (ret = 1, i = 0; ret && i < 3; ++i) {
+		pam_err = pam_authenticate(pamh, 0);
+		t_printv("pam_authenticate() returned %d\n", pam_err);
+		ret = (pam_err == PAM_SUCCESS) &&
+		    pam_putenv(pamh, "T_RESET=1") == PAM_SUCCESS &&
+		    (pam_err = openpam_reset(pamh, "bob")) == PAM_SUCCESS;
+	}
+	pam_end(pamh, pam_err);
+	return (ret);
+}
+
+
+/***************************************************************************
+ * Boilerplate
+ */
+
+static int
+t_prepare(int argc, char *argv[])
+{
+
+	(void)argc;
+	(void)argv;
+
+	if ((pam_return_so = getenv("PAM_RETURN_SO")) == NULL) {
+		t_printv("define PAM_RETURN_SO before running these tests\n");
+		return (0);
+	}
+
+	openpam_set_feature(OPENPAM_RESTRICT_MODULE_NAME, 0);
+	openpam_set_feature(OPENPAM_VERIFY_MODULE_FILE, 0);
+	openpam_set_feature(OPENPAM_RESTRICT_SERVICE_NAME, 0);
+	openpam_set_feature(OPENPAM_VERIFY_POLICY_FILE, 0);
+	openpam_set_feature(OPENPAM_FALLBACK_TO_OTHER, 0);
+
+	t_policy = t_fopen(NULL);
+	t_fprintf(t_policy, "auth required %s error=PAM_SUCCESS\n",
+	    pam_return_so);
+	fflush(t_policy->file);
+
+	T(cleared);
+	T(reused);
+
+	return (0);
+}
+
+static void
+t_cleanup_policy(void)
+{
+
+	t_fclose(t_policy);
+}
+
+int
+main(int argc, char *argv[])
+{
+
+	t_main(t_prepare, t_cleanup_policy, argc, argv);
+}
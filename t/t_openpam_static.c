@@ -0,0 +1,151 @@
+/*-
+ * Copyright (c) 2026 Dag-Erling Smørgrav
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote
+ *    products derived from this software without specific prior written
+ *    permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $OpenPAM$
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <err.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <cryb/test.h>
+
+#include <security/pam_appl.h>
+#include <security/openpam.h>
+
+#include "openpam_impl.h"
+#include "t_pam_conv.h"
+
+#define T_FUNC(n, d)							\
+	static const char *t_ ## n ## _desc = d;			\
+	static int t_ ## n ## _func(OPENPAM_UNUSED(char **desc),	\
+	    OPENPAM_UNUSED(void *arg))
+
+#define T(n)								\
+	t_add_test(&t_ ## n ## _func, NULL, "%s", t_ ## n ## _desc)
+
+static struct t_pam_conv_script t_script;
+static struct pam_conv t_pamc = { &t_pam_conv, &t_script };
+
+/*
+ * Start a transaction with a one-line policy, check that the module came
+ * from libpam itself, and return the result of pam_authenticate().
+ */
+static int
+t_authenticate_static(const char *line)
+{
+	struct t_file *tf;
+	pam_handle_t *pamh;
+	pam_module_t *module;
+	int pam_err;
+
+	tf = t_fopen(NULL);
+	t_fprintf(tf, "%s\n", line);
+	pam_err = pam_start(tf->name, "test", &t_pamc, &pamh);
+	t_printv("pam_start() returned %d\n", pam_err);
+	t_fclose(tf);
+	if (pam_err != PAM_SUCCESS)
+		return (pam_err);
+	module = pamh->chains[PAM_AUTH]->module;
+	if (module == NULL || module->dlh != NULL) {
+		t_printv("not a static module\n");
+		pam_err = PAM_SYSTEM_ERR;
+	} else {
+		t_printv("using static %s\n", module->path);
+		pam_err = pam_authenticate(pamh, 0);
+		t_printv("pam_authenticate() returned %d\n", pam_err);
+	}
+	pam_end(pamh, pam_err);
+	return (pam_err);
+}
+
+
+/***************************************************************************
+ * Tests
+ */
+
+T_FUNC(bare_name, "static module by bare name")
+{
+
+	return (t_authenticate_static("auth required pam_permit") == PAM_SUCCESS);
+}
+
+T_FUNC(suffixed_name, "static module by full name")
+{
+
+	return (t_authenticate_static("auth required pam_deny" PAM_SOEXT) ==
+	    PAM_AUTH_ERR);
+}
+
+T_FUNC(options, "static module with options")
+{
+
+	return (t_authenticate_static("auth required pam_return "
+	    "error=PAM_PERM_DENIED") == PAM_PERM_DENIED);
+}
+
+
+/***************************************************************************
+ * Boilerplate
+ */
+
+static int
+t_prepare(int argc, char *argv[])
+{
+
+	(void)argc;
+	(void)argv;
+
+	/* make sure nothing can be found on disk */
+	openpam_module_path[0] = "/nonexistent";
+	openpam_module_path[1] = NULL;
+
+	openpam_set_feature(OPENPAM_RESTRICT_SERVICE_NAME, 0);
+	openpam_set_feature(OPENPAM_VERIFY_POLICY_FILE, 0);
+	openpam_set_feature(OPENPAM_FALLBACK_TO_OTHER, 0);
+
+	T(bare_name);
+	T(suffixed_name);
+	T(options);
+
+	return (0);
+}
+
+int
+main(int argc, char *argv[])
+{
+
+	t_main(t_prepare, NULL, argc, argv);
+}
@@ -0,0 +1,306 @@
+/*-
+ * Copyright (c) 2026 Dag-Erling Smørgrav
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote
+ *    products derived from this software without specific prior written
+ *    permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $OpenPAM$
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <cryb/test.h>
+
+#include <security/pam_appl.h>
+#include <security/openpam.h>
+
+#include "openpam_impl.h"
+#include "t_pam_conv.h"
+
+#define T_FUNC(n, d)							\
+	static const char *t_ ## n ## _desc = d;			\
+	static int t_ ## n ## _func(OPENPAM_UNUSED(char **desc),	\
+	    OPENPAM_UNUSED(void *arg))
+
+#define T(n)								\
+	t_add_test(&t_ ## n ## _func, NULL, "%s", t_ ## n ## _desc)
+
+const char *pam_return_so;
+
+/*
+ * Create a policy which calls pam_return twice, once failing and once
+ * succeeding, and run the given number of transactions against it.
+ */
+static struct t_file *
+t_policy(int n)
+{
+	struct t_pam_conv_script script;
+	struct pam_conv pamc;
+	struct t_file *tf;
+	pam_handle_t *pamh;
+	int i, pam_err;
+
+	memset(&script, 0, sizeof script);
+	pamc.conv = &t_pam_conv;
+	pamc.appdata_ptr = &script;
+	tf = t_fopen(NULL);
+	t_fprintf(tf, "auth optional %s error=PAM_AUTH_ERR\n", pam_return_so);
+	t_fprintf(tf, "auth required %s error=PAM_SUCCESS\n", pam_return_so);
+	for (i = 0; i < n; ++i) {
+		pam_err = pam_start(tf->name, "test", &pamc, &pamh);
+		if (pam_err != PAM_SUCCESS) {
+			t_printv("pam_start() returned %d\n", pam_err);
+			break;
+		}
+		pam_err = pam_authenticate(pamh, 0);
+		pam_end(pamh, pam_err);
+	}
+	return (tf);
+}
+
+/*
+ * Look up the record for a given service, if there is one.
+ */
+static struct openpam_stats *
+t_find(struct openpam_stats *stats, size_t nstats, const char *service)
+{
+	size_t i;
+
+	for (i = 0; i < nstats; ++i) {
+		if (strcmp(stats[i].service, service) == 0) {
+			t_printv("%s %s %s: %lu calls, %llu ns\n",
+			    stats[i].facility, stats[i].module,
+			    pam_sm_func_name[stats[i].primitive],
+			    stats[i].calls, stats[i].nsec);
+			return (&stats[i]);
+		}
+	}
+	t_printv("no record for %s\n", service);
+	return (NULL);
+}
+
+/*
+ * Threads which authenticate using clones of a common template, all
+ * starting at the same time.
+ */
+#define T_NTHREADS	8
+#define T_NCALLS	16
+
+static pthread_mutex_t t_gate_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t t_gate_cv = PTHREAD_COND_INITIALIZER;
+static int t_gate_open;
+
+static void *
+t_thread(void *arg)
+{
+	pam_handle_t *pamh = arg;
+	int i;
+
+	pthread_mutex_lock(&t_gate_mtx);
+	while (!t_gate_open)
+		pthread_cond_wait(&t_gate_cv, &t_gate_mtx);
+	pthread_mutex_unlock(&t_gate_mtx);
+	for (i = 0; i < T_NCALLS; ++i)
+		pam_authenticate(pamh, 0);
+	return (NULL);
+}
+
+
+/***************************************************************************
+ * Tests
+ */
+
+T_FUNC(counts, "calls, results and latencies are counted")
+{
+	struct openpam_stats *stats, *os;
+	struct t_file *tf;
+	unsigned long sum;
+	size_t nstats;
+	int i, ret;
+
+	tf = t_policy(3);
+	if (openpam_get_stats(&stats, &nstats) != PAM_SUCCESS) {
+		t_fclose(tf);
+		return (0);
+	}
+	ret = (os = t_find(stats, nstats, tf->name)) != NULL &&
+	    strcmp(os->facility, "auth") == 0 &&
+	    strcmp(os->module, pam_return_so) == 0 &&
+	    os->primitive == PAM_SM_AUTHENTICATE &&
+	    os->calls == 6 &&
+	    os->result[PAM_SUCCESS] == 3 &&
+	    os->result[PAM_AUTH_ERR] == 3;
+	for (sum = 0, i = 0; ret && i < OPENPAM_STATS_BUCKETS; ++i)
+		sum += os->latency[i];
+	ret = ret && sum == 6;
+	free(stats);
+	t_fclose(tf);
+	return (ret);
+}
+
+T_FUNC(reset, "counters can be reset")
+{
+	struct openpam_stats *stats, *os;
+	struct t_file *tf;
+	size_t nstats;
+	int ret;
+
+	tf = t_policy(2);
+	openpam_reset_stats();
+	if (openpam_get_stats(&stats, &nstats) != PAM_SUCCESS) {
+		t_fclose(tf);
+		return (0);
+	}
+	ret = (os = t_find(stats, nstats, tf->name)) != NULL &&
+	    os->calls == 0 &&
+	    os->result[PAM_SUCCESS] == 0 &&
+	    os->nsec == 0;
+	free(stats);
+	t_fclose(tf);
+	return (ret);
+}
+
+T_FUNC(disabled, "nothing is recorded when disabled")
+{
+	struct openpam_stats *stats;
+	struct t_file *tf;
+	size_t nstats;
+	int ret;
+
+	openpam_set_feature(OPENPAM_MODULE_STATS, 0);
+	tf = t_policy(1);
+	openpam_set_feature(OPENPAM_MODULE_STATS, 1);
+	if (openpam_get_stats(&stats, &nstats) != PAM_SUCCESS) {
+		t_fclose(tf);
+		return (0);
+	}
+	ret = t_find(stats, nstats, tf->name) == NULL;
+	free(stats);
+	t_fclose(tf);
+	return (ret);
+}
+
+T_FUNC(clones, "concurrent clones share a record")
+{
+	struct t_pam_conv_script script;
+	struct pam_conv pamc;
+	struct openpam_stats *stats, *os;
+	struct t_file *tf;
+	pam_handle_t *tmpl, *pamh[T_NTHREADS];
+	pthread_t thr[T_NTHREADS];
+	size_t i, n, nstats;
+	int pam_err, ret;
+
+	memset(&script, 0, sizeof script);
+	pamc.conv = &t_pam_conv;
+	pamc.appdata_ptr = &script;
+	tf = t_policy(0);
+	pam_err = pam_start(tf->name, "test", &pamc, &tmpl);
+	t_printv("pam_start() returned %d\n", pam_err);
+	if (pam_err != PAM_SUCCESS) {
+		t_fclose(tf);
+		return (0);
+	}
+	for (n = 0; n < T_NTHREADS; ++n) {
+		if (openpam_clone(tmpl, &pamh[n]) != PAM_SUCCESS)
+			break;
+		if (pthread_create(&thr[n], NULL, t_thread, pamh[n]) != 0) {
+			pam_end(pamh[n], PAM_SUCCESS);
+			break;
+		}
+	}
+	pthread_mutex_lock(&t_gate_mtx);
+	t_gate_open = 1;
+	pthread_cond_broadcast(&t_gate_cv);
+	pthread_mutex_unlock(&t_gate_mtx);
+	for (i = 0; i < n; ++i) {
+		pthread_join(thr[i], NULL);
+		pam_end(pamh[i], PAM_SUCCESS);
+	}
+	pam_end(tmpl, PAM_SUCCESS);
+	ret = (n == T_NTHREADS);
+	if (!ret || openpam_get_stats(&stats, &nstats) != PAM_SUCCESS) {
+		t_fclose(tf);
+		return (0);
+	}
+	/* exactly one record, which saw every call */
+	for (i = n = 0; i < nstats; ++i)
+		if (strcmp(stats[i].service, tf->name) == 0)
+			++n;
+	ret = n == 1 &&
+	    (os = t_find(stats, nstats, tf->name)) != NULL &&
+	    os->calls == 2 * T_NTHREADS * T_NCALLS &&
+	    os->result[PAM_SUCCESS] == T_NTHREADS * T_NCALLS &&
+	    os->result[PAM_AUTH_ERR] == T_NTHREADS * T_NCALLS;
+	free(stats);
+	t_fclose(tf);
+	return (ret);
+}
+
+
+/***************************************************************************
+ * Boilerplate
+ */
+
+static int
+t_prepare(int argc, char *argv[])
+{
+
+	(void)argc;
+	(void)argv;
+
+	if ((pam_return_so = getenv("PAM_RETURN_SO")) == NULL) {
+		t_printv("define PAM_RETURN_SO before running these tests\n");
+		return (0);
+	}
+
+	openpam_set_feature(OPENPAM_RESTRICT_MODULE_NAME, 0);
+	openpam_set_feature(OPENPAM_VERIFY_MODULE_FILE, 0);
+	openpam_set_feature(OPENPAM_RESTRICT_SERVICE_NAME, 0);
+	openpam_set_feature(OPENPAM_VERIFY_POLICY_FILE, 0);
+	openpam_set_feature(OPENPAM_FALLBACK_TO_OTHER, 0);
+
+	T(counts);
+	T(reset);
+	T(disabled);
+	T(clones);
+
+	return (0);
+}
+
+int
+main(int argc, char *argv[])
+{
+
+	t_main(t_prepare, NULL, argc, argv);
+}
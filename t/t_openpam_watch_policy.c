@@ -0,0 +1,178 @@
+/*-
+ * Copyright (c) 2026 Dag-Erling Smørgrav
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote
+ *    products derived from this software without specific prior written
+ *    permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $OpenPAM$
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <err.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <cryb/test.h>
+
+#include <security/pam_appl.h>
+#include <security/openpam.h>
+
+#include "openpam_impl.h"
+#include "t_pam_conv.h"
+#include "t_pam_policy.h"
+
+#define T_FUNC(n, d)							\
+	static const char *t_ ## n ## _desc = d;			\
+	static int t_ ## n ## _func(OPENPAM_UNUSED(char **desc),	\
+	    OPENPAM_UNUSED(void *arg))
+
+#define T(n)								\
+	t_add_test(&t_ ## n ## _func, NULL, "%s", t_ ## n ## _desc)
+
+const char *pam_return_so;
+
+
+/***************************************************************************
+ * Tests
+ */
+
+T_FUNC(unchanged, "unchanged policy")
+{
+	struct t_file *tf;
+	int ret;
+
+	tf = t_fopen(NULL);
+	t_write_policy(tf, PAM_SUCCESS);
+	ret = t_authenticate(tf->name, PAM_SUCCESS) &&
+	    t_authenticate(tf->name, PAM_SUCCESS) &&
+	    t_authenticate(tf->name, PAM_SUCCESS);
+	t_fclose(tf);
+	return (ret);
+}
+
+T_FUNC(modified, "policy modified in place")
+{
+	struct t_file *tf;
+	int ret;
+
+	tf = t_fopen(NULL);
+	t_write_policy(tf, PAM_SUCCESS);
+	ret = t_authenticate(tf->name, PAM_SUCCESS) &&
+	    t_authenticate(tf->name, PAM_SUCCESS);
+	t_write_policy(tf, PAM_AUTH_ERR);
+	ret = ret && t_authenticate(tf->name, PAM_AUTH_ERR);
+	t_fclose(tf);
+	return (ret);
+}
+
+T_FUNC(replaced, "policy replaced by rename")
+{
+	struct t_file *tf, *tfn;
+	int ret;
+
+	tf = t_fopen(NULL);
+	t_write_policy(tf, PAM_SUCCESS);
+	ret = t_authenticate(tf->name, PAM_SUCCESS) &&
+	    t_authenticate(tf->name, PAM_SUCCESS);
+	tfn = t_fopen(NULL);
+	t_write_policy(tfn, PAM_PERM_DENIED);
+	if (rename(tfn->name, tf->name) != 0) {
+		t_printv("rename(): %s\n", strerror(errno));
+		ret = 0;
+	}
+	ret = ret && t_authenticate(tf->name, PAM_PERM_DENIED);
+	t_fclose(tfn);
+	t_fclose(tf);
+	return (ret);
+}
+
+T_FUNC(included, "included policy modified")
+{
+	struct t_file *tf, *tfi;
+	int ret;
+
+	tfi = t_fopen(NULL);
+	t_write_policy(tfi, PAM_SUCCESS);
+	tf = t_fopen(NULL);
+	t_fprintf(tf, "auth include %s\n", tfi->name);
+	fflush(tf->file);
+	ret = t_authenticate(tf->name, PAM_SUCCESS) &&
+	    t_authenticate(tf->name, PAM_SUCCESS);
+	t_write_policy(tfi, PAM_AUTH_ERR);
+	ret = ret && t_authenticate(tf->name, PAM_AUTH_ERR);
+	t_fclose(tf);
+	t_fclose(tfi);
+	return (ret);
+}
+
+
+/***************************************************************************
+ * Boilerplate
+ */
+
+static int
+t_prepare(int argc, char *argv[])
+{
+
+	(void)argc;
+	(void)argv;
+
+	if ((pam_return_so = getenv("PAM_RETURN_SO")) == NULL) {
+		t_printv("define PAM_RETURN_SO before running these tests\n");
+		return (0);
+	}
+
+	openpam_set_feature(OPENPAM_RESTRICT_MODULE_NAME, 0);
+	openpam_set_feature(OPENPAM_VERIFY_MODULE_FILE, 0);
+	openpam_set_feature(OPENPAM_RESTRICT_SERVICE_NAME, 0);
+	openpam_set_feature(OPENPAM_VERIFY_POLICY_FILE, 0);
+	openpam_set_feature(OPENPAM_FALLBACK_TO_OTHER, 0);
+	openpam_set_feature(OPENPAM_CACHE_POLICY, 1);
+	if (openpam_watch_policy(1) != PAM_SUCCESS) {
+		t_printv("policy watcher not available\n");
+		return (0);
+	}
+
+	T(unchanged);
+	T(modified);
+	T(replaced);
+	T(included);
+
+	return (0);
+}
+
+int
+main(int argc, char *argv[])
+{
+
+	t_main(t_prepare, NULL, argc, argv);
+}
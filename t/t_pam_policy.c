@@ -0,0 +1,90 @@
+/*-
+ * Copyright (c) 2026 Dag-Erling Smørgrav
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote
+ *    products derived from this software without specific prior written
+ *    permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $OpenPAM$
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <cryb/test.h>
+
+#include <security/pam_appl.h>
+#include <security/openpam.h>
+
+#include "openpam_impl.h"
+
+#include "t_pam_conv.h"
+#include "t_pam_policy.h"
+
+static struct t_pam_conv_script t_script;
+static struct pam_conv t_pamc = { &t_pam_conv, &t_script };
+
+/*
+ * Replace the contents of a policy file with a single auth entry which
+ * uses pam_return to return the specified error code.
+ */
+void
+t_write_policy(struct t_file *tf, int modret)
+{
+
+	t_frewind(tf);
+	if (ftruncate(fileno(tf->file), 0) != 0)
+		t_printv("ftruncate(): %s\n", strerror(errno));
+	t_fprintf(tf, "auth required %s error=%s\n",
+	    pam_return_so, pam_err_name[modret]);
+	fflush(tf->file);
+}
+
+/*
+ * Start a transaction for the given service, authenticate, and check
+ * that we get the expected result.
+ */
+int
+t_authenticate(const char *service, int expected)
+{
+	pam_handle_t *pamh;
+	int pam_err;
+
+	pam_err = pam_start(service, "test", &t_pamc, &pamh);
+	if (pam_err != PAM_SUCCESS) {
+		t_printv("pam_start() returned %d\n", pam_err);
+		return (0);
+	}
+	pam_err = pam_authenticate(pamh, 0);
+	t_printv("pam_authenticate() returned %d\n", pam_err);
+	pam_end(pamh, pam_err);
+	return (pam_err == expected);
+}